@@ -0,0 +1,111 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "capacity_ledger.hpp"
+
+#include <fast-lib/log.hpp>
+
+FASTLIB_LOG_INIT(capacity_ledger_log, "Capacity_ledger")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(capacity_ledger_log, trace);
+
+/**
+ * \brief Take an amount from an atomic counter if enough is available.
+ */
+bool try_take(std::atomic<long long> &available, long long amount, bool allow_overbooking)
+{
+	if (allow_overbooking) {
+		available -= amount;
+		return true;
+	}
+	auto current = available.load();
+	do {
+		if (current < amount)
+			return false;
+	} while (!available.compare_exchange_weak(current, current - amount));
+	return true;
+}
+
+Capacity_ledger::Capacity_ledger(const std::vector<Host_capacity> &hosts)
+{
+	entries.reserve(hosts.size());
+	for (const auto &host : hosts) {
+		std::unique_ptr<Entry> entry(new Entry);
+		entry->host = host.host;
+		entry->memory = host.memory;
+		entry->vcpus = host.vcpus;
+		for (const auto &id_count : host.devices)
+			entry->devices[id_count.first] = id_count.second;
+		entries.push_back(std::move(entry));
+	}
+}
+
+size_t Capacity_ledger::size() const
+{
+	return entries.size();
+}
+
+const std::string & Capacity_ledger::get_host(size_t index) const
+{
+	return entries.at(index)->host;
+}
+
+Host_capacity Capacity_ledger::get_capacity(size_t index) const
+{
+	const auto &entry = *entries.at(index);
+	Host_capacity capacity;
+	capacity.host = entry.host;
+	capacity.memory = entry.memory;
+	capacity.vcpus = entry.vcpus;
+	for (const auto &id_count : entry.devices)
+		capacity.devices[id_count.first] = id_count.second;
+	return capacity;
+}
+
+bool Capacity_ledger::try_reserve(size_t index, const Domain_demand &domain, bool allow_overbooking)
+{
+	auto &entry = *entries.at(index);
+	// Check device types first since they cannot be added later.
+	for (const auto &id_count : domain.devices) {
+		if (id_count.second != 0 && entry.devices.count(id_count.first) == 0)
+			return false;
+	}
+	const auto memory = static_cast<long long>(domain.memory);
+	if (!try_take(entry.memory, memory, false))
+		return false;
+	if (!try_take(entry.vcpus, domain.vcpus, allow_overbooking)) {
+		entry.memory += memory;
+		return false;
+	}
+	for (auto id_count_it = domain.devices.begin(); id_count_it != domain.devices.end(); ++id_count_it) {
+		if (id_count_it->second == 0)
+			continue;
+		if (!try_take(entry.devices.at(id_count_it->first), id_count_it->second, false)) {
+			// Roll back what was taken so far.
+			FASTLIB_LOG(capacity_ledger_log, trace) << "Not enough devices of type " << id_count_it->first.str() << " left on " << entry.host << ".";
+			for (auto taken_it = domain.devices.begin(); taken_it != id_count_it; ++taken_it) {
+				if (taken_it->second != 0)
+					entry.devices.at(taken_it->first) += taken_it->second;
+			}
+			entry.vcpus += domain.vcpus;
+			entry.memory += memory;
+			return false;
+		}
+	}
+	return true;
+}
+
+void Capacity_ledger::release(size_t index, const Domain_demand &domain)
+{
+	auto &entry = *entries.at(index);
+	entry.memory += static_cast<long long>(domain.memory);
+	entry.vcpus += domain.vcpus;
+	for (const auto &id_count : domain.devices) {
+		if (id_count.second != 0)
+			entry.devices.at(id_count.first) += id_count.second;
+	}
+}
@@ -0,0 +1,94 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef CAPACITY_LEDGER_HPP
+#define CAPACITY_LEDGER_HPP
+
+#include <fast-lib/message/migfra/pci_id.hpp>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+
+using PCI_id = fast::msg::migfra::PCI_id;
+
+/**
+ * \brief Resources a domain needs on its destination.
+ */
+struct Domain_demand
+{
+	std::string name;
+	// Memory in KiB.
+	unsigned long long memory = 0;
+	unsigned int vcpus = 0;
+	// (pci_id : number of attached devices)
+	std::unordered_map<PCI_id, size_t> devices;
+};
+
+/**
+ * \brief Resources left on a destination.
+ *
+ * Values may become negative if vCPUs are overbooked.
+ */
+struct Host_capacity
+{
+	std::string host;
+	// Free memory in KiB.
+	long long memory = 0;
+	// Number of CPUs minus vCPUs of active domains.
+	long long vcpus = 0;
+	// (pci_id : number of devices not attached to any domain)
+	std::unordered_map<PCI_id, long long> devices;
+};
+
+/**
+ * \brief Capacities of the destinations of one evacuation with atomic reservations.
+ *
+ * Every resource of a destination is an atomic counter, so domains can be reserved and released
+ * concurrently without a lock. A reservation either takes all resources a domain needs or none.
+ */
+class Capacity_ledger
+{
+public:
+	explicit Capacity_ledger(const std::vector<Host_capacity> &hosts);
+	Capacity_ledger(const Capacity_ledger &) = delete;
+	Capacity_ledger & operator=(const Capacity_ledger &) = delete;
+
+	size_t size() const;
+	const std::string & get_host(size_t index) const;
+	/**
+	 * \brief Get a snapshot of the capacity left on a destination.
+	 */
+	Host_capacity get_capacity(size_t index) const;
+	/**
+	 * \brief Reserve the resources of a domain on a destination.
+	 *
+	 * \param allow_overbooking Reserve vCPUs even if not enough are left.
+	 * \returns False if not enough resources are left, in which case nothing is reserved.
+	 */
+	bool try_reserve(size_t index, const Domain_demand &domain, bool allow_overbooking);
+	/**
+	 * \brief Release the resources of a domain reserved on a destination.
+	 */
+	void release(size_t index, const Domain_demand &domain);
+private:
+	struct Entry
+	{
+		std::string host;
+		std::atomic<long long> memory;
+		std::atomic<long long> vcpus;
+		// The keys are fixed after construction, so the map itself is only read concurrently.
+		std::unordered_map<PCI_id, std::atomic<long long>> devices;
+	};
+
+	std::vector<std::unique_ptr<Entry>> entries;
+};
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "capacity_prober.hpp"
+
+#include "connection_pool.hpp"
+#include "evacuation_planner.hpp"
+#include "pci_device_handler.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <exception>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+
+FASTLIB_LOG_INIT(capacity_prober_log, "Capacity_prober")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(capacity_prober_log, trace);
+
+/**
+ * \brief Get the port of the libvirt daemon a transport connects to.
+ *
+ * Returns nullptr for transports which do not connect over the network.
+ */
+const char * get_transport_service(const std::string &transport)
+{
+	if (transport == "ssh" || transport == "libssh" || transport == "libssh2")
+		return "22";
+	if (transport == "tcp")
+		return "16509";
+	if (transport == "" || transport == "tls")
+		return "16514";
+	return nullptr;
+}
+
+/**
+ * \brief Check that a host accepts connections of the transport within the timeout.
+ *
+ * Connecting to libvirt itself cannot be interrupted and takes the timeout of the operating system if the host is down.
+ */
+void check_reachable(const std::string &host, const std::string &transport, std::chrono::milliseconds timeout)
+{
+	auto service = get_transport_service(transport);
+	if (host.empty() || !service)
+		return;
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *servinfo = nullptr;
+	int ret;
+	if ((ret = getaddrinfo(host.c_str(), service, &hints, &servinfo)) != 0)
+		throw std::runtime_error("Error resolving " + host + ": getaddrinfo: " + std::string(gai_strerror(ret)));
+	std::unique_ptr<struct addrinfo, void (*)(struct addrinfo *)> servinfo_owner(servinfo, freeaddrinfo);
+	// The send timeout also limits the time connect() blocks.
+	struct timeval tv;
+	tv.tv_sec = timeout.count() / 1000;
+	tv.tv_usec = (timeout.count() % 1000) * 1000;
+	std::string error = "No address found.";
+	for (auto p = servinfo; p != nullptr; p = p->ai_next) {
+		int fd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+		if (fd == -1) {
+			error = std::strerror(errno);
+			continue;
+		}
+		if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0 && connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+			close(fd);
+			return;
+		}
+		error = (errno == EINPROGRESS) ? "Connection timed out." : std::strerror(errno);
+		close(fd);
+	}
+	throw std::runtime_error("Could not connect to " + host + ": " + error);
+}
+
+Capacity_prober::Capacity_prober(std::shared_ptr<Connection_pool> connection_pool, std::chrono::milliseconds timeout, std::chrono::milliseconds cache_ttl, unsigned int workers, size_t max_pending) :
+	connection_pool(std::move(connection_pool)),
+	timeout(timeout),
+	cache_ttl(cache_ttl),
+	workers(workers, max_pending, Thread_pool::Overflow_policy::reject)
+{
+}
+
+std::vector<Host_capacity> Capacity_prober::probe(const std::vector<std::string> &hosts, const std::string &driver, const std::string &transport, std::shared_ptr<const PCI_device_handler> pci_device_handler)
+{
+	std::vector<Host_capacity> capacities(hosts.size());
+	std::vector<bool> found(hosts.size(), false);
+	std::vector<std::pair<size_t, std::shared_future<Host_capacity>>> pending;
+	for (size_t i = 0; i != hosts.size(); ++i) {
+		if (find_cached(get_uri(hosts[i], driver, transport), capacities[i])) {
+			FASTLIB_LOG(capacity_prober_log, trace) << "Use cached capacity of " << hosts[i] << ".";
+			found[i] = true;
+			continue;
+		}
+		try {
+			pending.emplace_back(i, get_probe(hosts[i], driver, transport, pci_device_handler));
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(capacity_prober_log, warn) << "Error probing capacity of " << hosts[i] << ": " << e.what() << " Drop destination.";
+		}
+	}
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	for (auto &index_future : pending) {
+		const auto &host = hosts[index_future.first];
+		auto &future = index_future.second;
+		if (future.wait_until(deadline) != std::future_status::ready) {
+			FASTLIB_LOG(capacity_prober_log, warn) << "Timeout probing capacity of " << host << ". Drop destination.";
+			continue;
+		}
+		try {
+			capacities[index_future.first] = future.get();
+			found[index_future.first] = true;
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(capacity_prober_log, warn) << "Error probing capacity of " << host << ": " << e.what() << " Drop destination.";
+		}
+	}
+	std::vector<Host_capacity> reachable;
+	for (size_t i = 0; i != hosts.size(); ++i) {
+		if (found[i])
+			reachable.push_back(std::move(capacities[i]));
+	}
+	return reachable;
+}
+
+std::shared_future<Host_capacity> Capacity_prober::get_probe(const std::string &host, const std::string &driver, const std::string &transport, std::shared_ptr<const PCI_device_handler> pci_device_handler)
+{
+	auto uri = get_uri(host, driver, transport);
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	auto probe_it = in_flight.find(uri);
+	if (probe_it != in_flight.end()) {
+		FASTLIB_LOG(capacity_prober_log, trace) << "Wait for probe of " << host << " in flight.";
+		return probe_it->second;
+	}
+	auto promise = std::make_shared<std::promise<Host_capacity>>();
+	auto probe = promise->get_future().share();
+	// The probe removes itself from in_flight, which is not possible before the lock is released.
+	workers.submit({[this, promise, uri, host, driver, transport, pci_device_handler]
+	{
+		try {
+			auto capacity = probe_host(host, driver, transport, *pci_device_handler);
+			{
+				std::lock_guard<std::mutex> lock(cache_mutex);
+				if (cache_ttl.count() != 0)
+					cache[uri] = Cache_entry{capacity, std::chrono::steady_clock::now()};
+				in_flight.erase(uri);
+			}
+			promise->set_value(std::move(capacity));
+		} catch (...) {
+			{
+				std::lock_guard<std::mutex> lock(cache_mutex);
+				in_flight.erase(uri);
+			}
+			promise->set_exception(std::current_exception());
+		}
+	}});
+	in_flight.emplace(uri, probe);
+	return probe;
+}
+
+Host_capacity Capacity_prober::probe_host(const std::string &host, const std::string &driver, const std::string &transport, const PCI_device_handler &pci_device_handler) const
+{
+	check_reachable(host, transport, timeout);
+	auto conn = connection_pool->get(host, driver, transport);
+	return get_host_capacity(conn.get(), host, pci_device_handler);
+}
+
+void Capacity_prober::update(const std::vector<Host_capacity> &capacities, const std::string &driver, const std::string &transport)
+{
+	if (cache_ttl.count() == 0)
+		return;
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	for (const auto &capacity : capacities) {
+		// Only probed capacities are updated and the time of probing is kept,
+		// so updated capacities do not live longer than probed ones.
+		auto entry_it = cache.find(get_uri(capacity.host, driver, transport));
+		if (entry_it != cache.end())
+			entry_it->second.capacity = capacity;
+	}
+}
+
+bool Capacity_prober::find_cached(const std::string &uri, Host_capacity &capacity)
+{
+	if (cache_ttl.count() == 0)
+		return false;
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	auto entry_it = cache.find(uri);
+	if (entry_it == cache.end())
+		return false;
+	if (std::chrono::steady_clock::now() - entry_it->second.probed >= cache_ttl) {
+		cache.erase(entry_it);
+		return false;
+	}
+	capacity = entry_it->second.capacity;
+	return true;
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef CAPACITY_PROBER_HPP
+#define CAPACITY_PROBER_HPP
+
+#include "capacity_ledger.hpp"
+#include "thread_pool.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <future>
+#include <cstddef>
+
+class Connection_pool;
+class PCI_device_handler;
+
+/**
+ * \brief Probes the capacities of evacuation destinations concurrently.
+ *
+ * The destinations are probed by a fixed number of workers. Each host is probed at most once at a time:
+ * Evacuations probing a host which is already being probed wait for that probe instead of starting another one.
+ * Before connecting to libvirt, the host is checked to accept connections within the timeout,
+ * so an unreachable host does not occupy a worker for the long timeout of the operating system.
+ * Destinations which do not answer within the timeout or fail are dropped, so a single unreachable host does not abort an evacuation.
+ * Probed capacities are cached for a short time to be reused by back-to-back evacuations.
+ */
+class Capacity_prober
+{
+public:
+	/**
+	 * \brief Construct a Capacity_prober.
+	 *
+	 * \param connection_pool The pool to get connections to the destinations from.
+	 * \param timeout The time to wait for all destinations to answer and to connect to a single destination.
+	 * \param cache_ttl The time a probed capacity is reused. A ttl of 0 disables caching.
+	 * \param workers The number of hosts probed in parallel.
+	 * \param max_pending The number of hosts waiting to be probed, further hosts are dropped.
+	 */
+	Capacity_prober(std::shared_ptr<Connection_pool> connection_pool, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000), std::chrono::milliseconds cache_ttl = std::chrono::milliseconds(10000), unsigned int workers = 8, size_t max_pending = 256);
+	/**
+	 * \brief Get the capacities of all reachable hosts.
+	 *
+	 * \param pci_device_handler Counts the free devices of the hosts.
+	 * \returns The capacities in order of the hosts with unreachable hosts left out.
+	 */
+	std::vector<Host_capacity> probe(const std::vector<std::string> &hosts, const std::string &driver, const std::string &transport, std::shared_ptr<const PCI_device_handler> pci_device_handler);
+	/**
+	 * \brief Overwrite cached capacities.
+	 *
+	 * Should be called with the capacities left after planning an evacuation,
+	 * so the next evacuation does not plan with capacity already taken.
+	 */
+	void update(const std::vector<Host_capacity> &capacities, const std::string &driver, const std::string &transport);
+private:
+	struct Cache_entry
+	{
+		Host_capacity capacity;
+		std::chrono::steady_clock::time_point probed;
+	};
+
+	bool find_cached(const std::string &uri, Host_capacity &capacity);
+	/**
+	 * \brief Get the probe of a host which is in flight or start a new one.
+	 */
+	std::shared_future<Host_capacity> get_probe(const std::string &host, const std::string &driver, const std::string &transport, std::shared_ptr<const PCI_device_handler> pci_device_handler);
+	Host_capacity probe_host(const std::string &host, const std::string &driver, const std::string &transport, const PCI_device_handler &pci_device_handler) const;
+
+	std::shared_ptr<Connection_pool> connection_pool;
+	const std::chrono::milliseconds timeout;
+	const std::chrono::milliseconds cache_ttl;
+	// (uri : cache entry)
+	std::unordered_map<std::string, Cache_entry> cache;
+	// (uri : probe) of the hosts being probed.
+	std::unordered_map<std::string, std::shared_future<Host_capacity>> in_flight;
+	// Held while accessing cache or in_flight.
+	std::mutex cache_mutex;
+	// Declared last to finish all probes before the other members are destroyed.
+	Thread_pool workers;
+};
+
+#endif
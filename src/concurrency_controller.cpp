@@ -0,0 +1,226 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "concurrency_controller.hpp"
+
+#include "connection_pool.hpp"
+#include "utility.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include <future>
+
+FASTLIB_LOG_INIT(concurrency_controller_log, "Concurrency_controller")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(concurrency_controller_log, trace);
+
+//
+// Concurrency_controller::Slot implementation
+//
+
+Concurrency_controller::Slot::Slot(Concurrency_controller &controller, std::string domain_name) :
+	controller(controller),
+	domain_name(std::move(domain_name))
+{
+	// The promise is shared since the admitting thread may still use it after this thread woke up.
+	auto admission = std::make_shared<std::promise<unsigned int>>();
+	auto admitted = admission->get_future();
+	controller.enqueue(this->domain_name, [admission](unsigned int concurrency)
+	{
+		admission->set_value(concurrency);
+	});
+	concurrency = admitted.get();
+}
+
+Concurrency_controller::Slot::Slot(Concurrency_controller &controller, std::string domain_name, unsigned int concurrency) :
+	controller(controller),
+	domain_name(std::move(domain_name)),
+	concurrency(concurrency)
+{
+}
+
+Concurrency_controller::Slot::~Slot()
+{
+	controller.release(domain_name);
+}
+
+unsigned int Concurrency_controller::Slot::get_concurrency() const
+{
+	return concurrency;
+}
+
+//
+// Concurrency_controller implementation
+//
+
+Concurrency_controller::Concurrency_controller(Aimd_policy policy, std::shared_ptr<Connection_pool> connection_pool, std::string driver) :
+	policy(policy),
+	connection_pool(std::move(connection_pool)),
+	driver(std::move(driver)),
+	concurrency(std::max(policy.initial, 1u)),
+	max_concurrency(concurrency),
+	last_bandwidth(0),
+	stopped(false)
+{
+	if (policy.max != 0 && concurrency > policy.max)
+		concurrency = max_concurrency = policy.max;
+}
+
+Concurrency_controller::~Concurrency_controller()
+{
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+		stopped = true;
+	}
+	controller_cv.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+unsigned int Concurrency_controller::get_concurrency() const
+{
+	std::lock_guard<std::mutex> lock(controller_mutex);
+	return concurrency;
+}
+
+unsigned int Concurrency_controller::get_max_concurrency() const
+{
+	std::lock_guard<std::mutex> lock(controller_mutex);
+	return max_concurrency;
+}
+
+void Concurrency_controller::request(std::string domain_name, std::function<void(std::unique_ptr<Slot>)> admitted)
+{
+	enqueue(domain_name, [this, domain_name, admitted](unsigned int concurrency)
+	{
+		admitted(std::unique_ptr<Slot>(new Slot(*this, domain_name, concurrency)));
+	});
+}
+
+void Concurrency_controller::enqueue(std::string domain_name, std::function<void(unsigned int)> admitted)
+{
+	std::vector<std::function<void()>> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+		waiting.push_back(Waiter{std::move(domain_name), std::move(admitted)});
+		callbacks = admit_waiters();
+	}
+	for (auto &callback : callbacks)
+		callback();
+}
+
+void Concurrency_controller::release(const std::string &domain_name)
+{
+	std::vector<std::function<void()>> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+		active.erase(domain_name);
+		callbacks = admit_waiters();
+	}
+	for (auto &callback : callbacks)
+		callback();
+}
+
+std::vector<std::function<void()>> Concurrency_controller::admit_waiters()
+{
+	std::vector<std::function<void()>> callbacks;
+	while (!waiting.empty() && active.size() < concurrency) {
+		auto waiter = std::move(waiting.front());
+		waiting.pop_front();
+		active.emplace(waiter.domain_name, Active_migration());
+		auto admitted = std::move(waiter.admitted);
+		auto admitted_concurrency = concurrency;
+		callbacks.push_back([admitted, admitted_concurrency] {admitted(admitted_concurrency);});
+	}
+	// Start adapting with the first migration.
+	if (!active.empty() && !thread.joinable())
+		thread = std::thread(&Concurrency_controller::run, this);
+	return callbacks;
+}
+
+void Concurrency_controller::run()
+{
+	std::unique_lock<std::mutex> lock(controller_mutex);
+	while (!controller_cv.wait_for(lock, std::chrono::milliseconds(policy.interval), [this] {return stopped;})) {
+		lock.unlock();
+		try {
+			adapt();
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(concurrency_controller_log, warn) << "Exception while adapting concurrency: " << e.what();
+		}
+		lock.lock();
+	}
+}
+
+void Concurrency_controller::adapt()
+{
+	std::vector<std::string> domain_names;
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+		for (const auto &migration : active)
+			domain_names.push_back(migration.first);
+	}
+	if (domain_names.empty())
+		return;
+	// Sample without holding the lock since libvirt calls may take a while.
+	auto conn = connection_pool->get("", driver);
+	std::unordered_map<std::string, Migration_progress> samples;
+	for (const auto &domain_name : domain_names) {
+		std::unique_ptr<virDomain, Deleter_virDomain> domain(virDomainLookupByName(conn.get(), domain_name.c_str()));
+		Migration_progress progress;
+		if (domain && get_job_progress(domain.get(), progress, false))
+			samples[domain_name] = progress;
+	}
+	if (samples.empty())
+		return;
+	std::vector<std::function<void()>> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+		unsigned long long bandwidth = 0;
+		bool converging = true;
+		for (const auto &sample : samples) {
+			auto migration_it = active.find(sample.first);
+			if (migration_it == active.end())
+				continue;
+			const auto &progress = sample.second;
+			auto &migration = migration_it->second;
+			bandwidth += progress.bandwidth;
+			// A whole memory iteration passed without reducing the remaining data.
+			if (migration.sampled && progress.iteration > migration.last.iteration && progress.data_remaining >= migration.last.data_remaining)
+				converging = false;
+			// Memory is dirtied faster than it is transferred.
+			if (progress.iteration > 1 && progress.dirty_rate > progress.bandwidth)
+				converging = false;
+			migration.sampled = true;
+			migration.last = progress;
+		}
+		if (!converging) {
+			auto decreased = std::max(static_cast<unsigned int>(concurrency * policy.decrease_factor), 1u);
+			if (decreased < concurrency) {
+				FASTLIB_LOG(concurrency_controller_log, debug) << "Migrations stopped converging. Decrease concurrency to " << decreased << ".";
+				concurrency = decreased;
+			}
+		} else if (active.size() >= concurrency && bandwidth >= last_bandwidth && (policy.max == 0 || concurrency < policy.max)) {
+			++concurrency;
+			max_concurrency = std::max(max_concurrency, concurrency);
+			FASTLIB_LOG(concurrency_controller_log, debug) << "Bandwidth " << bandwidth << " bytes/s did not decrease. Increase concurrency to " << concurrency << ".";
+			callbacks = admit_waiters();
+		}
+		last_bandwidth = bandwidth;
+	}
+	// Admitted migrations continue in a thread of their own since their callbacks may hold the last reference to the owner of this controller.
+	// Destroying the controller from its own thread would join the thread with itself.
+	if (!callbacks.empty())
+		std::thread([](std::vector<std::function<void()>> callbacks)
+		{
+			for (auto &callback : callbacks)
+				callback();
+		}, std::move(callbacks)).detach();
+}
@@ -0,0 +1,138 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef CONCURRENCY_CONTROLLER_HPP
+#define CONCURRENCY_CONTROLLER_HPP
+
+#include "migration_monitor.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+class Connection_pool;
+
+/**
+ * \brief Additive-increase/multiplicative-decrease of the number of parallel migrations of an evacuation.
+ */
+struct Aimd_policy
+{
+	// Adapt the concurrency of evacuations. If false, evacuations are only limited by the migration-limits.
+	bool adaptive = false;
+	// Number of parallel migrations an evacuation starts with.
+	unsigned int initial = 2;
+	// Upper limit of parallel migrations (0 = unlimited).
+	unsigned int max = 0;
+	// Factor the concurrency is multiplied with if a migration stops converging.
+	double decrease_factor = 0.5;
+	// Time between two adaptions in milliseconds.
+	unsigned int interval = 5000;
+};
+
+/**
+ * \brief Adapts the number of parallel migrations of one evacuation.
+ *
+ * A background thread samples the job statistics of all active migrations every interval.
+ * The concurrency is raised by one while all slots are used and the aggregate bandwidth does not decrease.
+ * It is multiplied by the decrease factor as soon as a migration stops converging, i.e.,
+ * a memory iteration did not reduce the remaining data or the dirty rate exceeds the bandwidth.
+ */
+class Concurrency_controller
+{
+public:
+	/**
+	 * \brief RAII-guard to wait for a free slot in constructor and to free it in destructor.
+	 */
+	class Slot
+	{
+		friend class Concurrency_controller;
+	public:
+		Slot(Concurrency_controller &controller, std::string domain_name);
+		~Slot();
+		Slot(const Slot &) = delete;
+		Slot & operator=(const Slot &) = delete;
+
+		/**
+		 * \brief Get the concurrency at the time the migration started.
+		 */
+		unsigned int get_concurrency() const;
+	private:
+		// Takes over a slot admitted by the controller.
+		Slot(Concurrency_controller &controller, std::string domain_name, unsigned int concurrency);
+
+		Concurrency_controller &controller;
+		const std::string domain_name;
+		unsigned int concurrency;
+	};
+
+	/**
+	 * \param connection_pool The pool to get the connection to the local host from.
+	 * \param driver The libvirt-driver of the migrated domains.
+	 */
+	Concurrency_controller(Aimd_policy policy, std::shared_ptr<Connection_pool> connection_pool, std::string driver);
+	~Concurrency_controller();
+	/**
+	 * \brief Get the current concurrency.
+	 */
+	unsigned int get_concurrency() const;
+	/**
+	 * \brief Get the highest concurrency reached so far.
+	 */
+	unsigned int get_max_concurrency() const;
+	/**
+	 * \brief Wait for a free slot without blocking the calling thread.
+	 *
+	 * The callback is called with the slot as soon as it is free, either from the calling thread,
+	 * from the thread freeing a slot or from a detached thread if the concurrency was raised.
+	 */
+	void request(std::string domain_name, std::function<void(std::unique_ptr<Slot>)> admitted);
+private:
+	// Progress of an active migration at the last adaption.
+	struct Active_migration
+	{
+		bool sampled = false;
+		Migration_progress last;
+	};
+	// Migration waiting for a free slot.
+	struct Waiter
+	{
+		std::string domain_name;
+		// Called with the concurrency at admission.
+		std::function<void(unsigned int)> admitted;
+	};
+
+	void enqueue(std::string domain_name, std::function<void(unsigned int)> admitted);
+	void release(const std::string &domain_name);
+	// Moves waiters into free slots. The returned callbacks must be called without holding the lock.
+	std::vector<std::function<void()>> admit_waiters();
+	void run();
+	void adapt();
+
+	const Aimd_policy policy;
+	std::shared_ptr<Connection_pool> connection_pool;
+	const std::string driver;
+	unsigned int concurrency;
+	unsigned int max_concurrency;
+	unsigned long long last_bandwidth;
+	// (domain name : progress)
+	std::unordered_map<std::string, Active_migration> active;
+	std::deque<Waiter> waiting;
+	bool stopped;
+	mutable std::mutex controller_mutex;
+	std::condition_variable controller_cv;
+	std::thread thread;
+};
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "connection_pool.hpp"
+
+#include "utility.hpp"
+
+#include <libvirt/virterror.h>
+#include <fast-lib/log.hpp>
+
+#include <stdexcept>
+#include <algorithm>
+
+FASTLIB_LOG_INIT(connection_pool_log, "Connection_pool")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(connection_pool_log, trace);
+
+std::string get_uri(const std::string &host, const std::string &driver, const std::string &transport)
+{
+	std::string plus_transport = (transport != "") ? ("+" + transport) : "";
+	std::string mode = (driver == "lxctools") ? "" : "system";
+	return driver + plus_transport + "://" + host + "/" + mode;
+}
+
+Connection_pool::Connection_pool(unsigned int max_connections_per_uri, int keepalive_interval, unsigned int keepalive_count) :
+	max_connections_per_uri(std::max(max_connections_per_uri, 1u)),
+	keepalive_interval(keepalive_interval),
+	keepalive_count(keepalive_count),
+	lifecycle_events(std::make_shared<Lifecycle_events>())
+{
+}
+
+std::shared_ptr<virConnect> Connection_pool::get(const std::string &uri)
+{
+	std::shared_ptr<Entry> entry;
+	{
+		std::lock_guard<std::mutex> lock(entries_mutex);
+		auto &entry_ref = entries[uri];
+		if (!entry_ref)
+			entry_ref = std::make_shared<Entry>();
+		entry = entry_ref;
+	}
+	// Only connections to the same URI wait on each other while a connection is opened.
+	std::lock_guard<std::mutex> lock(entry->mutex);
+	auto &connections = entry->connections;
+	// Drop dead connections. They are closed as soon as the last user releases them.
+	connections.erase(std::remove_if(connections.begin(), connections.end(),
+			[&uri](const std::shared_ptr<virConnect> &conn)
+			{
+				if (virConnectIsAlive(conn.get()) == 1)
+					return false;
+				FASTLIB_LOG(connection_pool_log, debug) << "Drop dead connection to " << uri << ".";
+				return true;
+			}),
+			connections.end());
+	// The pool holds one reference, all others belong to current users.
+	auto least_used = std::min_element(connections.begin(), connections.end(),
+			[](const std::shared_ptr<virConnect> &lhs, const std::shared_ptr<virConnect> &rhs)
+			{
+				return lhs.use_count() < rhs.use_count();
+			});
+	if (least_used != connections.end() && ((*least_used).use_count() == 1 || connections.size() >= max_connections_per_uri))
+		return *least_used;
+	connections.push_back(open(uri));
+	FASTLIB_LOG(connection_pool_log, trace) << connections.size() << " connections open to " << uri << ".";
+	return connections.back();
+}
+
+std::shared_ptr<virConnect> Connection_pool::get(const std::string &host, const std::string &driver, const std::string &transport)
+{
+	return get(get_uri(host, driver, transport));
+}
+
+void Connection_pool::add_lifecycle_listener(Lifecycle_listener listener)
+{
+	std::lock_guard<std::mutex> lock(lifecycle_events->mutex);
+	lifecycle_events->listeners.push_back(std::move(listener));
+}
+
+bool Connection_pool::has_lifecycle_events(virConnectPtr conn) const
+{
+	std::lock_guard<std::mutex> lock(lifecycle_events->mutex);
+	return lifecycle_events->connections.count(conn) != 0;
+}
+
+int Connection_pool::lifecycle_callback(virConnectPtr conn, virDomainPtr domain, int event, int detail, void *opaque)
+{
+	auto context = static_cast<Event_context *>(opaque);
+	try {
+		auto domain_name = get_domain_name(domain);
+		std::vector<Lifecycle_listener> listeners;
+		{
+			std::lock_guard<std::mutex> lock(context->lifecycle_events->mutex);
+			listeners = context->lifecycle_events->listeners;
+		}
+		for (const auto &listener : listeners)
+			listener(conn, context->uri, domain_name, event, detail);
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(connection_pool_log, warn) << "Exception while handling lifecycle event: " << e.what();
+	}
+	return 0;
+}
+
+void Connection_pool::free_event_context(void *opaque)
+{
+	delete static_cast<Event_context *>(opaque);
+}
+
+std::shared_ptr<virConnect> Connection_pool::open(const std::string &uri) const
+{
+	FASTLIB_LOG(connection_pool_log, trace) << "Connect to " + uri;
+	auto raw_conn = virConnectOpen(uri.c_str());
+	if (!raw_conn)
+		throw std::runtime_error("Failed to connect to libvirt with uri: " + uri);
+	if (keepalive_interval > 0) {
+		// Returns 1 if the remote side does not support keepalive, which is not an error.
+		if (virConnectSetKeepAlive(raw_conn, keepalive_interval, keepalive_count) == -1)
+			FASTLIB_LOG(connection_pool_log, warn) << "Error enabling keepalive for " << uri << ": " << virGetLastErrorMessage();
+	}
+	// Receive lifecycle events of all domains on this connection.
+	auto context = new Event_context{lifecycle_events, uri};
+	auto callback_id = virConnectDomainEventRegisterAny(raw_conn, nullptr, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+			to_generic_callback<virConnectDomainEventGenericCallback>(lifecycle_callback), context, free_event_context);
+	if (callback_id == -1) {
+		delete context;
+		FASTLIB_LOG(connection_pool_log, warn) << "Error registering lifecycle events for " << uri << ": " << virGetLastErrorMessage();
+	} else {
+		std::lock_guard<std::mutex> lock(lifecycle_events->mutex);
+		lifecycle_events->connections.insert(raw_conn);
+	}
+	// Registered callbacks hold a reference on the connection, so they have to be removed before closing.
+	auto events = lifecycle_events;
+	return std::shared_ptr<virConnect>(raw_conn, [events, callback_id](virConnectPtr ptr)
+	{
+		if (callback_id != -1) {
+			{
+				std::lock_guard<std::mutex> lock(events->mutex);
+				events->connections.erase(ptr);
+			}
+			virConnectDomainEventDeregisterAny(ptr, callback_id);
+		}
+		virConnectClose(ptr);
+	});
+}
@@ -0,0 +1,118 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef CONNECTION_POOL_HPP
+#define CONNECTION_POOL_HPP
+
+#include "libvirt_event_loop.hpp"
+
+#include <libvirt/libvirt.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <mutex>
+#include <functional>
+
+/**
+ * \brief Build a libvirt URI from host, driver and transport.
+ *
+ * \param host The hostname of the connection (empty for the local host).
+ * \param driver The libvirt-driver of the connection (e.g., qemu).
+ * \param transport The transport protocol to use (e.g., ssh or tcp for remote connections)
+ */
+std::string get_uri(const std::string &host, const std::string &driver, const std::string &transport = "");
+
+/**
+ * \brief Thread-safe pool of libvirt connections keyed by URI.
+ *
+ * Libvirt connections may be used by several threads at once, so connections are shared instead of leased.
+ * A new connection to an URI is only opened if all existing ones are in use and the limit per URI is not reached.
+ * Otherwise the least used connection is returned.
+ * Keepalive messages are enabled on every connection and connections which are not alive anymore
+ * are dropped and replaced on the next request.
+ * Lifecycle events of all domains are received on every connection and passed to the lifecycle listeners.
+ */
+class Connection_pool
+{
+public:
+	/**
+	 * \brief Callback for domain lifecycle events.
+	 *
+	 * Called from the event loop thread with the connection, its URI, the domain name,
+	 * the event (enum virDomainEventType) and its detail.
+	 */
+	using Lifecycle_listener = std::function<void(virConnectPtr conn, const std::string &uri, const std::string &domain_name, int event, int detail)>;
+
+	/**
+	 * \brief Construct a Connection_pool.
+	 *
+	 * \param max_connections_per_uri The maximum number of connections opened to one URI.
+	 * \param keepalive_interval Seconds between keepalive messages (disabled if not positive).
+	 * \param keepalive_count Number of unanswered keepalive messages after which a connection is considered dead.
+	 */
+	Connection_pool(unsigned int max_connections_per_uri = 4, int keepalive_interval = 5, unsigned int keepalive_count = 5);
+	/**
+	 * \brief Get a connection to the URI.
+	 *
+	 * Opens a new connection if required.
+	 * Throws if no connection could be opened.
+	 */
+	std::shared_ptr<virConnect> get(const std::string &uri);
+	/**
+	 * \brief Get a connection to a specific host and libvirt-driver.
+	 */
+	std::shared_ptr<virConnect> get(const std::string &host, const std::string &driver, const std::string &transport = "");
+	/**
+	 * \brief Add a listener which is called on every lifecycle event of a domain on a pooled connection.
+	 */
+	void add_lifecycle_listener(Lifecycle_listener listener);
+	/**
+	 * \brief Check if lifecycle events are received on the connection.
+	 *
+	 * Not all drivers support events, so waiting for an event might require to poll more often.
+	 */
+	bool has_lifecycle_events(virConnectPtr conn) const;
+private:
+	// Shared with the event callbacks and connection deleters which may outlive the pool.
+	struct Lifecycle_events
+	{
+		std::mutex mutex;
+		std::vector<Lifecycle_listener> listeners;
+		std::set<virConnectPtr> connections;
+	};
+	struct Event_context
+	{
+		std::shared_ptr<Lifecycle_events> lifecycle_events;
+		std::string uri;
+	};
+
+	static int lifecycle_callback(virConnectPtr conn, virDomainPtr domain, int event, int detail, void *opaque);
+	static void free_event_context(void *opaque);
+
+	struct Entry
+	{
+		std::mutex mutex;
+		std::vector<std::shared_ptr<virConnect>> connections;
+	};
+
+	std::shared_ptr<virConnect> open(const std::string &uri) const;
+
+	const unsigned int max_connections_per_uri;
+	const int keepalive_interval;
+	const unsigned int keepalive_count;
+	// Has to be started before any connection is opened and stopped after all connections are closed.
+	Libvirt_event_loop event_loop;
+	std::shared_ptr<Lifecycle_events> lifecycle_events;
+	std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+	std::mutex entries_mutex;
+};
+
+#endif
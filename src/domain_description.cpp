@@ -0,0 +1,117 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "domain_description.hpp"
+
+#include "utility.hpp"
+#include "xml_scanner.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <stdexcept>
+
+FASTLIB_LOG_INIT(domain_description_log, "Domain_description")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(domain_description_log, trace);
+
+/**
+ * \brief Convert a memory size of the domain xml to KiB.
+ */
+unsigned long long convert_to_kib(unsigned long long value, const std::string &unit)
+{
+	if (unit == "b" || unit == "bytes")
+		return value / 1024;
+	if (unit == "KB")
+		return value * 1000 / 1024;
+	if (unit == "k" || unit == "KiB")
+		return value;
+	if (unit == "MB")
+		return value * 1000 * 1000 / 1024;
+	if (unit == "M" || unit == "MiB")
+		return value * 1024;
+	if (unit == "GB")
+		return value * 1000 * 1000 * 1000 / 1024;
+	if (unit == "G" || unit == "GiB")
+		return value * 1024 * 1024;
+	if (unit == "TB")
+		return value * 1000 * 1000 * 1000 * 1000 / 1024;
+	if (unit == "T" || unit == "TiB")
+		return value * 1024 * 1024 * 1024;
+	throw std::runtime_error("Unknown memory unit \"" + unit + "\".");
+}
+
+Domain_description::Domain_description(virDomainPtr domain) :
+	vcpu_count(0),
+	memory_size(0)
+{
+	auto xml = get_domain_xml(domain);
+	Xml_scanner scanner(xml);
+	if (scanner.next() != Xml_scanner::Token::start_element || scanner.get_name() != "domain")
+		throw std::runtime_error("Domain xml does not describe a domain.");
+	bool current_memory_found = false;
+	while (scanner.next_child(1)) {
+		auto name = scanner.get_name();
+		if (name == "vcpu") {
+			auto current = scanner.get_attribute("current");
+			auto maximum = scanner.read_text();
+			vcpu_count = to_unsigned(current.empty() ? maximum : current);
+		} else if (name == "currentMemory" || (name == "memory" && !current_memory_found)) {
+			// The current memory may be omitted if it equals the maximum memory.
+			auto unit = scanner.get_attribute("unit", "KiB");
+			memory_size = convert_to_kib(to_unsigned(scanner.read_text()), std::string(unit.data(), unit.size()));
+			current_memory_found = current_memory_found || name == "currentMemory";
+		} else if (name == "devices") {
+			parse_devices(scanner);
+		}
+	}
+	FASTLIB_LOG(domain_description_log, trace) << "Parsed domain description with " << hostdev_addresses.size() << " hostdevs, "
+		<< shmem_devices.size() << " shmem devices, " << vcpu_count << " vCPUs and " << memory_size << " KiB memory.";
+}
+
+void Domain_description::parse_devices(Xml_scanner &scanner)
+{
+	auto devices_depth = scanner.get_depth();
+	while (scanner.next_child(devices_depth)) {
+		if (scanner.get_name() == "hostdev") {
+			// Only PCI hostdevs have a PCI source address.
+			if (scanner.get_attribute("type") != "pci")
+				continue;
+			auto hostdev_depth = scanner.get_depth();
+			while (scanner.next_child(hostdev_depth)) {
+				if (scanner.get_name() != "source")
+					continue;
+				auto source_depth = scanner.get_depth();
+				while (scanner.next_child(source_depth)) {
+					if (scanner.get_name() == "address")
+						hostdev_addresses.push_back(make_pci_address_from_address_element(scanner));
+				}
+			}
+		} else if (scanner.get_name() == "shmem") {
+			shmem_devices.emplace_back(scanner);
+		}
+	}
+}
+
+const std::vector<PCI_address> & Domain_description::get_hostdev_addresses() const
+{
+	return hostdev_addresses;
+}
+
+const std::vector<Ivshmem_device> & Domain_description::get_shmem_devices() const
+{
+	return shmem_devices;
+}
+
+unsigned int Domain_description::get_vcpu_count() const
+{
+	return vcpu_count;
+}
+
+unsigned long long Domain_description::get_memory_size() const
+{
+	return memory_size;
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef DOMAIN_DESCRIPTION_HPP
+#define DOMAIN_DESCRIPTION_HPP
+
+#include "pci_device_handler.hpp"
+#include "ivshmem_handler.hpp"
+
+#include <libvirt/libvirt.h>
+
+#include <string>
+#include <vector>
+
+class Xml_scanner;
+
+/**
+ * \brief The parsed xml description of a domain.
+ *
+ * The xml is fetched and scanned once on construction. A description is created once per migration
+ * and shared by all guards, so none of them has to fetch and parse the xml again.
+ */
+class Domain_description
+{
+public:
+	explicit Domain_description(virDomainPtr domain);
+
+	/**
+	 * \brief Get the source addresses of all PCI hostdevs.
+	 */
+	const std::vector<PCI_address> & get_hostdev_addresses() const;
+	/**
+	 * \brief Get all shmem devices.
+	 */
+	const std::vector<Ivshmem_device> & get_shmem_devices() const;
+	/**
+	 * \brief Get the number of currently active vCPUs.
+	 */
+	unsigned int get_vcpu_count() const;
+	/**
+	 * \brief Get the current memory in KiB.
+	 */
+	unsigned long long get_memory_size() const;
+private:
+	void parse_devices(Xml_scanner &scanner);
+
+	std::vector<PCI_address> hostdev_addresses;
+	std::vector<Ivshmem_device> shmem_devices;
+	unsigned int vcpu_count;
+	unsigned long long memory_size;
+};
+
+#endif
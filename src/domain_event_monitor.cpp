@@ -0,0 +1,93 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "domain_event_monitor.hpp"
+
+#include "utility.hpp"
+
+#include <libvirt/virterror.h>
+#include <fast-lib/log.hpp>
+
+#include <stdexcept>
+#include <algorithm>
+
+FASTLIB_LOG_INIT(domain_event_monitor_log, "Domain_event_monitor")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(domain_event_monitor_log, trace);
+
+int get_state_after_event(int event)
+{
+	switch (event) {
+	case VIR_DOMAIN_EVENT_STARTED:
+	case VIR_DOMAIN_EVENT_RESUMED:
+		return VIR_DOMAIN_RUNNING;
+	case VIR_DOMAIN_EVENT_SUSPENDED:
+		return VIR_DOMAIN_PAUSED;
+	case VIR_DOMAIN_EVENT_SHUTDOWN:
+		return VIR_DOMAIN_SHUTDOWN;
+	case VIR_DOMAIN_EVENT_STOPPED:
+		return VIR_DOMAIN_SHUTOFF;
+	case VIR_DOMAIN_EVENT_PMSUSPENDED:
+		return VIR_DOMAIN_PMSUSPENDED;
+	case VIR_DOMAIN_EVENT_CRASHED:
+		return VIR_DOMAIN_CRASHED;
+	default: // defined and undefined do not change the state
+		return -1;
+	}
+}
+
+void Domain_event_monitor::notify(virConnectPtr conn, const std::string &domain_name, int event)
+{
+	auto state = get_state_after_event(event);
+	if (state == -1)
+		return;
+	std::lock_guard<std::mutex> lock(waiters_mutex);
+	auto range = waiters.equal_range(Key(conn, domain_name));
+	if (range.first == range.second)
+		return;
+	FASTLIB_LOG(domain_event_monitor_log, trace) << "Domain " << domain_name << " changed state to " << state << ".";
+	for (auto it = range.first; it != range.second; ++it) {
+		it->second->notified = true;
+		it->second->state = state;
+	}
+	waiters_cv.notify_all();
+}
+
+void Domain_event_monitor::wait_for_state(virDomainPtr domain, virDomainState expected_state, std::chrono::duration<double> timeout, std::chrono::duration<double> poll_interval)
+{
+	using clock = std::chrono::steady_clock;
+	const auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(timeout);
+	const auto poll_interval_clock = std::chrono::duration_cast<clock::duration>(poll_interval);
+	const Key key(virDomainGetConnect(domain), get_domain_name(domain));
+	// Register before polling the state the first time so no event can be missed.
+	Waiter waiter;
+	std::unique_lock<std::mutex> lock(waiters_mutex);
+	auto waiter_it = waiters.emplace(key, &waiter);
+	try {
+		while (true) {
+			lock.unlock();
+			auto polled_state = get_domain_state(domain);
+			lock.lock();
+			if (polled_state == expected_state || (waiter.notified && waiter.state == expected_state))
+				break;
+			auto now = clock::now();
+			if (now > deadline)
+				throw std::runtime_error("Timeout while waiting for correct vm state.");
+			auto next_poll = std::min(deadline, now + poll_interval_clock);
+			while (!(waiter.notified && waiter.state == expected_state) && clock::now() < next_poll)
+				waiters_cv.wait_until(lock, next_poll);
+			if (waiter.notified && waiter.state == expected_state)
+				break;
+		}
+	} catch (...) {
+		if (!lock.owns_lock())
+			lock.lock();
+		waiters.erase(waiter_it);
+		throw;
+	}
+	waiters.erase(waiter_it);
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef DOMAIN_EVENT_MONITOR_HPP
+#define DOMAIN_EVENT_MONITOR_HPP
+
+#include <libvirt/libvirt.h>
+
+#include <string>
+#include <map>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/**
+ * \brief Completes waiters as soon as a domain reaches the state they wait for.
+ *
+ * Lifecycle events of the domains are passed to notify() from the libvirt event loop.
+ * Waiting threads are woken up by the event and do not have to poll the domain state.
+ * The state is only polled as a fallback in case an event is lost or not supported by the driver.
+ */
+class Domain_event_monitor
+{
+public:
+	/**
+	 * \brief Report a lifecycle event of a domain.
+	 *
+	 * \param conn The connection the event was received on.
+	 * \param domain_name The name of the domain.
+	 * \param event The lifecycle event (one of enum virDomainEventType).
+	 */
+	void notify(virConnectPtr conn, const std::string &domain_name, int event);
+	/**
+	 * \brief Wait until the domain is in a specific state.
+	 *
+	 * \param domain The domain to wait for.
+	 * \param expected_state The state to wait on.
+	 * \param timeout Throws if the state is not reached in time.
+	 * \param poll_interval The interval in which the state is polled in case no event arrives.
+	 */
+	void wait_for_state(virDomainPtr domain, virDomainState expected_state, std::chrono::duration<double> timeout, std::chrono::duration<double> poll_interval);
+private:
+	struct Waiter
+	{
+		bool notified = false;
+		int state = VIR_DOMAIN_NOSTATE;
+	};
+	using Key = std::pair<virConnectPtr, std::string>;
+
+	std::multimap<Key, Waiter *> waiters;
+	std::mutex waiters_mutex;
+	std::condition_variable waiters_cv;
+};
+
+/**
+ * \brief Convert a lifecycle event to the state a domain is in after the event.
+ *
+ * \returns One of enum virDomainState or -1 if the event does not change the state.
+ */
+int get_state_after_event(int event);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "domain_location_index.hpp"
+
+#include "connection_pool.hpp"
+#include "domain_event_monitor.hpp"
+#include "utility.hpp"
+
+#include <libvirt/virterror.h>
+#include <fast-lib/log.hpp>
+
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+
+FASTLIB_LOG_INIT(domain_location_index_log, "Domain_location_index")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(domain_location_index_log, trace);
+
+/**
+ * \brief Get names and states of all active domains on a connection.
+ */
+std::vector<std::pair<std::string, int>> get_active_domain_states(virConnectPtr conn)
+{
+	virDomainPtr *domains;
+	auto num = virConnectListAllDomains(conn, &domains, VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+	if (num < 0)
+		throw std::runtime_error(std::string("Error getting list of active domains: ") + virGetLastErrorMessage());
+	// Take ownership of all domains first so none is leaked if an exception is thrown.
+	std::vector<std::unique_ptr<virDomain, Deleter_virDomain>> owned_domains;
+	owned_domains.reserve(num);
+	for (int i = 0; i != num; ++i)
+		owned_domains.emplace_back(domains[i]);
+	free(domains);
+	std::vector<std::pair<std::string, int>> domain_states;
+	domain_states.reserve(num);
+	for (const auto &domain : owned_domains)
+		domain_states.emplace_back(get_domain_name(domain.get()), get_domain_state(domain.get()));
+	return domain_states;
+}
+
+// Upper limit of nodes seeded in parallel.
+const size_t max_seeding_threads = 16;
+// Time until seeding a node which could not be reached is tried again.
+const std::chrono::seconds seeding_retry_interval(10);
+
+Domain_location_index::Domain_location_index(std::shared_ptr<Connection_pool> connection_pool, std::vector<std::string> nodes, std::string driver, std::string transport) :
+	nodes(std::move(nodes)),
+	driver(std::move(driver)),
+	transport(std::move(transport)),
+	connection_pool(std::move(connection_pool)),
+	// Each node is seeded by at most one job at a time, so the queue never overflows.
+	seeders(std::max<size_t>(std::min(this->nodes.size(), max_seeding_threads), 1), std::max<size_t>(this->nodes.size(), 1), Thread_pool::Overflow_policy::reject)
+{
+	for (const auto &node : this->nodes) {
+		hosts_by_uri[get_uri(node, this->driver, this->transport)] = node;
+		nodes_by_host[node];
+	}
+}
+
+void Domain_location_index::start_seeding()
+{
+	// Seed all nodes in parallel so startup is not delayed by a slow or unreachable node.
+	std::lock_guard<std::mutex> lock(index_mutex);
+	for (auto &host_node : nodes_by_host)
+		start_seeding(host_node.first, host_node.second);
+}
+
+bool Domain_location_index::start_seeding(const std::string &host, Node &node)
+{
+	if (node.seeding || std::chrono::steady_clock::now() < node.next_attempt)
+		return false;
+	// Events are queued from now on, so the listing cannot overwrite them.
+	node.seeding = true;
+	node.pending_events.clear();
+	try {
+		seeders.submit({[this, host] {seed(host);}});
+	} catch (const std::exception &e) {
+		node.seeding = false;
+		node.attempted = true;
+		attempted_cv.notify_all();
+		FASTLIB_LOG(domain_location_index_log, warn) << "Could not seed domain locations of " << host << ": " << e.what();
+		return false;
+	}
+	return true;
+}
+
+void Domain_location_index::notify(const std::string &uri, const std::string &domain_name, int event)
+{
+	auto host_it = hosts_by_uri.find(uri);
+	if (host_it == hosts_by_uri.end())
+		return;
+	const auto &host = host_it->second;
+	auto state = (event == VIR_DOMAIN_EVENT_UNDEFINED) ? VIR_DOMAIN_SHUTOFF : get_state_after_event(event);
+	if (state == -1)
+		return;
+	std::lock_guard<std::mutex> lock(index_mutex);
+	auto &node = nodes_by_host[host];
+	if (node.seeding)
+		node.pending_events.emplace_back(domain_name, state);
+	else
+		apply_event(host, domain_name, state);
+	FASTLIB_LOG(domain_location_index_log, trace) << "Domain " << domain_name << " on " << host << " changed state to " << state << ".";
+}
+
+void Domain_location_index::apply_event(const std::string &host, const std::string &domain_name, int state)
+{
+	if (state == VIR_DOMAIN_SHUTOFF) {
+		auto location_it = locations.find(domain_name);
+		if (location_it == locations.end())
+			return;
+		location_it->second.erase(host);
+		if (location_it->second.empty())
+			locations.erase(location_it);
+	} else {
+		locations[domain_name][host] = state;
+	}
+}
+
+std::vector<Domain_location_index::Location> Domain_location_index::find(const std::string &domain_name)
+{
+	wait_for_initial_seeding();
+	std::vector<Location> found;
+	std::lock_guard<std::mutex> lock(index_mutex);
+	// Events might have been lost while a connection was dead, so these nodes are seeded again.
+	for (auto &host_node : nodes_by_host) {
+		auto &node = host_node.second;
+		if (node.connection && virConnectIsAlive(node.connection.get()) == 1)
+			continue;
+		node.connection.reset();
+		if (start_seeding(host_node.first, node))
+			FASTLIB_LOG(domain_location_index_log, debug) << "No live connection to " << host_node.first << ". Seed domain locations again.";
+		FASTLIB_LOG(domain_location_index_log, warn) << "Domain locations of " << host_node.first << " are unknown.";
+	}
+	auto location_it = locations.find(domain_name);
+	if (location_it != locations.end()) {
+		for (const auto &host_state : location_it->second)
+			found.push_back(Location{host_state.first, host_state.second});
+	}
+	return found;
+}
+
+void Domain_location_index::seed(const std::string &host)
+{
+	FASTLIB_LOG(domain_location_index_log, trace) << "Seed domain locations of " << host << ".";
+	std::shared_ptr<virConnect> conn;
+	std::vector<std::pair<std::string, int>> domain_states;
+	try {
+		// The connection is kept so lifecycle events of this node keep arriving.
+		conn = connection_pool->get(host, driver, transport);
+		domain_states = get_active_domain_states(conn.get());
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(domain_location_index_log, warn) << "Error seeding domain locations of " << host << ": " << e.what();
+		{
+			std::lock_guard<std::mutex> lock(index_mutex);
+			auto &node = nodes_by_host[host];
+			node.seeding = false;
+			node.attempted = true;
+			node.next_attempt = std::chrono::steady_clock::now() + seeding_retry_interval;
+			// The domains of this node are unknown, the events only apply to domains from the last listing.
+			for (const auto &event : node.pending_events)
+				apply_event(host, event.first, event.second);
+			node.pending_events.clear();
+		}
+		attempted_cv.notify_all();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(index_mutex);
+		for (auto location_it = locations.begin(); location_it != locations.end();) {
+			location_it->second.erase(host);
+			if (location_it->second.empty())
+				location_it = locations.erase(location_it);
+			else
+				++location_it;
+		}
+		for (const auto &domain_state : domain_states)
+			locations[domain_state.first][host] = domain_state.second;
+		// Events received meanwhile are newer than the listing.
+		auto &node = nodes_by_host[host];
+		for (const auto &event : node.pending_events)
+			apply_event(host, event.first, event.second);
+		node.pending_events.clear();
+		node.seeding = false;
+		node.attempted = true;
+		node.connection = std::move(conn);
+	}
+	attempted_cv.notify_all();
+}
+
+void Domain_location_index::wait_for_initial_seeding()
+{
+	std::unique_lock<std::mutex> lock(index_mutex);
+	attempted_cv.wait(lock, [this]
+	{
+		return std::all_of(nodes_by_host.begin(), nodes_by_host.end(), [](const std::pair<const std::string, Node> &host_node) {return host_node.second.attempted;});
+	});
+}
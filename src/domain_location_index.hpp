@@ -0,0 +1,112 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef DOMAIN_LOCATION_INDEX_HPP
+#define DOMAIN_LOCATION_INDEX_HPP
+
+#include "thread_pool.hpp"
+
+#include <libvirt/libvirt.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+class Connection_pool;
+
+/**
+ * \brief In-memory index of the hosts active domains are located on.
+ *
+ * The index is seeded in parallel by listing the active domains of every node.
+ * Afterwards it is kept current by the lifecycle events received on the connections to the nodes.
+ * A node is seeded again in the background if its connection died, since events might have been lost in between.
+ * Events received while a node is seeded are applied after its listing, so they are not overwritten by it.
+ */
+class Domain_location_index
+{
+public:
+	/**
+	 * \brief Location of an active domain.
+	 */
+	struct Location
+	{
+		std::string host;
+		int state;
+	};
+
+	/**
+	 * \brief Construct an empty Domain_location_index.
+	 *
+	 * \param connection_pool The pool to get connections to the nodes from.
+	 * \param nodes The nodes to index.
+	 * \param driver The libvirt-driver used to connect to the nodes.
+	 * \param transport The transport used to connect to the nodes.
+	 */
+	Domain_location_index(std::shared_ptr<Connection_pool> connection_pool, std::vector<std::string> nodes, std::string driver = "qemu", std::string transport = "ssh");
+	/**
+	 * \brief Update the index by a lifecycle event.
+	 *
+	 * Events received on connections to URIs not belonging to a node are ignored.
+	 */
+	void notify(const std::string &uri, const std::string &domain_name, int event);
+	/**
+	 * \brief Seed all nodes in parallel in the background.
+	 *
+	 * The index has to receive events before seeding starts, so no event can be missed.
+	 */
+	void start_seeding();
+	/**
+	 * \brief Find all nodes the domain is active on.
+	 *
+	 * Waits for the initial seeding to finish, but does not access the network.
+	 * Nodes whose connection died are seeded again in the background and logged as unknown until then.
+	 */
+	std::vector<Location> find(const std::string &domain_name);
+private:
+	struct Node
+	{
+		// Connection events are received on, empty if the node is not seeded.
+		std::shared_ptr<virConnect> connection;
+		// Seeding was tried at least once.
+		bool attempted = false;
+		bool seeding = false;
+		// Seeding is not retried before this time if it failed.
+		std::chrono::steady_clock::time_point next_attempt;
+		// (domain name : state) of events received while seeding.
+		std::vector<std::pair<std::string, int>> pending_events;
+	};
+
+	void seed(const std::string &host);
+	// Requires the lock. Returns false if the node is seeded already or seeding has to wait for the next attempt.
+	bool start_seeding(const std::string &host, Node &node);
+	void apply_event(const std::string &host, const std::string &domain_name, int state);
+	void wait_for_initial_seeding();
+
+	const std::vector<std::string> nodes;
+	const std::string driver;
+	const std::string transport;
+	// (uri : host)
+	std::unordered_map<std::string, std::string> hosts_by_uri;
+	// (host : node)
+	std::unordered_map<std::string, Node> nodes_by_host;
+	// (domain name : (host : state))
+	std::unordered_map<std::string, std::map<std::string, int>> locations;
+	std::mutex index_mutex;
+	std::condition_variable attempted_cv;
+	std::shared_ptr<Connection_pool> connection_pool;
+	// Destructed first, so no seeding outlives the index.
+	Thread_pool seeders;
+};
+
+#endif
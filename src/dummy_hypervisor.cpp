@@ -29,16 +29,16 @@ void Dummy_hypervisor::stop(const fast::msg::migfra::Stop &task, fast::msg::migf
 		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
 }
 
-void Dummy_hypervisor::migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Dummy_hypervisor::migrate(const fast::msg::migfra::Migrate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm)
 {
-	(void) task; (void) time_measurement; (void) comm;
+	(void) task; (void) options; (void) time_measurement; (void) details; (void) comm;
 	if (!never_throw)
 		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
 }
 
-void Dummy_hypervisor::evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Dummy_hypervisor::evacuate(const fast::msg::migfra::Evacuate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm)
 {
-	(void) task; (void) time_measurement; (void) comm;
+	(void) task; (void) options; (void) time_measurement; (void) details; (void) comm;
 	if (!never_throw)
 		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
 }
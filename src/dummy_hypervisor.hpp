@@ -57,11 +57,11 @@ public:
 	 * \param live_migration Enables live migration.
 	 * \param rdma_migration Enables rdma migration.
 	 */
-	void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void migrate(const fast::msg::migfra::Migrate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm) override;
 	/**
 	 * \brief Method to evacuate a host.
 	 */
-	void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void evacuate(const fast::msg::migfra::Evacuate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm) override;
 	/**
 	 * \brief Method to repin vcpus of a virtual machine.
 	 *
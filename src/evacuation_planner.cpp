@@ -0,0 +1,252 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "evacuation_planner.hpp"
+
+#include "pci_device_handler.hpp"
+#include "utility.hpp"
+
+#include <libvirt/virterror.h>
+#include <fast-lib/log.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+FASTLIB_LOG_INIT(evacuation_planner_log, "Evacuation_planner")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(evacuation_planner_log, trace);
+
+std::vector<Domain_demand> get_domain_demands(virConnectPtr conn)
+{
+	std::vector<Domain_demand> demands;
+	for (const auto &domain : get_active_domains(conn)) {
+		Domain_demand demand;
+		demand.name = get_domain_name(domain.get());
+		demand.memory = get_memory_size(domain.get());
+		demand.vcpus = get_vcpu_count(domain.get());
+		demand.devices = get_attached_device_types(domain.get());
+		demands.push_back(std::move(demand));
+	}
+	return demands;
+}
+
+Host_capacity get_host_capacity(virConnectPtr conn, const std::string &host, const PCI_device_handler &pci_device_handler)
+{
+	Host_capacity capacity;
+	capacity.host = host;
+	capacity.memory = get_free_memory(conn) / 1024;
+	capacity.vcpus = get_host_cpu_count(conn);
+	for (const auto &domain : get_active_domains(conn))
+		capacity.vcpus -= get_vcpu_count(domain.get());
+	for (const auto &id_count : pci_device_handler.count_free_devices(conn))
+		capacity.devices[id_count.first] = id_count.second;
+	return capacity;
+}
+
+/**
+ * \brief Get the share of a demand on the total capacity.
+ */
+double get_share(double demand, double total)
+{
+	if (total > 0)
+		return demand / total;
+	return demand > 0 ? std::numeric_limits<double>::infinity() : 0;
+}
+
+/**
+ * \brief Check if a domain fits on a snapshot of a destination.
+ */
+bool fits(const Domain_demand &domain, const Host_capacity &host, bool allow_overbooking)
+{
+	if (host.memory < static_cast<long long>(domain.memory))
+		return false;
+	if (!allow_overbooking && host.vcpus < domain.vcpus)
+		return false;
+	for (const auto &id_count : domain.devices) {
+		auto device_it = host.devices.find(id_count.first);
+		if (id_count.second != 0 && (device_it == host.devices.end() || device_it->second < static_cast<long long>(id_count.second)))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * \brief Sum up the capacities of all destinations.
+ */
+Host_capacity get_total_capacity(const std::vector<Host_capacity> &hosts)
+{
+	Host_capacity total;
+	for (const auto &host : hosts) {
+		total.memory += std::max(host.memory, 0LL);
+		total.vcpus += std::max(host.vcpus, 0LL);
+		for (const auto &id_count : host.devices)
+			total.devices[id_count.first] += std::max(id_count.second, 0LL);
+	}
+	return total;
+}
+
+const size_t Evacuation_plan::npos;
+
+Evacuation_plan::Evacuation_plan(std::vector<Domain_demand> domains, std::vector<Host_capacity> hosts, std::string mode, bool overbooking) :
+	mode(std::move(mode)),
+	overbooking(overbooking),
+	total(get_total_capacity(hosts)),
+	ledger(hosts),
+	next_host(0),
+	domains(std::move(domains)),
+	assignments(this->domains.size(), Assignment{npos, {}})
+{
+	for (size_t i = 0; i != this->domains.size(); ++i)
+		indices[this->domains[i].name] = i;
+	// Place largest domains first.
+	std::vector<std::pair<double, size_t>> sorted_domains;
+	sorted_domains.reserve(this->domains.size());
+	for (size_t i = 0; i != this->domains.size(); ++i)
+		sorted_domains.emplace_back(get_dominant_share(this->domains[i]), i);
+	std::stable_sort(sorted_domains.begin(), sorted_domains.end(),
+			[](const std::pair<double, size_t> &lhs, const std::pair<double, size_t> &rhs)
+			{return lhs.first > rhs.first;});
+	size_t placed = 0;
+	for (const auto &share_index : sorted_domains) {
+		const auto &domain = this->domains[share_index.second];
+		auto host = place(domain, {});
+		assignments[share_index.second].host = host;
+		if (host == npos) {
+			FASTLIB_LOG(evacuation_planner_log, warn) << "No destination with enough capacity for domain " << domain.name << ".";
+		} else {
+			++placed;
+			FASTLIB_LOG(evacuation_planner_log, trace) << "Plan to evacuate domain " << domain.name << " to " << ledger.get_host(host) << ".";
+		}
+	}
+	FASTLIB_LOG(evacuation_planner_log, debug) << "Planned " << placed << " of " << this->domains.size()
+		<< " domains on " << ledger.size() << " destinations (" << get_overbooked_count() << " overbooked).";
+}
+
+std::string Evacuation_plan::get_destination(const std::string &domain_name) const
+{
+	auto host = assignments[get_index(domain_name)].host;
+	if (host == npos)
+		throw std::runtime_error("No destination with enough capacity left for domain " + domain_name + ".");
+	return ledger.get_host(host);
+}
+
+std::string Evacuation_plan::get_alternate_destination(const std::string &domain_name)
+{
+	auto index = get_index(domain_name);
+	const auto &domain = domains[index];
+	auto &assignment = assignments[index];
+	if (assignment.host != npos) {
+		assignment.failed_hosts.insert(ledger.get_host(assignment.host));
+		ledger.release(assignment.host, domain);
+	}
+	assignment.host = place(domain, assignment.failed_hosts);
+	if (assignment.host == npos)
+		throw std::runtime_error("No alternate destination with enough capacity left for domain " + domain_name + ".");
+	return ledger.get_host(assignment.host);
+}
+
+size_t Evacuation_plan::get_overbooked_count() const
+{
+	size_t count = 0;
+	for (size_t i = 0; i != ledger.size(); ++i) {
+		if (ledger.get_capacity(i).vcpus < 0)
+			++count;
+	}
+	return count;
+}
+
+std::vector<Host_capacity> Evacuation_plan::get_capacities() const
+{
+	std::vector<Host_capacity> capacities;
+	capacities.reserve(ledger.size());
+	for (size_t i = 0; i != ledger.size(); ++i)
+		capacities.push_back(ledger.get_capacity(i));
+	return capacities;
+}
+
+double Evacuation_plan::get_dominant_share(const Domain_demand &domain) const
+{
+	double share = std::max(get_share(domain.memory, total.memory), get_share(domain.vcpus, total.vcpus));
+	for (const auto &id_count : domain.devices) {
+		auto device_it = total.devices.find(id_count.first);
+		share = std::max(share, get_share(id_count.second, device_it == total.devices.end() ? 0 : device_it->second));
+	}
+	return share;
+}
+
+double Evacuation_plan::get_remaining_share(const Host_capacity &host) const
+{
+	return get_share(std::max(host.memory, 0LL), total.memory) + get_share(host.vcpus, total.vcpus);
+}
+
+size_t Evacuation_plan::select(const Domain_demand &domain, const std::unordered_set<std::string> &excluded, bool allow_overbooking) const
+{
+	const auto count = ledger.size();
+	std::vector<Host_capacity> capacities;
+	capacities.reserve(count);
+	for (size_t i = 0; i != count; ++i)
+		capacities.push_back(ledger.get_capacity(i));
+	auto is_candidate = [&](size_t i)
+	{
+		return excluded.count(capacities[i].host) == 0 && fits(domain, capacities[i], allow_overbooking);
+	};
+	auto candidate = npos;
+	if (allow_overbooking) { // take the least overbooked destination
+		for (size_t i = 0; i != count; ++i) {
+			if (is_candidate(i) && (candidate == npos || capacities[i].vcpus > capacities[candidate].vcpus))
+				candidate = i;
+		}
+	} else if (mode == "compact") { // fill host, then go to next
+		for (size_t i = 0; i != count && candidate == npos; ++i) {
+			if (is_candidate(i))
+				candidate = i;
+		}
+	} else if (mode == "scatter") { // rotate through destinations
+		const auto first = next_host.load();
+		for (size_t offset = 0; offset != count && candidate == npos; ++offset) {
+			if (is_candidate((first + offset) % count))
+				candidate = (first + offset) % count;
+		}
+	} else { // "auto": take the destination with least capacity left (best fit)
+		for (size_t i = 0; i != count; ++i) {
+			if (is_candidate(i) && (candidate == npos || get_remaining_share(capacities[i]) < get_remaining_share(capacities[candidate])))
+				candidate = i;
+		}
+	}
+	return candidate;
+}
+
+size_t Evacuation_plan::place(const Domain_demand &domain, const std::unordered_set<std::string> &excluded)
+{
+	while (true) {
+		bool allow_overbooking = false;
+		auto candidate = select(domain, excluded, allow_overbooking);
+		// No destination left without overbooking -> try overbooking
+		if (candidate == npos && overbooking) {
+			allow_overbooking = true;
+			candidate = select(domain, excluded, allow_overbooking);
+		}
+		if (candidate == npos)
+			return npos;
+		if (ledger.try_reserve(candidate, domain, allow_overbooking)) {
+			next_host = (candidate + 1) % ledger.size();
+			return candidate;
+		}
+		// Capacity was reserved concurrently in between -> select again.
+		FASTLIB_LOG(evacuation_planner_log, trace) << "Capacity of " << ledger.get_host(candidate) << " changed. Select destination again.";
+	}
+}
+
+size_t Evacuation_plan::get_index(const std::string &domain_name) const
+{
+	auto index_it = indices.find(domain_name);
+	if (index_it == indices.end())
+		throw std::runtime_error("Domain " + domain_name + " is not part of the evacuation.");
+	return index_it->second;
+}
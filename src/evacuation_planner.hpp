@@ -0,0 +1,107 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef EVACUATION_PLANNER_HPP
+#define EVACUATION_PLANNER_HPP
+
+#include "capacity_ledger.hpp"
+
+#include <libvirt/libvirt.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+
+class PCI_device_handler;
+
+/**
+ * \brief Get the demands of all active domains on a connection.
+ */
+std::vector<Domain_demand> get_domain_demands(virConnectPtr conn);
+
+/**
+ * \brief Get the capacity left on a host.
+ *
+ * The free PCI devices of all types are counted, so the capacity does not depend on the domains to place.
+ *
+ * \param pci_device_handler Provides the cached devices of the host.
+ */
+Host_capacity get_host_capacity(virConnectPtr conn, const std::string &host, const PCI_device_handler &pci_device_handler);
+
+/**
+ * \brief Assignment of domains to destinations computed once per evacuation.
+ *
+ * Domains are placed by multi-dimensional first-fit-decreasing bin packing:
+ * The domains are sorted by their dominant share of the total destination capacity (memory, vCPUs, PCI devices)
+ * and the largest domains are placed first.
+ * Memory and PCI devices are hard constraints. vCPUs may only be overbooked if overbooking is enabled,
+ * in which case the least overbooked destination is chosen.
+ * The mode selects the destination among those the domain fits on:
+ * "compact" takes the first one in order of the destinations, "scatter" rotates through the destinations
+ * and "auto" takes the one with least capacity left (best-fit-decreasing), which keeps large gaps for the domains placed later.
+ *
+ * Every evacuation has its own plan which is shared by its tasks.
+ * The capacities are kept in a Capacity_ledger, so domains can be moved concurrently without a lock.
+ * The assignment of a domain may only be changed by the task evacuating it.
+ */
+class Evacuation_plan
+{
+public:
+	Evacuation_plan(std::vector<Domain_demand> domains, std::vector<Host_capacity> hosts, std::string mode = "auto", bool overbooking = true);
+	/**
+	 * \brief Get the planned destination of a domain.
+	 *
+	 * Throws if the domain could not be placed.
+	 */
+	std::string get_destination(const std::string &domain_name) const;
+	/**
+	 * \brief Move a domain to another destination after migrating to its planned destination failed.
+	 *
+	 * Destinations which already failed for this domain are not chosen again.
+	 * Throws if no other destination fits.
+	 */
+	std::string get_alternate_destination(const std::string &domain_name);
+	/**
+	 * \brief Get the number of destinations with overbooked vCPUs.
+	 */
+	size_t get_overbooked_count() const;
+	/**
+	 * \brief Get the capacities currently left on the destinations.
+	 */
+	std::vector<Host_capacity> get_capacities() const;
+private:
+	struct Assignment
+	{
+		// Index of the destination in the ledger or npos if not placed.
+		size_t host;
+		std::unordered_set<std::string> failed_hosts;
+	};
+
+	static const size_t npos = static_cast<size_t>(-1);
+
+	double get_dominant_share(const Domain_demand &domain) const;
+	double get_remaining_share(const Host_capacity &host) const;
+	size_t select(const Domain_demand &domain, const std::unordered_set<std::string> &excluded, bool allow_overbooking) const;
+	size_t place(const Domain_demand &domain, const std::unordered_set<std::string> &excluded);
+	size_t get_index(const std::string &domain_name) const;
+
+	const std::string mode;
+	const bool overbooking;
+	Host_capacity total;
+	Capacity_ledger ledger;
+	std::atomic<size_t> next_host;
+	std::vector<Domain_demand> domains;
+	// Same order as domains.
+	std::vector<Assignment> assignments;
+	// (domain name : index in domains)
+	std::unordered_map<std::string, size_t> indices;
+};
+
+#endif
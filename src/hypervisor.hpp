@@ -9,6 +9,9 @@
 #ifndef HYPERVISOR_HPP
 #define HYPERVISOR_HPP
 
+#include "result_details.hpp"
+#include "task_options.hpp"
+
 #include <fast-lib/message/migfra/task.hpp>
 #include <fast-lib/message/migfra/pci_id.hpp>
 #include <fast-lib/message/migfra/time_measurement.hpp>
@@ -18,6 +21,29 @@ using Time_measurement = fast::msg::migfra::Time_measurement;
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <stdexcept>
+#include <chrono>
+
+/**
+ * \brief Thrown by a hypervisor to execute an admitted task again later instead of blocking the worker.
+ *
+ * The task is admitted again after the delay and executed with the same task object,
+ * so the hypervisor may keep the state of the task (e.g., retries) meanwhile.
+ */
+struct Execute_later :
+	public std::runtime_error
+{
+	Execute_later(const std::string &what_arg, std::chrono::milliseconds delay) :
+		std::runtime_error(what_arg),
+		delay(delay)
+	{
+	}
+
+	const std::chrono::milliseconds delay;
+};
 
 /**
  * \brief An abstract class to provide an interface for the hypervisor.
@@ -31,6 +57,20 @@ public:
 	 * \brief Default virtual destructor.
 	 */
 	virtual ~Hypervisor() = default;
+	/**
+	 * \brief Method to wait for the admission of a task without blocking the calling thread.
+	 *
+	 * Tasks may have to wait for resources before they are executed, e.g., migrations for the migration limits.
+	 * The callback is called as soon as the task may be executed, possibly from another thread.
+	 * Resources reserved for the task are taken over if the task is executed with the same task object
+	 * and are released with the reservation passed to the callback otherwise.
+	 * The default implementation admits every task immediately.
+	 */
+	virtual void admit(std::shared_ptr<const fast::msg::migfra::Task> task, std::function<void(std::shared_ptr<void> reservation)> admitted)
+	{
+		(void) task;
+		admitted(nullptr);
+	}
 	/**
 	 * \brief Method to start a virtual machine.
 	 *
@@ -40,6 +80,23 @@ public:
 	 * \param memory The amount of ram memory to be assigned to the vm in KiB.
 	 */
 	virtual void start(const fast::msg::migfra::Start &task, fast::msg::migfra::Time_measurement &time_measurement) = 0;
+	/**
+	 * \brief Method to start a virtual machine without blocking the calling thread until it is booted.
+	 *
+	 * The callback is called with the exception of a failed start or nullptr, possibly from another thread.
+	 * The time measurement has to be kept until the callback is called.
+	 * The default implementation calls start() and the callback in the calling thread.
+	 */
+	virtual void start_async(std::shared_ptr<const fast::msg::migfra::Start> task, std::shared_ptr<fast::msg::migfra::Time_measurement> time_measurement, std::function<void(std::exception_ptr)> callback)
+	{
+		try {
+			start(*task, *time_measurement);
+		} catch (...) {
+			callback(std::current_exception());
+			return;
+		}
+		callback(nullptr);
+	}
 	/**
 	 * \brief Method to stop a virtual machine.
 	 *
@@ -55,12 +112,14 @@ public:
 	 * \param dest_hostname The name of the host to migrate to.
 	 * \param live_migration Enables live migration.
 	 * \param rdma_migration Enables rdma migration.
+	 * \param options Migration options which are not part of the Migrate task.
+	 * \param details Details on the migration returned in the result (e.g., progress summary).
 	 */
-	virtual void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) = 0;
+	virtual void migrate(const fast::msg::migfra::Migrate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm) = 0;
 	/**
 	 * \brief Method to evacuate a host.
 	 */
-	virtual void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) = 0;
+	virtual void evacuate(const fast::msg::migfra::Evacuate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm) = 0;
 	/**
 	 * \brief Method to repin vcpus of a virtual machine.
 	 *
@@ -1,19 +1,26 @@
 #include "ivshmem_handler.hpp"
 
+#include "domain_description.hpp"
+#include "shmem_transfer.hpp"
 #include "utility.hpp"
-#include "device_utility.hpp"
+#include "xml_scanner.hpp"
 
 #include <fast-lib/log.hpp>
 #include <libvirt/virterror.h>
 
 #include <regex>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <system_error>
 
 FASTLIB_LOG_INIT(ivshmem_handler_log, "Ivshmem_handler")
 FASTLIB_LOG_SET_LEVEL_GLOBAL(ivshmem_handler_log, trace);
 
 Ivshmem_device::Ivshmem_device(std::string id, std::string size, std::string unit) :
 	id(std::move(id)),
+	name(this->id),
 	size(std::move(size)),
 	unit(std::move(unit))
 {
@@ -24,24 +31,41 @@ Ivshmem_device::Ivshmem_device(const std::string &xml_desc)
 	from_xml(xml_desc);
 }
 
+Ivshmem_device::Ivshmem_device(Xml_scanner &scanner)
+{
+	from_element(scanner);
+}
+
 void Ivshmem_device::from_xml(const std::string &xml_desc)
 {
-	auto pt = read_xml_from_string(xml_desc);
-	if (pt.count("shmem") == 1) {
-		id = pt.get<decltype(id)>("shmem.<xmlattr>.name");
-		size = pt.get<decltype(size)>("shmem.size");
-		unit = pt.get<decltype(unit)>("shmem.size.<xmlattr>.unit");
-		if (pt.get_child("shmem").count("address") == 1) {
-			pt_pci = pt.get_child("shmem.address");
-		}
-	} else {
-		id = pt.get<decltype(id)>("alias.<xmlattr>.name");
-		size = pt.get<decltype(size)>("size");
-		unit = pt.get<decltype(unit)>("size.<xmlattr>.unit");
-		if (pt.count("address") == 1) {
-			pt_pci = pt.get_child("address");
+	Xml_scanner scanner(xml_desc);
+	if (scanner.next() != Xml_scanner::Token::start_element || scanner.get_name() != "shmem")
+		throw std::runtime_error("Xml does not describe a shmem device.");
+	from_element(scanner);
+}
+
+void Ivshmem_device::from_element(Xml_scanner &scanner)
+{
+	name = decode_xml(scanner.get_attribute("name"));
+	id = name;
+	size.clear();
+	unit.clear();
+	address_attributes.clear();
+	auto shmem_depth = scanner.get_depth();
+	while (scanner.next_child(shmem_depth)) {
+		auto name = scanner.get_name();
+		if (name == "alias") {
+			id = decode_xml(scanner.get_attribute("name"));
+		} else if (name == "size") {
+			unit = decode_xml(scanner.get_attribute("unit"));
+			size = decode_xml(scanner.read_text());
+		} else if (name == "address") {
+			for (const auto &attribute : scanner.get_attributes())
+				address_attributes.emplace_back(decode_xml(attribute.first), decode_xml(attribute.second));
 		}
 	}
+	if (id.empty() || name.empty() || size.empty() || unit.empty())
+		throw std::runtime_error("Incomplete description of shmem device.");
 }
 
 std::string Ivshmem_device::to_xml() const
@@ -54,15 +78,19 @@ std::string Ivshmem_device::to_xml() const
 </shmem>\n\
 	";
 */
-	boost::property_tree::ptree pt;
-	pt.put("shmem.<xmlattr>.name", id);
-	pt.put("shmem.model.<xmlattr>.type", "ivshmem-plain");
-	pt.put("shmem.size.<xmlattr>.unit", unit);
-	pt.put("shmem.size", size);
-	pt.put("shmem.alias.<xmlattr>.name", id);
-	if (!pt_pci.empty())
-		pt.put_child("shmem.address", pt_pci);
-	return write_xml_to_string(pt);
+	Xml_writer writer;
+	writer.start_element("shmem").attribute("name", name);
+	writer.start_element("model").attribute("type", "ivshmem-plain").end_element();
+	writer.start_element("size").attribute("unit", unit).text(size).end_element();
+	writer.start_element("alias").attribute("name", id).end_element();
+	if (!address_attributes.empty()) {
+		writer.start_element("address");
+		for (const auto &attribute : address_attributes)
+			writer.attribute(attribute.first, attribute.second);
+		writer.end_element();
+	}
+	writer.end_element();
+	return writer.str();
 }
 
 void attach_ivshmem_device(virDomainPtr domain, const Ivshmem_device &device)
@@ -73,17 +101,25 @@ void attach_ivshmem_device(virDomainPtr domain, const Ivshmem_device &device)
 		throw std::runtime_error(std::string("Could not attach ivshmem device. ") + virGetLastErrorMessage());
 }
 
-Migrate_ivshmem_guard::Migrate_ivshmem_guard(std::shared_ptr<virDomain> domain, Time_measurement &time_measurement, std::string tag_postfix) :
+Migrate_ivshmem_guard::Migrate_ivshmem_guard(std::shared_ptr<virDomain> domain, std::shared_ptr<const Domain_description> description, Time_measurement &time_measurement, std::string tag_postfix, std::shared_ptr<const Shmem_transfer> transfer) :
 	domain(domain),
+	description(std::move(description)),
 	time_measurement(time_measurement),
-	tag_postfix(std::move(tag_postfix))
+	tag_postfix(std::move(tag_postfix)),
+	transfer(std::move(transfer)),
+	migrated(false)
 {
 	if (this->tag_postfix != "")
 		this->tag_postfix = "-" + this->tag_postfix;
+	if (this->transfer) {
+		time_measurement.tick("precopy-ivshmem-devs" + this->tag_postfix);
+		precopy();
+		time_measurement.tock("precopy-ivshmem-devs" + this->tag_postfix);
+	}
 	FASTLIB_LOG(ivshmem_handler_log, trace) << "Detach all devices.";
-	time_measurement.tick("detach-ivshmem-devs" + tag_postfix);
+	time_measurement.tick("detach-ivshmem-devs" + this->tag_postfix);
 	detach();
-	time_measurement.tock("detach-ivshmem-devs" + tag_postfix);
+	time_measurement.tock("detach-ivshmem-devs" + this->tag_postfix);
 }
 
 Migrate_ivshmem_guard::~Migrate_ivshmem_guard() noexcept(false)
@@ -103,37 +139,131 @@ Migrate_ivshmem_guard::~Migrate_ivshmem_guard() noexcept(false)
 void Migrate_ivshmem_guard::set_destination_domain(std::shared_ptr<virDomain> dest_domain)
 {
 	domain = dest_domain;
+	migrated = true;
 }
 
-void Migrate_ivshmem_guard::detach()
+// Upper limit of threads handling the devices of a domain, so domains with many devices do not start a thread each.
+const size_t max_device_threads = 4;
+
+std::vector<Ivshmem_device> Migrate_ivshmem_guard::for_each_device(const std::vector<Ivshmem_device> &devices, const std::string &tag,
+		const std::function<void(const Ivshmem_device &)> &func, std::exception_ptr &error)
 {
-	auto domain_ptree = read_xml_from_string(get_domain_xml(domain.get()));
-	auto attached_devices = domain_ptree.get_child("domain.devices");
-	
-	for (const auto &device : attached_devices) {
-		if (device.first == "shmem") {
-			detached_devices.emplace_back(write_xml_to_string(device.second));
+	std::vector<std::exception_ptr> errors(devices.size());
+	std::atomic<size_t> next_device(0);
+	auto handle_devices = [this, &devices, &tag, &func, &errors, &next_device]
+	{
+		for (size_t i = next_device++; i < devices.size(); i = next_device++) {
+			const auto &device = devices[i];
+			auto device_tag = tag + "-" + device.id + tag_postfix;
+			try {
+				{
+					std::lock_guard<std::mutex> lock(time_measurement_mutex);
+					time_measurement.tick(device_tag);
+				}
+				func(device);
+				std::lock_guard<std::mutex> lock(time_measurement_mutex);
+				time_measurement.tock(device_tag);
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
 		}
+	};
+	// The calling thread handles devices as well.
+	std::vector<std::thread> threads;
+	auto thread_count = std::min(devices.size(), max_device_threads);
+	try {
+		for (size_t i = 1; i < thread_count; ++i)
+			threads.emplace_back(handle_devices);
+	} catch (const std::system_error &e) {
+		FASTLIB_LOG(ivshmem_handler_log, warn) << "Handle devices with " << threads.size() + 1 << " threads only: " << e.what();
+	}
+	handle_devices();
+	// Wait for all devices, even if one failed, since the threads reference the devices.
+	for (auto &thread : threads)
+		thread.join();
+	std::vector<Ivshmem_device> succeeded_devices;
+	for (size_t i = 0; i != devices.size(); ++i) {
+		if (!errors[i])
+			succeeded_devices.push_back(devices[i]);
+		else if (!error)
+			error = errors[i];
 	}
-	if (detached_devices.size() == 0) {
+	return succeeded_devices;
+}
+
+void Migrate_ivshmem_guard::precopy()
+{
+	// The domain keeps running, so the chunks it writes meanwhile are sent again after the migration.
+	std::exception_ptr error;
+	for_each_device(description->get_shmem_devices(), "precopy-ivshmem-dev", [this](const Ivshmem_device &device)
+	{
+		transfer->send(device.name);
+	}, error);
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void Migrate_ivshmem_guard::detach()
+{
+	const auto &devices = description->get_shmem_devices();
+	if (devices.size() == 0) {
 		FASTLIB_LOG(ivshmem_handler_log, trace) << "Could not find any attached ivshmem devices.";
-	} else {
-		if (detached_devices.size() > 1) 
-			throw std::runtime_error("Found more than one ivshmem device. Only migration of one is supported.");
-		FASTLIB_LOG(ivshmem_handler_log, trace) << "Detaching device: " << detached_devices.front().to_xml();
-		if (virDomainDetachDevice(domain.get(), detached_devices.front().to_xml().c_str()) != 0) {
-			throw std::runtime_error(std::string("Error detaching device. ") + virGetLastErrorMessage());
+		return;
+	}
+	FASTLIB_LOG(ivshmem_handler_log, trace) << "Detaching " << devices.size() << " devices in parallel.";
+	std::exception_ptr error;
+	detached_devices = for_each_device(devices, "detach-ivshmem-dev", [this](const Ivshmem_device &device)
+	{
+		FASTLIB_LOG(ivshmem_handler_log, trace) << "Detaching device: " << device.to_xml();
+		if (virDomainDetachDevice(domain.get(), device.to_xml().c_str()) != 0)
+			throw std::runtime_error("Error detaching device " + device.id + ". " + virGetLastErrorMessage());
+	}, error);
+	if (error) {
+		// The destructor is not called if the constructor throws, so restore the detached devices here.
+		try {
+			reattach();
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(ivshmem_handler_log, warn) << "Exception while reattaching ivshmem devices: " << e.what();
 		}
+		std::rethrow_exception(error);
 	}
 }
 
+void Migrate_ivshmem_guard::transfer_regions()
+{
+	time_measurement.tick("transfer-ivshmem-devs" + tag_postfix);
+	std::exception_ptr error;
+	for_each_device(detached_devices, "transfer-ivshmem-dev", [this](const Ivshmem_device &device)
+	{
+		transfer->send(device.name);
+	}, error);
+	time_measurement.tock("transfer-ivshmem-devs" + tag_postfix);
+	if (error)
+		std::rethrow_exception(error);
+}
+
 void Migrate_ivshmem_guard::reattach()
 {
 	if (detached_devices.size() > 0) {
-		if (detached_devices.size() != 1)
-			throw std::runtime_error("Wrong number of detached ivshmem devices: " + std::to_string(detached_devices.size()));
+		std::exception_ptr error;
+		// Restore the regions on the destination before the devices map them.
+		if (transfer && migrated) {
+			try {
+				transfer_regions();
+			} catch (...) {
+				// The devices are reattached anyway, as without a transfer.
+				error = std::current_exception();
+			}
+		}
 		time_measurement.tick("reattach-ivshmem-devs" + tag_postfix);
-		attach_ivshmem_device(domain.get(), detached_devices.front());
+		// Devices keep their PCI address, so they can be attached in any order.
+		auto reattached_devices = for_each_device(detached_devices, "reattach-ivshmem-dev", [this](const Ivshmem_device &device)
+		{
+			attach_ivshmem_device(domain.get(), device);
+		}, error);
 		time_measurement.tock("reattach-ivshmem-devs" + tag_postfix);
+		detached_devices.clear();
+		if (error)
+			std::rethrow_exception(error);
 	}
-}	
+}
@@ -12,14 +12,21 @@
 #include <fast-lib/message/migfra/time_measurement.hpp>
 
 #include <libvirt/libvirt.h>
-#include <boost/property_tree/ptree.hpp>
 
 #include <string>
 #include <vector>
 #include <memory>
+#include <utility>
+#include <mutex>
+#include <functional>
+#include <exception>
 
 using Time_measurement = fast::msg::migfra::Time_measurement;
 
+class Domain_description;
+class Xml_scanner;
+class Shmem_transfer;
+
 /**
  * \brief A struct representing an ivshmem device.
  */
@@ -28,14 +35,21 @@ struct Ivshmem_device
 
 	Ivshmem_device(std::string id, std::string size, std::string unit = "M");
 	Ivshmem_device(const std::string &xml_desc);
+	// Reads the shmem element the scanner is at and advances to its end.
+	explicit Ivshmem_device(Xml_scanner &scanner);
 
 	void from_xml(const std::string &xml_desc);
+	// The alias is taken as id if present, else the name.
+	void from_element(Xml_scanner &scanner);
 	std::string to_xml() const;
 
 	std::string id;
+	// Name of the shared memory region (/dev/shm/<name>) on the host.
+	std::string name;
 	std::string size;
 	std::string unit;
-	boost::property_tree::ptree pt_pci;
+	// (name : value) attributes of the PCI address, kept to reattach at the same address.
+	std::vector<std::pair<std::string, std::string>> address_attributes;
 };
 
 /**
@@ -46,23 +60,39 @@ void attach_ivshmem_device(virDomainPtr domain, const Ivshmem_device &device);
 /**
  * \brief RAII-guard which detaches ivshmem devices in constructor and reattaches in destructor.
  *
+ * The devices are taken from the description of the domain.
+ * The devices are detached and reattached in parallel by up to four threads, each device timed as detach-ivshmem-dev-<id> and reattach-ivshmem-dev-<id>.
+ * Reattached devices keep the PCI address they had on the source.
+ * If a transfer is passed, the regions of the devices are pre-copied to the destination before detaching (precopy-ivshmem-dev-<id>).
+ * After a migration the chunks changed since are transferred before reattaching (transfer-ivshmem-dev-<id>).
  * If no error occures during migration, the destination domain should be set.
  */
 class Migrate_ivshmem_guard
 {
 public:
-	Migrate_ivshmem_guard(std::shared_ptr<virDomain> domain, Time_measurement &time_measurement, std::string tag_postfix = "");
+	Migrate_ivshmem_guard(std::shared_ptr<virDomain> domain, std::shared_ptr<const Domain_description> description, Time_measurement &time_measurement, std::string tag_postfix = "", std::shared_ptr<const Shmem_transfer> transfer = nullptr);
 	~Migrate_ivshmem_guard() noexcept(false);
 
 	void set_destination_domain(std::shared_ptr<virDomain> dest_domain);
 private:
+	// Calls func for all devices in parallel by a bounded number of threads. Returns the devices func succeeded for and sets error to the first exception.
+	std::vector<Ivshmem_device> for_each_device(const std::vector<Ivshmem_device> &devices, const std::string &tag,
+			const std::function<void(const Ivshmem_device &)> &func, std::exception_ptr &error);
+	void precopy();
 	void detach();
+	void transfer_regions();
 	void reattach();
 
 	std::shared_ptr<virDomain> domain;
+	std::shared_ptr<const Domain_description> description;
 	std::vector<Ivshmem_device> detached_devices;
 	Time_measurement &time_measurement;
+	// Held while ticking and tocking from the threads of the devices.
+	std::mutex time_measurement_mutex;
 	std::string tag_postfix;
+	std::shared_ptr<const Shmem_transfer> transfer;
+	// The destination domain is set, so the regions have to be transferred.
+	bool migrated;
 };
 
 #endif
@@ -0,0 +1,63 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "libvirt_event_loop.hpp"
+
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include <fast-lib/log.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <mutex>
+
+FASTLIB_LOG_INIT(libvirt_event_loop_log, "Libvirt_event_loop")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(libvirt_event_loop_log, trace);
+
+// The default implementation may only be registered once per process.
+void register_default_event_impl()
+{
+	static std::once_flag registered;
+	std::call_once(registered, []
+	{
+		if (virEventRegisterDefaultImpl() == -1)
+			throw std::runtime_error(std::string("Error registering libvirt event loop: ") + virGetLastErrorMessage());
+	});
+}
+
+// Fires once to wake up the event loop so it can check whether it should stop.
+void wake_up_timeout_callback(int timer, void *opaque)
+{
+	(void) opaque;
+	virEventRemoveTimeout(timer);
+}
+
+Libvirt_event_loop::Libvirt_event_loop() :
+	running(true)
+{
+	register_default_event_impl();
+	thread = std::thread(&Libvirt_event_loop::run, this);
+}
+
+Libvirt_event_loop::~Libvirt_event_loop()
+{
+	running = false;
+	if (virEventAddTimeout(0, wake_up_timeout_callback, nullptr, nullptr) == -1)
+		FASTLIB_LOG(libvirt_event_loop_log, warn) << "Error waking up event loop.";
+	thread.join();
+}
+
+void Libvirt_event_loop::run()
+{
+	FASTLIB_LOG(libvirt_event_loop_log, trace) << "Event loop started.";
+	while (running) {
+		if (virEventRunDefaultImpl() == -1)
+			FASTLIB_LOG(libvirt_event_loop_log, warn) << "Error running event loop: " << virGetLastErrorMessage();
+	}
+	FASTLIB_LOG(libvirt_event_loop_log, trace) << "Event loop stopped.";
+}
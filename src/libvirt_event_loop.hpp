@@ -0,0 +1,42 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef LIBVIRT_EVENT_LOOP_HPP
+#define LIBVIRT_EVENT_LOOP_HPP
+
+#include <thread>
+#include <atomic>
+
+/**
+ * \brief Runs the default libvirt event loop in a dedicated thread.
+ *
+ * Libvirt needs a running event loop to send keepalive messages and to dispatch event callbacks.
+ * The default event loop implementation is registered on construction of the first instance,
+ * therefore the Libvirt_event_loop has to be created before any connection is opened.
+ */
+class Libvirt_event_loop
+{
+public:
+	/**
+	 * \brief Register the default event loop implementation and start the thread running it.
+	 */
+	Libvirt_event_loop();
+	/**
+	 * \brief Stop and join the thread running the event loop.
+	 */
+	~Libvirt_event_loop();
+	Libvirt_event_loop(const Libvirt_event_loop &) = delete;
+	Libvirt_event_loop & operator=(const Libvirt_event_loop &) = delete;
+private:
+	void run();
+
+	std::atomic<bool> running;
+	std::thread thread;
+};
+
+#endif
@@ -13,11 +13,20 @@
 #include "utility.hpp"
 #include "ivshmem_handler.hpp"
 #include "repin_handler.hpp"
+#include "connection_pool.hpp"
+#include "domain_description.hpp"
+#include "domain_event_monitor.hpp"
+#include "domain_location_index.hpp"
+#include "migration_monitor.hpp"
+#include "postcopy_policy.hpp"
+#include "evacuation_planner.hpp"
+#include "capacity_prober.hpp"
+#include "concurrency_controller.hpp"
+#include "shmem_transfer.hpp"
 
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 #include <fast-lib/log.hpp>
-#include <libssh/libsshpp.hpp>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -30,6 +39,7 @@
 #include <mutex>
 #include <regex>
 #include <functional>
+#include <algorithm>
 
 using namespace fast::msg::migfra;
 
@@ -40,65 +50,6 @@ FASTLIB_LOG_SET_LEVEL_GLOBAL(libvirt_hyp_log, trace);
 // Helper functions
 //
 
-/**
- * \brief Tries to connect to a domain via ssh in order to test if the domain is booted and ready to use.
- *
- * \param domain The domain to probe.
- */
-void probe_ssh_connection(const std::string &host, const std::chrono::duration<double> &timeout)
-{
-	ssh::Session session;
-	session.setOption(SSH_OPTIONS_HOST, host.c_str());
-	bool success = false;
-	auto start = std::chrono::high_resolution_clock::now();
-	do {
-		try {
-			FASTLIB_LOG(libvirt_hyp_log, trace) << "Try to connect to domain (" << host << ") with SSH.";
-			session.connect();
-			FASTLIB_LOG(libvirt_hyp_log, trace) << "Domain is ready.";
-			success = true;
-		} catch (ssh::SshException &e) {
-			FASTLIB_LOG(libvirt_hyp_log, debug) << "Exception while connecting to " << host << " with SSH: " << e.getError();
-			std::this_thread::sleep_for(std::chrono::seconds(1));
-		}
-		session.disconnect();
-		if (!success && std::chrono::high_resolution_clock::now() - start > timeout)
-			throw std::runtime_error("Timeout while trying to reach domain with SSH.");
-	} while (!success);
-}
-
-/**
- * \brief Get a libvirt-connection to a specific host and libvirt-driver.
- *
- * \param host The hostname of the connection.
- * \param driver The libvirt-driver of the connection (e.g., qemu).
- * \param transport The transport protocol to use (e.g., ssh or tcp for remote connections)
- * \returns shared_ptr to a domain.
- */
-std::shared_ptr<virConnect> connect(const std::string &host, const std::string &driver, const std::string transport = "")
-{
-	std::string plus_transport = (transport != "") ? ("+" + transport) : "";
-	std::string mode = (driver == "lxctools") ? "" : "system";
-	std::string uri = driver + plus_transport + "://" + host + "/" + mode;
-	FASTLIB_LOG(libvirt_hyp_log, trace) << "Connect to " + uri;
-	std::shared_ptr<virConnect> conn(
-			virConnectOpen(uri.c_str()),
-			Deleter_virConnect()
-	);
-	if (!conn)
-		throw std::runtime_error("Failed to connect to libvirt with uri: " + uri);
-	return conn;
-}
-
-std::string get_domain_name(virDomainPtr domain)
-{
-	auto ret = virDomainGetName(domain);
-	if (!ret)
-		throw std::runtime_error(std::string("Error getting name of domain.") + virGetLastErrorMessage());
-	return std::string(ret);
-
-}
-
 // TODO: If this function throws there is a memory leak due to use of free().
 std::vector<std::string> get_active_domain_names(virConnectPtr conn)
 {
@@ -116,18 +67,6 @@ std::vector<std::string> get_active_domain_names(virConnectPtr conn)
 	return vm_names;
 }
 
-/**
- * \brief Returns the number of CPUs for a host.
- * TODO: Check for actually online CPUs
- */
-int get_host_cpu_count(virConnectPtr conn)
-{
-	int cpu_count = -1;
-	if ((cpu_count = virNodeGetCPUMap(conn, nullptr, nullptr, 0)) == -1)
-		throw std::runtime_error("Error getting node ");
-	return cpu_count;
-}
-
 
 /**
  * \brief Define a domain using an xml config.
@@ -199,21 +138,6 @@ void create(virDomainPtr domain)
 		throw std::runtime_error(std::string("Error creating domain: ") + virGetLastErrorMessage());
 }
 
-/**
- * \brief Get the state of the domain.
- *
- * \param domain The domain which state is retrieved.
- * \returns One of enum virDomainState (http://libvirt.org/html/libvirt-libvirt-domain.html#virDomainState).
- */
-unsigned char get_domain_state(virDomainPtr domain)
-{
-	FASTLIB_LOG(libvirt_hyp_log, trace) << "Get domain info.";
-	virDomainInfo domain_info;
-	if (virDomainGetInfo(domain, &domain_info) == -1)
-		throw std::runtime_error("Failed getting domain info.");
-	return domain_info.state;
-}
-
 /**
  * \brief Custom exception thrown when domain state does not suit expected state.
  */
@@ -240,49 +164,6 @@ void check_state(virDomainPtr domain, virDomainState expected_state)
 		throw Domain_state_error("Wrong domain state: " + std::to_string(state));
 }
 
-/**
- * \brief Check if state of a domain is as expected on at least one of the nodes.
- *
- * This function is used to check if a domain is already running on any node.
- * \param name The name of the domain.
- * \param nodes The nodes to look for the domain.
- * \param expected_state The expected state with which the state of the domain is compared to.
- */
-void check_remote_state(const std::string &name, const std::vector<std::string> &nodes, virDomainState expected_state)
-{
-	for (const auto &node : nodes) {
-		FASTLIB_LOG(libvirt_hyp_log, trace) << "Check domain state on " + node + ".";
-		auto conn = connect(node, "qemu", "ssh");
-		try {
-			auto domain = find_by_name(conn.get(), name);
-			check_state(domain.get(), expected_state);
-		} catch (const Domain_state_error &e) {
-			throw std::runtime_error("Domain already running on " + node);
-		} catch (const std::runtime_error &e) {
-			if (e.what() != std::string("Domain not found."))
-				throw;
-		}
-	}
-}
-
-/**
- * \brief Wait until the domain is in a specific state.
- *
- * This function may be used to wait until a domain is activated or fully shut down.
- * \param domain The domain to poll.
- * \param expected_state The state to wait on.
- * \todo Implement timeout
- */
-void wait_for_state(virDomainPtr domain, virDomainState expected_state, const std::chrono::duration<double> timeout)
-{
-	auto start = std::chrono::high_resolution_clock::now();
-	while (get_domain_state(domain) != expected_state) {
-		if (std::chrono::high_resolution_clock::now() - start > timeout)
-			throw std::runtime_error("Timeout while waiting for correct vm state.");
-		std::this_thread::sleep_for(std::chrono::seconds(1));
-	}
-}
-
 bool is_persistent(virDomainPtr domain)
 {
 	auto ret = virDomainIsPersistent(domain);
@@ -382,6 +263,8 @@ unsigned long get_migrate_flags(std::string migration_type)
 	unsigned long flags = 0;
 	if (migration_type == "live") {
 		flags |= VIR_MIGRATE_LIVE;
+	} else if (migration_type == "postcopy") {
+		flags |= VIR_MIGRATE_LIVE | VIR_MIGRATE_POSTCOPY;
 	} else if (migration_type == "offline") {
 		flags |= VIR_MIGRATE_OFFLINE;
 	} else if (migration_type != "warm") {
@@ -391,29 +274,176 @@ unsigned long get_migrate_flags(std::string migration_type)
 	return flags;
 }
 
-std::shared_ptr<virDomain> migrate_domain(virDomainPtr domain, virConnectPtr dest_conn, unsigned long flags, const std::string &migrate_uri)
+/**
+ * \brief Custom exception thrown when a migration fails and may be retried.
+ */
+struct Migration_error :
+	public std::runtime_error
+{
+	explicit Migration_error(const std::string &what_arg, bool destination_failed = false, bool retryable = true) :
+		std::runtime_error(what_arg),
+		destination_failed(destination_failed),
+		retryable(retryable)
+	{
+	}
+
+	// The failure was caused by the destination, so another destination may succeed.
+	bool destination_failed;
+	// False if the domain may already run on the destination, so it must not be migrated again.
+	bool retryable;
+};
+
+/**
+ * \brief Check if a libvirt error is caused by the connection to or the libvirt daemon of the destination.
+ */
+bool is_destination_error(const virError &error)
+{
+	return error.domain == VIR_FROM_RPC ||
+		error.code == VIR_ERR_NO_CONNECT ||
+		error.code == VIR_ERR_AUTH_FAILED ||
+		error.code == VIR_ERR_RPC;
+}
+
+std::shared_ptr<virDomain> migrate_domain(virDomainPtr domain, virConnectPtr dest_conn, unsigned long flags, const std::string &migrate_uri, const Migration_options &options)
 {
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Migrate domain.";
-	// Create params only containing migrate uri.
-	std::unique_ptr<virTypedParameter[]> params;
-	size_t params_size = 0;
-	if (migrate_uri != "") {
-		params.reset(new virTypedParameter[1]);
-		strcpy(params[0].field, VIR_MIGRATE_PARAM_URI);
-		params[0].type = VIR_TYPED_PARAM_STRING;
-		// TODO: Fix memory leak
-		params[0].value.s = new char[migrate_uri.size() + 1];
-		strcpy(params[0].value.s, migrate_uri.c_str());
-		params_size = 1;
+	Typed_parameters params;
+	if (migrate_uri != "")
+		params.add_string(VIR_MIGRATE_PARAM_URI, migrate_uri);
+	// Transfer memory using multiple connections
+	if (options.parallel_connections > 0) {
+		FASTLIB_LOG(libvirt_hyp_log, trace) << "Use " << options.parallel_connections << " parallel connections.";
+		flags |= VIR_MIGRATE_PARALLEL;
+		params.add_int(VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS, options.parallel_connections);
+	}
+	// Compress memory
+	const auto &compression = options.compression;
+	if (!compression.methods.empty()) {
+		FASTLIB_LOG(libvirt_hyp_log, trace) << "Use " << compression.str() << " compression.";
+		flags |= VIR_MIGRATE_COMPRESSED;
+		for (const auto &method : compression.methods)
+			params.add_string(VIR_MIGRATE_PARAM_COMPRESSION, method);
+		if (compression.xbzrle_cache != 0)
+			params.add_ullong(VIR_MIGRATE_PARAM_COMPRESSION_XBZRLE_CACHE, compression.xbzrle_cache);
+		if (compression.mt_level != -1)
+			params.add_int(VIR_MIGRATE_PARAM_COMPRESSION_MT_LEVEL, compression.mt_level);
+		if (compression.mt_threads != 0)
+			params.add_int(VIR_MIGRATE_PARAM_COMPRESSION_MT_THREADS, compression.mt_threads);
+		if (compression.mt_dthreads != 0)
+			params.add_int(VIR_MIGRATE_PARAM_COMPRESSION_MT_DTHREADS, compression.mt_dthreads);
 	}
 	// Migrate
 	std::shared_ptr<virDomain> dest_domain(
-		virDomainMigrate3(domain, dest_conn, params.get(), params_size, flags),
+		virDomainMigrate3(domain, dest_conn, params.get(), params.size(), flags),
 		Deleter_virDomain()
 	);
 	// Check for error
-	if (!dest_domain)
-		throw std::runtime_error(std::string("Migration failed: ") + virGetLastErrorMessage());
+	if (!dest_domain) {
+		auto libvirt_error = virGetLastError();
+		throw Migration_error(std::string("Migration failed: ") + virGetLastErrorMessage(), libvirt_error && is_destination_error(*libvirt_error));
+	}
+	return dest_domain;
+}
+
+/**
+ * \brief Downgrade a migration to the next fallback of the chain rdma -> tcp and live -> postcopy -> warm.
+ *
+ * \returns The name of the fallback or an empty string if there is no fallback left.
+ */
+std::string downgrade_migration(Migrate &task)
+{
+	if (task.rdma_migration.get_or(false)) {
+		task.rdma_migration = false;
+		return "tcp";
+	}
+	auto migration_type = task.migration_type.get_or("warm");
+	if (migration_type == "live") {
+		task.migration_type = std::string("postcopy");
+		return "postcopy";
+	} else if (migration_type == "postcopy") {
+		task.migration_type = std::string("warm");
+		return "warm";
+	}
+	return "";
+}
+
+/**
+ * \brief Switch a migration to an alternate destination if there is one.
+ *
+ * \returns The fallback or an empty string if there is no other destination.
+ */
+std::string switch_destination(Migrate &task, const std::function<std::string()> &get_alternate_destination)
+{
+	if (!get_alternate_destination)
+		return "";
+	try {
+		auto destination = get_alternate_destination();
+		if (destination == task.dest_hostname)
+			return "";
+		task.dest_hostname = destination;
+		return "destination " + destination;
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(libvirt_hyp_log, debug) << "No alternate destination: " << e.what();
+		return "";
+	}
+}
+
+/**
+ * \brief Get the time measurement tag of a migration which includes the compression used.
+ *
+ * E.g., "migrate" or "migrate-compression-xbzrle+mt".
+ */
+std::string get_migrate_tag(const std::string &tag, const Migration_options &options)
+{
+	if (options.compression.methods.empty())
+		return tag;
+	return tag + "-compression-" + options.compression.str();
+}
+
+/**
+ * \brief Migrate a domain while its progress is monitored.
+ *
+ * Post-copy migrations are switched to post-copy as soon as the policy decides so.
+ * A summary of the progress is added to the details with key details_key.
+ */
+std::shared_ptr<virDomain> migrate_domain_monitored(std::shared_ptr<virDomain> domain, const std::string &name, virConnectPtr dest_conn, const std::string &dest_hostname, unsigned long flags, const std::string &migrate_uri, const Migration_options &options, const Postcopy_policy &postcopy_policy, std::shared_ptr<fast::Communicator> comm, Result_details &details, const std::string &details_key)
+{
+	Migration_monitor::Sample_handler sample_handler;
+	// Written by the monitor thread which is joined before reading.
+	YAML::Node postcopy;
+	if (flags & VIR_MIGRATE_POSTCOPY) {
+		sample_handler = [domain, &name, &postcopy_policy, &postcopy](const Migration_progress &progress)
+		{
+			if (postcopy["reason"])
+				return;
+			auto reason = postcopy_policy.get_switchover_reason(progress);
+			if (reason == "")
+				return;
+			FASTLIB_LOG(libvirt_hyp_log, trace) << "Switch migration of " << name << " to post-copy (" << reason << ").";
+			if (virDomainMigrateStartPostCopy(domain.get(), 0) == -1) {
+				FASTLIB_LOG(libvirt_hyp_log, warn) << "Error switching to post-copy: " << virGetLastErrorMessage();
+				return;
+			}
+			postcopy["reason"] = reason;
+			postcopy["iteration"] = progress.iteration;
+			postcopy["time-elapsed"] = progress.time_elapsed;
+		};
+	}
+	Migration_monitor migration_monitor(domain, name, dest_hostname, comm, sample_handler);
+	std::shared_ptr<virDomain> dest_domain;
+	try {
+		dest_domain = migrate_domain(domain.get(), dest_conn, flags, migrate_uri, options);
+	} catch (const Migration_error &e) {
+		migration_monitor.stop();
+		// After the switch the domain runs on the destination, so it must not be migrated again.
+		if (postcopy["reason"])
+			throw Migration_error(std::string(e.what()) + " (failed in post-copy phase)", e.destination_failed, false);
+		throw;
+	}
+	auto summary = migration_monitor.stop();
+	if (flags & VIR_MIGRATE_POSTCOPY)
+		summary["postcopy"] = postcopy["reason"] ? postcopy : YAML::Node("none");
+	details.set(details_key, summary);
 	return dest_domain;
 }
 
@@ -428,14 +458,6 @@ bool sort_domains_by_size(virDomainPtr domain1, virDomainPtr domain2)
 	return domain1_size < domain2_size;
 }
 
-unsigned long long get_free_memory(virConnectPtr conn)
-{
-	auto memory = virNodeGetFreeMemory(conn);
-	if (memory == 0)
-		throw std::runtime_error(std::string("Error geting free node memory: ") + virGetLastErrorMessage());
-	return memory;
-}
-
 bool check_snapshot_required(virDomainPtr domain1, virConnectPtr conn1, virDomainPtr domain2, virConnectPtr conn2)
 {
 	auto domain1_size = get_memory_size(domain1);
@@ -445,11 +467,23 @@ bool check_snapshot_required(virDomainPtr domain1, virConnectPtr conn1, virDomai
 	return host1_free_memory < domain2_size || host2_free_memory < domain1_size;
 }
 
+/**
+ * \brief Create the transfer of ivshmem regions to the destination if the options request it.
+ */
+std::shared_ptr<const Shmem_transfer> make_shmem_transfer(const Migration_options &options, const Shmem_transfer_config &config, const std::string &dest_hostname, const std::string &domain_name)
+{
+	if (!options.transfer_ivshmem)
+		return nullptr;
+	if (config.port == 0)
+		throw std::runtime_error("Transfer of ivshmem regions requested, but no shmem-transfer port is configured.");
+	return std::make_shared<const Shmem_transfer>(dest_hostname, domain_name, config);
+}
+
 // TODO: Refactor (maybe object oriented approach?)
-void Libvirt_hypervisor::swap_migration(const std::string &name, const std::string &name_swap, const std::string &hostname, const std::string &hostname_swap, unsigned long flags, unsigned long flags_swap, bool rdma_migration, const std::string &driver, const std::string &transport, const Migrate &task, std::shared_ptr<fast::Communicator> comm, Time_measurement &time_measurement)
+void Libvirt_hypervisor::swap_migration(const std::string &name, const std::string &name_swap, const std::string &hostname, const std::string &hostname_swap, unsigned long flags, unsigned long flags_swap, bool rdma_migration, const std::string &driver, const std::string &transport, const Migrate &task, const Migration_options &options, std::shared_ptr<fast::Communicator> comm, Time_measurement &time_measurement, Result_details &details, std::unique_ptr<Migration_slot> &slot)
 {
-	auto conn = connect(hostname, driver, transport);
-	auto conn_swap = connect(hostname_swap, driver, transport);
+	auto conn = connection_pool->get(hostname, driver, transport);
+	auto conn_swap = connection_pool->get(hostname_swap, driver, transport);
 	auto domain = find_by_name(conn.get(), name);
 	auto domain_swap = find_by_name(conn_swap.get(), name_swap);
 	// Get domains
@@ -457,15 +491,22 @@ void Libvirt_hypervisor::swap_migration(const std::string &name, const std::stri
 	// Check if domains are in running state
 	check_state(domain.get(), VIR_DOMAIN_RUNNING);
 	check_state(domain_swap.get(), VIR_DOMAIN_RUNNING);
+	// Both migrations have to be admitted by the migration limits (leave scheduler in destructor of the slot)
+	if (!slot || slot->get_destination() != hostname_swap)
+		throw Execute_later("Swap of " + name + " with " + name_swap + " is not admitted yet.", std::chrono::milliseconds(0));
+	// Fetch and parse the domain descriptions once for all guards.
+	auto description = std::make_shared<const Domain_description>(domain.get());
+	auto description_swap = std::make_shared<const Domain_description>(domain_swap.get());
+	details.set("queue-time", slot->get_queue_time().count());
 	// Suspend pscom (resume in destructor)
 	Pscom_handler pscom_handler(task, comm, time_measurement, false);
 	Pscom_handler pscom_handler_swap(task, comm, time_measurement, true);
 	// Guard migration of PCI devices.
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Create guards for device migration.";
-	Migrate_devices_guard dev_guard(pci_device_handler, domain, time_measurement, name);
-	Migrate_devices_guard dev_guard_swap(pci_device_handler, domain_swap, time_measurement, name_swap);
-	Migrate_ivshmem_guard ivshmem_guard(domain, time_measurement, name);
-	Migrate_ivshmem_guard ivshmem_guard_swap(domain_swap, time_measurement, name_swap);
+	Migrate_devices_guard dev_guard(pci_device_handler, domain, description, time_measurement, name);
+	Migrate_devices_guard dev_guard_swap(pci_device_handler, domain_swap, description_swap, time_measurement, name_swap);
+	Migrate_ivshmem_guard ivshmem_guard(domain, description, time_measurement, name, make_shmem_transfer(options, shmem_transfer_config, hostname_swap, name));
+	Migrate_ivshmem_guard ivshmem_guard_swap(domain_swap, description_swap, time_measurement, name_swap, make_shmem_transfer(options, shmem_transfer_config, hostname, name_swap));
 	// Guard repin of vcpus.
 	// In particular, resume after migration since repin is done after migration in suspended state.
 	Repin_guard repin_guard(domain, flags, task.vcpu_map, time_measurement, name);
@@ -475,7 +516,7 @@ void Libvirt_hypervisor::swap_migration(const std::string &name, const std::stri
 		FASTLIB_LOG(libvirt_hyp_log, trace) << "Starting swap-migration using snapshot.";
 		// TODO: RAII handler for snapshot for better error recovery
 		// TODO: Move to dedicated function
-		auto func = [=, &time_measurement](decltype(domain) domain1, decltype(name) name1, decltype(conn) conn1, decltype(hostname) hostname1, decltype(flags) flags1, decltype(dev_guard) &dev_guard1, decltype(ivshmem_guard) &ivshmem_guard1, decltype(repin_guard) &repin_guard1,
+		auto func = [=, &time_measurement, &details](decltype(domain) domain1, decltype(name) name1, decltype(conn) conn1, decltype(hostname) hostname1, decltype(flags) flags1, decltype(dev_guard) &dev_guard1, decltype(ivshmem_guard) &ivshmem_guard1, decltype(repin_guard) &repin_guard1,
 				decltype(domain) domain2, decltype(name) name2, decltype(conn) conn2, decltype(flags) flags2, decltype(dev_guard) &dev_guard2, decltype(ivshmem_guard) &ivshmem_guard2, decltype(repin_guard) &repin_guard2)
 		{
 			// Suspend vm1
@@ -487,9 +528,9 @@ void Libvirt_hypervisor::swap_migration(const std::string &name, const std::stri
 			// Create migrateuri for vm2
 			std::string migrate_uri = get_migrate_uri(rdma_migration, hostname1);
 			// Migrate vm2
-			time_measurement.tick("migrate-" + name2);
-			auto dest_domain2 = migrate_domain(domain2.get(), conn1.get(), flags2, migrate_uri);
-			time_measurement.tock("migrate-" + name2);
+			time_measurement.tick(get_migrate_tag("migrate-" + name2, options));
+			auto dest_domain2 = migrate_domain_monitored(domain2, name2, conn1.get(), hostname1, flags2, migrate_uri, options, postcopy_policy, comm, details, "migration-progress-" + name2);
+			time_measurement.tock(get_migrate_tag("migrate-" + name2, options));
 			// Set destination domain for guard of vm2
 			repin_guard2.set_destination_domain(dest_domain2);
 			dev_guard2.set_destination_domain(dest_domain2);
@@ -519,21 +560,21 @@ void Libvirt_hypervisor::swap_migration(const std::string &name, const std::stri
 			func(domain_swap, name_swap, conn_swap, hostname_swap, flags_swap, dev_guard_swap, ivshmem_guard_swap, repin_guard_swap, domain, name, conn, flags, dev_guard, ivshmem_guard, repin_guard);
 	} else {
 		FASTLIB_LOG(libvirt_hyp_log, trace) << "Starting swap-migration using parallel migration.";
-		time_measurement.tick("migrate");
+		time_measurement.tick(get_migrate_tag("migrate", options));
 		std::mutex time_measurement_mutex;
-		auto mig_func = [=, &time_measurement, &time_measurement_mutex](const std::string &hostname, virDomainPtr domain, virConnectPtr destconn, unsigned long flags, Migrate_devices_guard &dev_guard, Migrate_ivshmem_guard &ivshmem_guard, Repin_guard &repin_guard, const std::string &name)
+		auto mig_func = [=, &time_measurement, &time_measurement_mutex, &details](const std::string &hostname, std::shared_ptr<virDomain> domain, virConnectPtr destconn, unsigned long flags, Migrate_devices_guard &dev_guard, Migrate_ivshmem_guard &ivshmem_guard, Repin_guard &repin_guard, const std::string &name)
 		{
 			// Create migrateuri
 			std::string migrate_uri = get_migrate_uri(rdma_migration, hostname);
 			{
 				std::lock_guard<std::mutex> lock(time_measurement_mutex);
-				time_measurement.tick("migrate-" + name);
+				time_measurement.tick(get_migrate_tag("migrate-" + name, options));
 			}
 			// Migrate
-			auto dest_domain = migrate_domain(domain, destconn, flags, migrate_uri);
+			auto dest_domain = migrate_domain_monitored(domain, name, destconn, hostname, flags, migrate_uri, options, postcopy_policy, comm, details, "migration-progress-" + name);
 			{
 				std::lock_guard<std::mutex> lock(time_measurement_mutex);
-				time_measurement.tock("migrate-" + name);
+				time_measurement.tock(get_migrate_tag("migrate-" + name, options));
 			}
 			// Set destination domain for guards
 			dev_guard.set_destination_domain(dest_domain);
@@ -541,10 +582,10 @@ void Libvirt_hypervisor::swap_migration(const std::string &name, const std::stri
 			repin_guard.set_destination_domain(dest_domain);
 		};
 		{
-			auto mig1 = std::async(std::launch::async, [&](){mig_func(hostname_swap, domain.get(), conn_swap.get(), flags, dev_guard, ivshmem_guard, repin_guard, name);});
-			auto mig2 = std::async(std::launch::async, [&](){mig_func(hostname, domain_swap.get(), conn.get(), flags_swap, dev_guard_swap, ivshmem_guard_swap, repin_guard_swap, name_swap);});
+			auto mig1 = std::async(std::launch::async, [&](){mig_func(hostname_swap, domain, conn_swap.get(), flags, dev_guard, ivshmem_guard, repin_guard, name);});
+			auto mig2 = std::async(std::launch::async, [&](){mig_func(hostname, domain_swap, conn.get(), flags_swap, dev_guard_swap, ivshmem_guard_swap, repin_guard_swap, name_swap);});
 		}
-		time_measurement.tock("migrate");
+		time_measurement.tock(get_migrate_tag("migrate", options));
 	}
 }
 
@@ -577,77 +618,160 @@ std::string get_host_ip(const std::string &hostname)
 // Libvirt_hypervisor implementation
 //
 
-Libvirt_hypervisor::Libvirt_hypervisor(std::vector<std::string> nodes, std::string default_driver, std::string default_transport, unsigned int start_timeout, unsigned int stop_timeout) :
-	pci_device_handler(std::make_shared<PCI_device_handler>()),
+Libvirt_hypervisor::Libvirt_hypervisor(std::vector<std::string> nodes, std::string default_driver, std::string default_transport, unsigned int start_timeout, unsigned int stop_timeout, std::shared_ptr<Connection_pool> connection_pool, std::shared_ptr<Capacity_prober> capacity_prober, Migration_limits migration_limits, Aimd_policy aimd_policy, Postcopy_policy postcopy_policy, Retry_policy retry_policy, Shmem_transfer_config shmem_transfer_config, Start_pipeline_limits start_pipeline_limits) :
+	pci_device_handler(std::make_shared<PCI_device_handler>(connection_pool)),
+	connection_pool(std::move(connection_pool)),
+	capacity_prober(std::move(capacity_prober)),
+	migration_scheduler(std::make_shared<Migration_scheduler>(migration_limits)),
+	domain_event_monitor(std::make_shared<Domain_event_monitor>()),
 	nodes(std::move(nodes)),
 	default_driver(std::move(default_driver)),
 	default_transport(std::move(default_transport)),
 	start_timeout(start_timeout),
-	stop_timeout(stop_timeout)
+	stop_timeout(stop_timeout),
+	postcopy_policy(std::move(postcopy_policy)),
+	retry_policy(std::move(retry_policy)),
+	aimd_policy(std::move(aimd_policy)),
+	domain_location_index(std::make_shared<Domain_location_index>(this->connection_pool, this->nodes)),
+	shmem_transfer_config(std::move(shmem_transfer_config)),
+	start_pipeline(std::make_shared<Start_pipeline>(start_pipeline_limits))
 {
+	if (this->shmem_transfer_config.port != 0) {
+		auto pool = this->connection_pool;
+		auto driver = this->default_driver;
+		shmem_receiver = std::make_shared<Shmem_receiver>(this->shmem_transfer_config, this->nodes, [pool, driver](const std::string &region_name)
+		{
+			std::vector<std::string> domain_names;
+			auto conn = pool->get("", driver);
+			for (const auto &domain : get_active_domains(conn.get())) {
+				Domain_description description(domain.get());
+				const auto &devices = description.get_shmem_devices();
+				auto device_it = std::find_if(devices.begin(), devices.end(), [&region_name](const Ivshmem_device &device) {return device.name == region_name;});
+				if (device_it != devices.end())
+					domain_names.push_back(virDomainGetName(domain.get()));
+			}
+			return domain_names;
+		});
+	}
+	// Held weakly since the index holds the pool, which holds its listeners.
+	std::weak_ptr<Domain_event_monitor> weak_monitor = domain_event_monitor;
+	std::weak_ptr<Domain_location_index> weak_index = domain_location_index;
+	this->connection_pool->add_lifecycle_listener(
+		[weak_monitor, weak_index](virConnectPtr conn, const std::string &uri, const std::string &domain_name, int event, int detail)
+		{
+			(void) detail;
+			if (auto monitor = weak_monitor.lock())
+				monitor->notify(conn, domain_name, event);
+			if (auto index = weak_index.lock())
+				index->notify(uri, domain_name, event);
+		});
+	domain_location_index->start_seeding();
+	// Enumerate devices before the first start so it does not have to.
+	std::vector<std::string> host_uris{get_uri("", this->default_driver)};
+	for (const auto &node : this->nodes)
+		host_uris.push_back(get_uri(node, this->default_driver, this->default_transport));
+	pci_device_handler->prewarm(host_uris);
 }
 
 void Libvirt_hypervisor::start(const Start &task, Time_measurement &time_measurement)
 {
-	(void) time_measurement;
-	// Connect to libvirt to libvirt
-	auto driver = task.driver.is_valid() ? task.driver.get() : default_driver;
-	auto conn = connect("", driver);
+	// Shared with the callback, which may still be setting the value when get() returns.
+	auto started = std::make_shared<std::promise<void>>();
+	auto started_future = started->get_future();
+	// Not owned, since this waits for the start to finish.
+	std::shared_ptr<Time_measurement> time_measurement_ptr(&time_measurement, [](Time_measurement *){});
+	start_async(std::make_shared<const Start>(task), time_measurement_ptr, [started](std::exception_ptr error)
+	{
+		if (error)
+			started->set_exception(error);
+		else
+			started->set_value();
+	});
+	started_future.get();
+}
+
+void Libvirt_hypervisor::start_async(std::shared_ptr<const Start> task, std::shared_ptr<Time_measurement> time_measurement, std::function<void(std::exception_ptr)> callback)
+{
+	auto driver = task->driver.is_valid() ? task->driver.get() : default_driver;
 	// Check if domain already running on a remote host
-	if (!task.vm_name.is_valid())
+	if (!task->vm_name.is_valid())
 		throw std::runtime_error("vm-name is not valid.");
-	auto vm_name = task.vm_name.get();
-	check_remote_state(vm_name, nodes, VIR_DOMAIN_SHUTOFF);
-	// Get domain
-	std::shared_ptr<virDomain> domain;
-	if (task.xml.is_valid()) {
-		std::string xml = task.xml.get();
-		// Define domain from XML (or start paused if transient)
-		if (task.transient.get_or(false))
-			domain = create_from_xml(conn.get(), xml, true);
+	auto vm_name = task->vm_name.get();
+	auto locations = domain_location_index->find(vm_name);
+	if (!locations.empty())
+		throw std::runtime_error("Domain already running on " + locations.front().host);
+	auto transient = task->transient.get_or(false);
+	if (transient && !task->xml.is_valid())
+		throw std::runtime_error("XML description is missing which is required to create a transient domain.");
+	// Passed from step to step.
+	auto domain = std::make_shared<std::shared_ptr<virDomain>>();
+	std::vector<Start_pipeline::Step> steps;
+	steps.emplace_back(Start_pipeline::Stage::define, [this, task, time_measurement, driver, transient, domain]
+	{
+		time_measurement->tick("define");
+		auto conn = connection_pool->get("", driver);
+		if (task->xml.is_valid()) {
+			// Define domain from XML (or start paused if transient)
+			if (transient)
+				*domain = create_from_xml(conn.get(), task->xml.get(), true);
+			else
+				*domain = define_from_xml(conn.get(), task->xml.get());
+		} else {
+			// Find existing domain
+			*domain = find_by_name(conn.get(), task->vm_name.get());
+			// Get domain info + check if in shutdown state
+			check_state(domain->get(), VIR_DOMAIN_SHUTOFF);
+		}
+		// Set memory
+		if (task->memory.is_valid()) {
+			// TODO: Add separat max memory option
+			set_max_memory(domain->get(), task->memory);
+			set_memory(domain->get(), task->memory);
+		}
+		// Set VCPUs
+		if (task->vcpus.is_valid()) {
+			// TODO: Add separat max vcpus option
+			set_max_vcpus(domain->get(), task->vcpus);
+			set_vcpus(domain->get(), task->vcpus);
+		}
+		time_measurement->tock("define");
+	});
+	steps.emplace_back(Start_pipeline::Stage::create, [time_measurement, transient, domain]
+	{
+		time_measurement->tick("create");
+		// Start domain (or resume if transient)
+		if (transient)
+			resume_domain(domain->get());
 		else
-			domain = define_from_xml(conn.get(), xml);
-	} else {
-		if (task.transient.get_or(false))
-			throw std::runtime_error("XML description is missing which is required to create a transient domain.");
-		// Find existing domain
-		domain = find_by_name(conn.get(), *task.vm_name);
-		// Get domain info + check if in shutdown state
-		check_state(domain.get(), VIR_DOMAIN_SHUTOFF);
-	}
-	// Set memory
-	if (task.memory.is_valid()) {
-		// TODO: Add separat max memory option
-		set_max_memory(domain.get(), task.memory);
-		set_memory(domain.get(), task.memory);
-	}
-	// Set VCPUs
-	if (task.vcpus.is_valid()) {
-		// TODO: Add separat max vcpus option
-		set_max_vcpus(domain.get(), task.vcpus);
-		set_vcpus(domain.get(), task.vcpus);
-	}
-	// Start domain (or resume if transient)
-	if (task.transient.get_or(false))
-		resume_domain(domain.get());
-	else
-		create(domain.get());
-	// Attach devices
-	FASTLIB_LOG(libvirt_hyp_log, trace) << "Attach " << task.pci_ids.size() << " devices.";
-	for (auto &pci_id : task.pci_ids) {
-		FASTLIB_LOG(libvirt_hyp_log, trace) << "Attach device with PCI-ID " << pci_id.str();
-		pci_device_handler->attach(domain.get(), pci_id);
-	}
-	if (task.ivshmem.is_valid()) {
-		Ivshmem_device ivshmem_device(task.ivshmem->id, task.ivshmem->size);
-		attach_ivshmem_device(domain.get(), ivshmem_device);
+			create(domain->get());
+		time_measurement->tock("create");
+	});
+	if (!task->pci_ids.empty() || task->ivshmem.is_valid()) {
+		steps.emplace_back(Start_pipeline::Stage::attach, [this, task, time_measurement, domain]
+		{
+			time_measurement->tick("attach");
+			// Attach devices
+			FASTLIB_LOG(libvirt_hyp_log, trace) << "Attach " << task->pci_ids.size() << " devices.";
+			for (auto &pci_id : task->pci_ids) {
+				FASTLIB_LOG(libvirt_hyp_log, trace) << "Attach device with PCI-ID " << pci_id.str();
+				pci_device_handler->attach(domain->get(), pci_id);
+			}
+			if (task->ivshmem.is_valid()) {
+				Ivshmem_device ivshmem_device(task->ivshmem->id, task->ivshmem->size);
+				attach_ivshmem_device(domain->get(), ivshmem_device);
+			}
+			time_measurement->tock("attach");
+		});
 	}
 	// Wait for domain to boot
-	if (task.probe_with_ssh.get_or(true)) {
+	auto get_probe_host = [task, domain]() -> std::string
+	{
+		if (!task->probe_with_ssh.get_or(true))
+			return "";
 		FASTLIB_LOG(libvirt_hyp_log, trace) << "Wait for domain to boot.";
-		const auto hostname = task.probe_hostname.is_valid() ? task.probe_hostname.get() : get_domain_name(domain.get());
-		probe_ssh_connection(hostname, std::chrono::seconds(start_timeout));
-	}
+		return task->probe_hostname.is_valid() ? task->probe_hostname.get() : get_domain_name(domain->get());
+	};
+	start_pipeline->run(std::move(steps), get_probe_host, std::chrono::seconds(start_timeout), std::move(callback));
 }
 
 void Libvirt_hypervisor::stop(const Stop &task, Time_measurement &time_measurement)
@@ -656,7 +780,7 @@ void Libvirt_hypervisor::stop(const Stop &task, Time_measurement &time_measureme
 	// Connect to libvirt to libvirt
 	auto driver = task.driver.is_valid() ? task.driver.get() : default_driver;
 	auto func = [&](const std::string &vm_name){
-		auto conn = connect("", driver);
+		auto conn = connection_pool->get("", driver);
 		// Get domain by name
 		std::shared_ptr<virDomain> domain(
 			find_by_name(conn.get(), vm_name)
@@ -678,7 +802,9 @@ void Libvirt_hypervisor::stop(const Stop &task, Time_measurement &time_measureme
 		// Wait until domain is shut down
 		FASTLIB_LOG(libvirt_hyp_log, trace) << "Wait until domain is shut down.";
 		try {
-			wait_for_state(domain.get(), VIR_DOMAIN_SHUTOFF, std::chrono::seconds(stop_timeout));
+			// Polling is only a fallback if lifecycle events are received on the connection.
+			auto poll_interval = connection_pool->has_lifecycle_events(conn.get()) ? std::chrono::seconds(5) : std::chrono::seconds(1);
+			domain_event_monitor->wait_for_state(domain.get(), VIR_DOMAIN_SHUTOFF, std::chrono::seconds(stop_timeout), poll_interval);
 		} catch (const std::runtime_error &e) {
 			auto libvirt_error = virGetLastError();
 			if (!libvirt_error || persistent || (libvirt_error->code != VIR_ERR_NO_DOMAIN))
@@ -694,7 +820,7 @@ void Libvirt_hypervisor::stop(const Stop &task, Time_measurement &time_measureme
 	if (task.vm_name) {
 		func(*task.vm_name);
 	} else if (task.regex) {
-		auto conn = connect("", driver);
+		auto conn = connection_pool->get("", driver);
 		auto vm_names = get_active_domain_names(conn.get());
 		FASTLIB_LOG(libvirt_hyp_log, trace) << "Using regex: " << *task.regex << ".";
 		std::regex regex(*task.regex);
@@ -711,7 +837,191 @@ void Libvirt_hypervisor::stop(const Stop &task, Time_measurement &time_measureme
 	}
 }
 
-void Libvirt_hypervisor::migrate(const Migrate &task, Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+/**
+ * \brief Evacuate task of a single domain which carries the plan of its evacuation.
+ *
+ * The plan is shared by all tasks of an evacuation, so overlapping evacuations do not interfere.
+ */
+struct Planned_evacuate :
+	public Evacuate
+{
+	std::shared_ptr<Evacuation_plan> plan;
+	// Only set if the concurrency of evacuations is adaptive.
+	std::shared_ptr<Concurrency_controller> concurrency_controller;
+};
+
+void Libvirt_hypervisor::admit(std::shared_ptr<const Task> task, std::function<void(std::shared_ptr<void> reservation)> admitted)
+{
+	if (auto evacuate_task = std::dynamic_pointer_cast<const Planned_evacuate>(task)) {
+		admit_evacuation(evacuate_task, admitted);
+		return;
+	}
+	auto migrate_task = std::dynamic_pointer_cast<const Migrate>(task);
+	if (!migrate_task) {
+		admitted(nullptr);
+		return;
+	}
+	// A retry may continue at another destination.
+	auto destination = get_retry_destination(*task, migrate_task->dest_hostname);
+	unsigned long long bytes = 0;
+	try {
+		auto driver = migrate_task->driver.get_or(default_driver);
+		auto conn = connection_pool->get("", driver);
+		bytes = get_memory_size(find_by_name(conn.get(), migrate_task->vm_name).get()) * 1024;
+		if (migrate_task->swap_with.is_valid()) {
+			auto conn_swap = connection_pool->get(destination, driver, migrate_task->transport.get_or(default_transport));
+			bytes += get_memory_size(find_by_name(conn_swap.get(), migrate_task->swap_with.get().vm_name).get()) * 1024;
+		}
+	} catch (const std::exception &e) {
+		// Executing the task reports the error, but it is admitted anyway so it does not wait for admission again.
+		FASTLIB_LOG(libvirt_hyp_log, debug) << "Admit migration of " << migrate_task->vm_name << " without its size: " << e.what();
+	}
+	auto key = task.get();
+	migration_scheduler->request(destination, bytes, [this, key, admitted](std::unique_ptr<Migration_slot> slot)
+	{
+		Admitted_slots slots;
+		slots.migration_slot = std::move(slot);
+		admitted(reserve_admitted_slots(key, std::move(slots)));
+	});
+}
+
+void Libvirt_hypervisor::admit_evacuation(std::shared_ptr<const Planned_evacuate> task, std::function<void(std::shared_ptr<void> reservation)> admitted)
+{
+	const auto &domain_name = task->vm_name.get();
+	unsigned long long bytes = 0;
+	try {
+		auto conn = connection_pool->get("", task->driver.get_or(default_driver));
+		bytes = get_memory_size(find_by_name(conn.get(), domain_name).get()) * 1024;
+	} catch (const std::exception &e) {
+		// Executing the task reports the error, but it is admitted anyway so it does not wait for admission again.
+		FASTLIB_LOG(libvirt_hyp_log, debug) << "Admit evacuation of " << domain_name << " without its size: " << e.what();
+	}
+	// Request the migration slot once the evacuation allows another migration, in the same order evacuate() would.
+	auto request_migration_slot = [this, task, domain_name, bytes, admitted](std::unique_ptr<Concurrency_controller::Slot> concurrency_slot)
+	{
+		std::string destination;
+		try {
+			destination = get_retry_destination(*task, task->plan->get_destination(domain_name));
+		} catch (const std::exception &) {
+			// Executing the task reports the error.
+			Admitted_slots slots;
+			slots.concurrency_slot = std::move(concurrency_slot);
+			admitted(reserve_admitted_slots(task.get(), std::move(slots)));
+			return;
+		}
+		// The concurrency slot is shared since std::function requires a copyable callback.
+		std::shared_ptr<Concurrency_controller::Slot> shared_concurrency_slot(std::move(concurrency_slot));
+		migration_scheduler->request(destination, bytes, [this, task, shared_concurrency_slot, admitted](std::unique_ptr<Migration_slot> migration_slot)
+		{
+			Admitted_slots slots;
+			slots.concurrency_slot = shared_concurrency_slot;
+			slots.migration_slot = std::move(migration_slot);
+			admitted(reserve_admitted_slots(task.get(), std::move(slots)));
+		});
+	};
+	if (task->concurrency_controller)
+		task->concurrency_controller->request(domain_name, request_migration_slot);
+	else
+		request_migration_slot(nullptr);
+}
+
+std::shared_ptr<void> Libvirt_hypervisor::reserve_admitted_slots(const Task *key, Admitted_slots slots)
+{
+	{
+		std::lock_guard<std::mutex> lock(admitted_slots_mutex);
+		admitted_slots[key] = std::move(slots);
+	}
+	// Frees the slots if the task did not take them. The deleter is called although no object is owned.
+	return std::shared_ptr<void>(nullptr, [this, key](void *)
+	{
+		std::lock_guard<std::mutex> lock(admitted_slots_mutex);
+		admitted_slots.erase(key);
+	});
+}
+
+std::string Libvirt_hypervisor::get_retry_destination(const Task &task, const std::string &destination)
+{
+	std::lock_guard<std::mutex> lock(retry_states_mutex);
+	auto state_it = retry_states.find(&task);
+	return state_it == retry_states.end() ? destination : state_it->second.task.dest_hostname;
+}
+
+Libvirt_hypervisor::Admitted_slots Libvirt_hypervisor::take_admitted_slots(const Task &task)
+{
+	std::lock_guard<std::mutex> lock(admitted_slots_mutex);
+	auto slots_it = admitted_slots.find(&task);
+	if (slots_it == admitted_slots.end())
+		return Admitted_slots();
+	auto slots = std::move(slots_it->second);
+	admitted_slots.erase(slots_it);
+	return slots;
+}
+
+void Libvirt_hypervisor::migrate(const Migrate &task, const Migration_options &options, Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm)
+{
+	migrate_with_retries(task, task, options, time_measurement, details, comm, nullptr, std::move(take_admitted_slots(task).migration_slot));
+}
+
+void Libvirt_hypervisor::migrate_with_retries(const Task &key, Migrate task, const Migration_options &options, Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm, std::function<std::string()> get_alternate_destination, std::unique_ptr<Migration_slot> slot)
+{
+	unsigned int retries = 0;
+	std::vector<std::string> fallbacks;
+	{
+		// Continue with the state of the last attempt if the task is executed again.
+		std::lock_guard<std::mutex> lock(retry_states_mutex);
+		auto state_it = retry_states.find(&key);
+		if (state_it != retry_states.end()) {
+			task = std::move(state_it->second.task);
+			retries = state_it->second.retries;
+			fallbacks = std::move(state_it->second.fallbacks);
+			retry_states.erase(state_it);
+		}
+	}
+	auto set_details = [&]
+	{
+		details.set("retries", retries);
+		if (!fallbacks.empty())
+			details.set("fallbacks", fallbacks);
+	};
+	try {
+		migrate_once(task, options, time_measurement, details, comm, slot);
+	} catch (const Execute_later &) {
+		// Not admitted for the current destination, the next attempt continues with this state.
+		slot.reset();
+		std::lock_guard<std::mutex> lock(retry_states_mutex);
+		retry_states[&key] = Retry_state{std::move(task), retries, std::move(fallbacks)};
+		throw;
+	} catch (const Migration_error &e) {
+		if (!e.retryable || retries == options.retry_counter) {
+			set_details();
+			throw;
+		}
+		++retries;
+		FASTLIB_LOG(libvirt_hyp_log, warn) << e.what() << " Retry " << retries << " of " << options.retry_counter << ".";
+		// Guards have restored the domain on the source, so the next attempt starts from scratch.
+		// A failing destination is replaced first, as a downgrade would not help.
+		std::string fallback;
+		if (e.destination_failed)
+			fallback = switch_destination(task, get_alternate_destination);
+		if (fallback == "")
+			fallback = downgrade_migration(task);
+		if (fallback == "" && !e.destination_failed)
+			fallback = switch_destination(task, get_alternate_destination);
+		if (fallback != "") {
+			FASTLIB_LOG(libvirt_hyp_log, trace) << "Fall back to " << fallback << ".";
+			fallbacks.push_back(fallback);
+		}
+		// Back off without a worker and without the slot, the migration is admitted again for its next attempt.
+		slot.reset();
+		auto message = "Retry migration of " + task.vm_name + ".";
+		std::lock_guard<std::mutex> lock(retry_states_mutex);
+		retry_states[&key] = Retry_state{std::move(task), retries, std::move(fallbacks)};
+		throw Execute_later(message, retry_policy.get_backoff(retries));
+	}
+	set_details();
+}
+
+void Libvirt_hypervisor::migrate_once(const Migrate &task, const Migration_options &options, Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm, std::unique_ptr<Migration_slot> &slot)
 {
 	const std::string &dest_hostname = task.dest_hostname;
 	auto migration_type = task.migration_type.is_valid() ? task.migration_type.get() : "warm";
@@ -723,41 +1033,53 @@ void Libvirt_hypervisor::migrate(const Migrate &task, Time_measurement &time_mea
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "rdma-migration=" << rdma_migration;
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "driver=" << driver;
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "transport=" << transport;
+	FASTLIB_LOG(libvirt_hyp_log, trace) << "parallel-connections=" << options.parallel_connections;
 	// Set migration flags
 	auto base_flags = get_migrate_flags(migration_type);
 	// Swap migration or normal migration
 	if (task.swap_with.is_valid()) {
 		if (driver != "qemu")
 			throw std::runtime_error("Currently swap migration is only supported by the qemu driver.");
-		swap_migration(task.vm_name, task.swap_with.get().vm_name, get_hostname(), dest_hostname, base_flags, base_flags, rdma_migration, driver, transport, task, comm, time_measurement);
+		swap_migration(task.vm_name, task.swap_with.get().vm_name, get_hostname(), dest_hostname, base_flags, base_flags, rdma_migration, driver, transport, task, options, comm, time_measurement, details, slot);
 	} else {
 		auto flags = base_flags;
 		// Connect to libvirt
-		auto conn = connect("", driver);
+		auto conn = connection_pool->get("", driver);
 		// Get domain by name
 		auto domain = find_by_name(conn.get(), task.vm_name);
 		// Check if domain is in running state
 		check_state(domain.get(), VIR_DOMAIN_RUNNING);
+		// The migration has to be admitted by the migration limits (leave scheduler in destructor of the slot)
+		if (!slot || slot->get_destination() != dest_hostname)
+			throw Execute_later("Migration of " + task.vm_name + " to " + dest_hostname + " is not admitted yet.", std::chrono::milliseconds(0));
+		// Fetch and parse the domain description once for all guards.
+		auto description = std::make_shared<const Domain_description>(domain.get());
+		details.set("queue-time", slot->get_queue_time().count());
 		// Suspend pscom (resume in destructor)
 		Pscom_handler pscom_handler(task, comm, time_measurement);
 		// Guard migration of PCI devices.
 		FASTLIB_LOG(libvirt_hyp_log, trace) << "Create guard for device migration.";
-		Migrate_ivshmem_guard ivshmem_guard(domain, time_measurement);
-		Migrate_devices_guard dev_guard(pci_device_handler, domain, time_measurement);
+		Migrate_ivshmem_guard ivshmem_guard(domain, description, time_measurement, "", make_shmem_transfer(options, shmem_transfer_config, dest_hostname, task.vm_name));
+		Migrate_devices_guard dev_guard(pci_device_handler, domain, description, time_measurement);
 		// Guard repin of vcpus.
 		// In particular, resume after migration since repin is done after migration in suspended state.
 		Repin_guard repin_guard(domain, flags, task.vcpu_map, time_measurement);
 		// Connect to destination
-		auto dest_connection = connect(dest_hostname, driver, transport);
+		std::shared_ptr<virConnect> dest_connection;
+		try {
+			dest_connection = connection_pool->get(dest_hostname, driver, transport);
+		} catch (const std::runtime_error &e) {
+			throw Migration_error(e.what(), true);
+		}
 		// Create migrateuri
 		// TODO: Fix libvirt lxctools driver so no IP has to be sent via migrate uri.
 		std::string migrate_uri = (driver == "lxctools") ?
 			get_host_ip(dest_hostname) :
 			get_migrate_uri(rdma_migration, dest_hostname);
 		// Migrate domain
-		time_measurement.tick("migrate");
-		auto dest_domain = migrate_domain(domain.get(), dest_connection.get(), flags, migrate_uri);
-		time_measurement.tock("migrate");
+		time_measurement.tick(get_migrate_tag("migrate", options));
+		auto dest_domain = migrate_domain_monitored(domain, task.vm_name, dest_connection.get(), dest_hostname, flags, migrate_uri, options, postcopy_policy, comm, details, "migration-progress");
+		time_measurement.tock(get_migrate_tag("migrate", options));
 		// Set destination domain for guards
 		FASTLIB_LOG(libvirt_hyp_log, trace) << "Set destination domain for guards.";
 		repin_guard.set_destination_domain(dest_domain);
@@ -766,54 +1088,30 @@ void Libvirt_hypervisor::migrate(const Migrate &task, Time_measurement &time_mea
 	}
 }
 
-int get_capacity(const std::string &host, const std::string &driver, const std::string transport = "")
-{
-	auto conn = connect(host, driver, transport);
-	auto cpu_count = get_host_cpu_count(conn.get());
-	auto domain_count = get_active_domain_names(conn.get()).size();
-	return cpu_count - domain_count;
-}
-
-std::tuple<std::deque<std::pair<std::string, int>> &, std::mutex &> get_destinations_capacities()
-{
-	static std::mutex dest_caps_mutex;
-	static std::deque<std::pair<std::string, int>> dest_caps;
-	return std::tie(dest_caps, dest_caps_mutex);
-}
-
-void init_destinations_capacities(const std::vector<std::string> &destinations, const std::string &driver, const std::string &transport, bool overbooking)
-{
-	FASTLIB_LOG(libvirt_hyp_log, trace) << "init dest_caps";
-	auto &dest_caps = std::get<0>(get_destinations_capacities());
-	dest_caps.clear();
-	for (const auto &destination : destinations) {
-		dest_caps.emplace_back(destination, get_capacity(destination, driver, transport));
-	}
-	FASTLIB_LOG(libvirt_hyp_log, trace) << "dest_caps.size() = " << dest_caps.size();
-	// If no overbooking allowed -> drop all full hosts
-	FASTLIB_LOG(libvirt_hyp_log, trace) << "overbooking:" << overbooking;
-	if (!overbooking) {
-		dest_caps.erase(std::remove_if(dest_caps.begin(), dest_caps.end(), 
-				[](const std::pair<std::string, int> &x){return x.second < 1;}),
-				dest_caps.end());
-	}
-	FASTLIB_LOG(libvirt_hyp_log, trace) << "dest_caps.size() = " << dest_caps.size();
-}
-
 std::vector<std::shared_ptr<Task>> Libvirt_hypervisor::get_evacuate_tasks(const Task_container &task_cont)
 {
 	if (task_cont.type(true) != "node evacuated")
 		throw std::runtime_error("No evacuate tasks.");
 	auto base_task = std::dynamic_pointer_cast<Evacuate>(task_cont.tasks.front());
 	auto overbooking = base_task->overbooking.get_or(true);
+	auto mode = base_task->mode.get_or("auto");
 	auto driver = base_task->driver.get_or(default_driver);
 	auto transport = base_task->transport.get_or(default_transport);
-	auto conn = connect("", driver);
-	auto domain_names = get_active_domain_names(conn.get());
+	auto conn = connection_pool->get("", driver);
+	auto domain_demands = get_domain_demands(conn.get());
+	auto capacities = capacity_prober->probe(base_task->destinations, driver, transport, pci_device_handler);
+	if (capacities.empty() && !domain_demands.empty())
+		throw std::runtime_error("No destination host reachable to evacuate to.");
+	// Plan all migrations at once before the first one starts.
+	auto plan = std::make_shared<Evacuation_plan>(domain_demands, std::move(capacities), mode, overbooking);
+	capacity_prober->update(plan->get_capacities(), driver, transport);
+	std::shared_ptr<Concurrency_controller> concurrency_controller;
+	if (aimd_policy.adaptive)
+		concurrency_controller = std::make_shared<Concurrency_controller>(aimd_policy, connection_pool, driver);
 	std::vector<std::shared_ptr<Task>> tasks;
-	for (auto &domain_name : domain_names) {
+	for (const auto &demand : domain_demands) {
 		// TODO: Implement copy constructor for Evacuate task
-		auto task = std::make_shared<Evacuate>();
+		auto task = std::make_shared<Planned_evacuate>();
 		task->destinations = base_task->destinations;
 		task->mode = base_task->mode;
 		task->overbooking = base_task->overbooking;
@@ -823,10 +1121,11 @@ std::vector<std::shared_ptr<Task>> Libvirt_hypervisor::get_evacuate_tasks(const
 		task->pscom_hook_procs = base_task->pscom_hook_procs;
 		task->driver = base_task->driver;
 		task->transport = base_task->transport;
-		task->vm_name.set(domain_name);
+		task->vm_name.set(demand.name);
+		task->plan = plan;
+		task->concurrency_controller = concurrency_controller;
 		tasks.push_back(task);
 	}
-	init_destinations_capacities(base_task->destinations, driver, transport, overbooking);
 	return tasks;
 }
 
@@ -845,57 +1144,32 @@ Migrate conv_evacuate_to_migrate(const std::string &domain_name, const std::stri
 	return mig_task;
 }
 
-std::string get_next_destination(std::deque<std::pair<std::string, int>> &dest_caps, bool overbooking, const std::string &mode, std::mutex &m)
-{
-	using dest_caps_deque = std::deque<std::pair<std::string, int>>;
-	// To few destinations to migrate to -> error
-	if (dest_caps.empty())
-		throw std::runtime_error("No destination host left to evacuate to.");
-	// Lock for thread safety
-	std::lock_guard<std::mutex> lock(m);
-	// Use first destination in list
-	auto destination = dest_caps.front().first;
-	// Reduce capacity of destination
-	--dest_caps.front().second;
-	if (mode == "compact") { // fill host, then go to next
-		if (dest_caps.front().second < 1) { // if host full/overbooked
-			if (!overbooking) { // no overbooking -> drop host
-				dest_caps.pop_front();
-			} else { // overbooking -> rotate to next host
-				std::rotate(dest_caps.begin(), dest_caps.begin() + 1, dest_caps.end());
-			}
-		}
-	} else if (mode == "scatter") { // rotate through destinations
-		if (dest_caps.front().second < 1 && !overbooking) {
-				dest_caps.pop_front();
-		} else {
-			std::rotate(dest_caps.begin(), dest_caps.begin() + 1, dest_caps.end());
-		}
-	} else if (mode == "auto") { // sort to distribute domains water-filling-like
-		std::sort(dest_caps.begin(), dest_caps.end(),
-				[](dest_caps_deque::const_reference a, dest_caps_deque::const_reference b)
-				{return a.second > b.second;});
-	}
-	return destination;
-}
-
-void Libvirt_hypervisor::evacuate(const Evacuate &task, Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Libvirt_hypervisor::evacuate(const Evacuate &task, const Migration_options &options, Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm)
 {
-	auto mode = task.mode.get_or("auto");
-	auto overbooking = task.overbooking.get_or(true);
-	auto driver = task.driver.get_or(default_driver);
-	auto transport = task.transport.get_or(default_transport);
 	auto domain_name = task.vm_name.get();
-	// Connect to libvirt
-	auto conn = connect("", driver);
-	// Get cap per destination and mutex for synchronization in pair
-	auto dest_caps_tuple = get_destinations_capacities();
-	const auto &destination = get_next_destination(std::get<0>(dest_caps_tuple), overbooking, mode, std::get<1>(dest_caps_tuple));
+	// Get plan of this evacuation
+	auto planned_task = dynamic_cast<const Planned_evacuate *>(&task);
+	if (!planned_task || !planned_task->plan)
+		throw std::runtime_error("No evacuation planned for domain " + domain_name + ".");
+	auto plan = planned_task->plan;
+	// The adaptive concurrency of this evacuation has to admit another migration (free slot in destructor)
+	auto slots = take_admitted_slots(task);
+	if (planned_task->concurrency_controller) {
+		if (!slots.concurrency_slot)
+			throw Execute_later("Evacuation of " + domain_name + " is not admitted yet.", std::chrono::milliseconds(0));
+		details.set("concurrency", slots.concurrency_slot->get_concurrency());
+	}
+	auto destination = plan->get_destination(domain_name);
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Evacuate domain " << domain_name << " to " << destination << ".";
 	// Convert task
 	auto mig_task = conv_evacuate_to_migrate(domain_name, destination, task);
-	// Migrate
-	migrate(mig_task, time_measurement, comm);
+	// Migrate (migration options like parallel-connections apply to evacuations as well)
+	migrate_with_retries(task, mig_task, options, time_measurement, details, comm, [&]
+	{
+		return plan->get_alternate_destination(domain_name);
+	}, std::move(slots.migration_slot));
+	if (planned_task->concurrency_controller)
+		details.set("max-concurrency", planned_task->concurrency_controller->get_max_concurrency());
 }
 
 void Libvirt_hypervisor::repin(const Repin &task, Time_measurement &time_measurement)
@@ -904,7 +1178,7 @@ void Libvirt_hypervisor::repin(const Repin &task, Time_measurement &time_measure
 	auto &vcpu_map = task.vcpu_map;
 	auto driver = task.driver.is_valid() ? task.driver.get() : default_driver;
 	// Connect to libvirt
-	auto conn = connect("", driver);
+	auto conn = connection_pool->get("", driver);
 	// Get domain by name
 	auto domain = find_by_name(conn.get(), task.vm_name);
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Repin domain " << task.vm_name << ".";
@@ -916,7 +1190,7 @@ void Libvirt_hypervisor::suspend(const fast::msg::migfra::Suspend &task, fast::m
 	(void) time_measurement;
 	auto driver = task.driver.is_valid() ? task.driver.get() : default_driver;
 	// Connect to libvirt
-	auto conn = connect("", driver);
+	auto conn = connection_pool->get("", driver);
 	// Get domain by name
 	auto domain = find_by_name(conn.get(), task.vm_name);
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Suspend domain " << task.vm_name << ".";
@@ -928,7 +1202,7 @@ void Libvirt_hypervisor::resume(const fast::msg::migfra::Resume &task, fast::msg
 	(void) time_measurement;
 	auto driver = task.driver.is_valid() ? task.driver.get() : default_driver;
 	// Connect to libvirt
-	auto conn = connect("", driver);
+	auto conn = connection_pool->get("", driver);
 	// Get domain by name
 	auto domain = find_by_name(conn.get(), task.vm_name);
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Resume domain " << task.vm_name << ".";
@@ -10,12 +10,26 @@
 #define LIBVIRT_HYPERVISOR_HPP
 
 #include "hypervisor.hpp"
+#include "postcopy_policy.hpp"
+#include "retry_policy.hpp"
+#include "migration_scheduler.hpp"
+#include "concurrency_controller.hpp"
+#include "shmem_transfer.hpp"
+#include "start_pipeline.hpp"
 
 #include <memory>
 #include <vector>
 #include <string>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
 
 class PCI_device_handler;
+class Connection_pool;
+class Capacity_prober;
+class Domain_event_monitor;
+class Domain_location_index;
+struct Planned_evacuate;
 
 /**
  * \brief Implementation of the Hypervisor interface using libvirt API.
@@ -34,8 +48,24 @@ public:
 	 *
 	 * Establishes an connection to qemu on the local host.
 	 * \param nodes Defines the nodes to look for already running virtual machines.
+	 * \param connection_pool The pool all libvirt connections are taken from.
+	 * \param capacity_prober Probes the capacities of evacuation destinations.
+	 * \param migration_limits Limits concurrent migrations leaving this host.
+	 * \param aimd_policy Adapts the number of parallel migrations of evacuations.
+	 * \param postcopy_policy Decides when post-copy migrations switch to post-copy.
+	 * \param retry_policy Defines the backoff between retries of failed migrations.
+	 * \param shmem_transfer_config Port and chunk size of transfers of ivshmem regions, a receiver is started if the port is set.
+	 * \param start_pipeline_limits Concurrency of the stages of starting domains.
 	 */
-	Libvirt_hypervisor(std::vector<std::string> nodes, std::string default_driver, std::string default_transport, unsigned int start_timeout, unsigned int stop_timeout);
+	Libvirt_hypervisor(std::vector<std::string> nodes, std::string default_driver, std::string default_transport, unsigned int start_timeout, unsigned int stop_timeout, std::shared_ptr<Connection_pool> connection_pool, std::shared_ptr<Capacity_prober> capacity_prober, Migration_limits migration_limits, Aimd_policy aimd_policy, Postcopy_policy postcopy_policy, Retry_policy retry_policy, Shmem_transfer_config shmem_transfer_config, Start_pipeline_limits start_pipeline_limits);
+	/**
+	 * \brief Method to wait for the admission of a task without blocking the calling thread.
+	 *
+	 * Migrations are queued in the migration scheduler until they fit the migration limits.
+	 * Evacuations additionally wait for their adaptive concurrency before.
+	 * The slots of an admitted task are taken over by migrate() or evacuate().
+	 */
+	void admit(std::shared_ptr<const fast::msg::migfra::Task> task, std::function<void(std::shared_ptr<void> reservation)> admitted) override;
 	/**
 	 * \brief Method to start a virtual machine.
 	 *
@@ -45,6 +75,13 @@ public:
 	 * \param memory The amount of ram memory to be assigned to the vm in KiB.
 	 */
 	void start(const fast::msg::migfra::Start &task, fast::msg::migfra::Time_measurement &time_measurement) override;
+	/**
+	 * \brief Method to start a virtual machine through the start pipeline.
+	 *
+	 * The domain is defined, created and its devices are attached by the workers of the respective stage.
+	 * Afterwards it is probed with SSH if requested.
+	 */
+	void start_async(std::shared_ptr<const fast::msg::migfra::Start> task, std::shared_ptr<fast::msg::migfra::Time_measurement> time_measurement, std::function<void(std::exception_ptr)> callback) override;
 	/**
 	 * \brief Method to stop a virtual machine.
 	 *
@@ -64,11 +101,11 @@ public:
 	 * \param rdma_migration Enables rdma migration.
 	 * \param time_measurement Time measurement facility.
 	 */
-	void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void migrate(const fast::msg::migfra::Migrate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm) override;
 	/**
 	 * \brief Method to evacuate an entire host, i.e., migrate all domains away from this host.
 	 */
-	void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void evacuate(const fast::msg::migfra::Evacuate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm) override;
 	/**
 	 * \brief Method to repin vcpus of a virtual machine.
 	 *
@@ -93,15 +130,74 @@ public:
  	 */
 	std::vector<std::shared_ptr<fast::msg::migfra::Task>> get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont) override;
 private:
+	/**
+	 * \brief Migrate and retry failed migrations along the fallback chain.
+	 *
+	 * A retry throws Execute_later after the fallback is chosen, so the worker and the slots are free during the backoff.
+	 * The state of the retries is kept until the task is executed again.
+	 * \param key The executed task, which identifies the migration when it is executed again.
+	 * \param get_alternate_destination Returns another destination to retry at (e.g., for evacuations) or is empty.
+	 */
+	void migrate_with_retries(const fast::msg::migfra::Task &key, fast::msg::migfra::Migrate task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm, std::function<std::string()> get_alternate_destination, std::unique_ptr<Migration_slot> slot);
+	/**
+	 * \param slot The slot the migration was admitted with. Is replaced if it is empty or for another destination.
+	 */
+	void migrate_once(const fast::msg::migfra::Migrate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm, std::unique_ptr<Migration_slot> &slot);
+	void swap_migration(const std::string &name, const std::string &name_swap, const std::string &hostname, const std::string &hostname_swap, unsigned long flags, unsigned long flags_swap, bool rdma_migration, const std::string &driver, const std::string &transport, const fast::msg::migfra::Migrate &task, const Migration_options &options, std::shared_ptr<fast::Communicator> comm, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::unique_ptr<Migration_slot> &slot);
+	/**
+	 * \brief Slots a task was admitted with, empty if the task was not admitted or did not need a slot.
+	 */
+	struct Admitted_slots
+	{
+		std::shared_ptr<Concurrency_controller::Slot> concurrency_slot;
+		std::unique_ptr<Migration_slot> migration_slot;
+	};
 
-	void swap_migration(const std::string &name, const std::string &name_swap, const std::string &hostname, const std::string &hostname_swap, unsigned long flags, unsigned long flags_swap, bool rdma_migration, const std::string &driver, const std::string &transport, const fast::msg::migfra::Migrate &task, std::shared_ptr<fast::Communicator> comm, fast::msg::migfra::Time_measurement &time_measurement);
+	void admit_evacuation(std::shared_ptr<const Planned_evacuate> task, std::function<void(std::shared_ptr<void> reservation)> admitted);
+	/**
+	 * \brief Keep the slots of an admitted task until it takes them. The returned reservation frees slots which are not taken.
+	 */
+	std::shared_ptr<void> reserve_admitted_slots(const fast::msg::migfra::Task *key, Admitted_slots slots);
+	/**
+	 * \brief Take the slots a task was admitted with.
+	 */
+	Admitted_slots take_admitted_slots(const fast::msg::migfra::Task &task);
+	/**
+	 * \brief Get the destination a retried migration continues at or the passed destination if the task is not retried.
+	 */
+	std::string get_retry_destination(const fast::msg::migfra::Task &task, const std::string &destination);
 
 	std::shared_ptr<PCI_device_handler> pci_device_handler;
+	std::shared_ptr<Connection_pool> connection_pool;
+	std::shared_ptr<Capacity_prober> capacity_prober;
+	std::shared_ptr<Migration_scheduler> migration_scheduler;
+	std::shared_ptr<Domain_event_monitor> domain_event_monitor;
 	std::vector<std::string> nodes;
 	std::string default_driver;
 	std::string default_transport;
 	unsigned int start_timeout;
 	unsigned int stop_timeout;
+	Postcopy_policy postcopy_policy;
+	Retry_policy retry_policy;
+	Aimd_policy aimd_policy;
+	std::shared_ptr<Domain_location_index> domain_location_index;
+	Shmem_transfer_config shmem_transfer_config;
+	// Only set if the transfer of shmem regions is configured.
+	std::shared_ptr<Shmem_receiver> shmem_receiver;
+	std::shared_ptr<Start_pipeline> start_pipeline;
+	// (task : slots) of admitted tasks which are not executed yet.
+	std::unordered_map<const fast::msg::migfra::Task *, Admitted_slots> admitted_slots;
+	std::mutex admitted_slots_mutex;
+	// Migration of a task which is executed again to retry it.
+	struct Retry_state
+	{
+		fast::msg::migfra::Migrate task;
+		unsigned int retries;
+		std::vector<std::string> fallbacks;
+	};
+	// (task : retry state) of retried tasks until they are executed again.
+	std::unordered_map<const fast::msg::migfra::Task *, Retry_state> retry_states;
+	std::mutex retry_states_mutex;
 };
 
 #endif
@@ -0,0 +1,182 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "migration_monitor.hpp"
+
+#include "utility.hpp"
+
+#include <libvirt/virterror.h>
+#include <fast-lib/log.hpp>
+
+#include <regex>
+#include <algorithm>
+#include <limits>
+#include <functional>
+
+std::chrono::milliseconds Migration_monitor::interval = std::chrono::milliseconds(1000);
+std::string Migration_monitor::topic_template = "fast/migfra/<hostname>/progress";
+int Migration_monitor::qos = 0;
+
+FASTLIB_LOG_INIT(migration_monitor_log, "Migration_monitor")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(migration_monitor_log, trace);
+
+bool get_job_progress(virDomainPtr domain, Migration_progress &progress, bool completed)
+{
+	int type;
+	virTypedParameterPtr params = nullptr;
+	int nparams = 0;
+	if (virDomainGetJobStats(domain, &type, &params, &nparams, completed ? VIR_DOMAIN_JOB_STATS_COMPLETED : 0) == -1)
+		return false;
+	std::unique_ptr<virTypedParameter, std::function<void(virTypedParameterPtr)>> params_guard(params,
+			[nparams](virTypedParameterPtr ptr) {virTypedParamsFree(ptr, nparams);});
+	if (type == VIR_DOMAIN_JOB_NONE)
+		return false;
+	unsigned long long page_size = 4096;
+	unsigned long long dirty_pages = 0;
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_TIME_ELAPSED, &progress.time_elapsed);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_DATA_REMAINING, &progress.data_remaining);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_MEMORY_ITERATION, &progress.iteration);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_MEMORY_BPS, &progress.bandwidth);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_MEMORY_PAGE_SIZE, &page_size);
+	// The dirty rate is reported in pages per second.
+	if (virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_MEMORY_DIRTY_RATE, &dirty_pages) == 1)
+		progress.dirty_rate = dirty_pages * page_size;
+	return true;
+}
+
+YAML::Node Migration_progress::emit() const
+{
+	YAML::Node node;
+	node["time-elapsed"] = time_elapsed;
+	node["iteration"] = iteration;
+	node["data-remaining"] = data_remaining;
+	node["dirty-rate"] = dirty_rate;
+	node["bandwidth"] = bandwidth;
+	return node;
+}
+
+Migration_monitor::Migration_monitor(std::shared_ptr<virDomain> domain, std::string vm_name, std::string dest_hostname, std::shared_ptr<fast::Communicator> comm, Sample_handler sample_handler) :
+	domain(std::move(domain)),
+	vm_name(std::move(vm_name)),
+	dest_hostname(std::move(dest_hostname)),
+	comm(std::dynamic_pointer_cast<fast::MQTT_communicator>(comm)),
+	topic(std::regex_replace(std::regex_replace(topic_template, std::regex(R"((<hostname>))"), get_hostname()), std::regex(R"((<vm_name>))"), this->vm_name)),
+	sample_handler(std::move(sample_handler)),
+	samples(0),
+	min_data_remaining(std::numeric_limits<unsigned long long>::max()),
+	max_dirty_rate(0),
+	max_bandwidth(0),
+	stopped(false)
+{
+	if (interval.count() > 0 || this->sample_handler)
+		thread = std::thread(&Migration_monitor::run, this);
+}
+
+Migration_monitor::~Migration_monitor()
+{
+	{
+		std::lock_guard<std::mutex> lock(monitor_mutex);
+		stopped = true;
+	}
+	monitor_cv.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+YAML::Node Migration_monitor::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(monitor_mutex);
+		stopped = true;
+	}
+	monitor_cv.notify_all();
+	if (thread.joinable())
+		thread.join();
+	// The statistics of the completed job also cover migrations finishing before the first sample.
+	Migration_progress completed;
+	bool has_completed = get_job_progress(domain.get(), completed, true);
+	if (has_completed) {
+		last = completed;
+		max_bandwidth = std::max(max_bandwidth, completed.bandwidth);
+	}
+	YAML::Node summary;
+	summary["samples"] = samples;
+	if (samples != 0 || has_completed) {
+		summary["iterations"] = last.iteration;
+		summary["time-elapsed"] = last.time_elapsed;
+		summary["max-bandwidth"] = max_bandwidth;
+	}
+	if (samples != 0) {
+		summary["min-data-remaining"] = min_data_remaining;
+		summary["max-dirty-rate"] = max_dirty_rate;
+	}
+	return summary;
+}
+
+void Migration_monitor::set_interval(std::chrono::milliseconds interval)
+{
+	Migration_monitor::interval = interval;
+}
+
+void Migration_monitor::set_topic_template(std::string topic)
+{
+	Migration_monitor::topic_template = std::move(topic);
+}
+
+void Migration_monitor::set_qos(int qos)
+{
+	Migration_monitor::qos = qos;
+}
+
+void Migration_monitor::run()
+{
+	const auto sample_interval = (interval.count() > 0) ? interval : std::chrono::milliseconds(1000);
+	std::unique_lock<std::mutex> lock(monitor_mutex);
+	while (!monitor_cv.wait_for(lock, sample_interval, [this]{return stopped;})) {
+		lock.unlock();
+		Migration_progress progress;
+		bool sampled = get_job_progress(domain.get(), progress, false);
+		if (sampled) {
+			publish(progress);
+			if (sample_handler) {
+				try {
+					sample_handler(progress);
+				} catch (const std::exception &e) {
+					FASTLIB_LOG(migration_monitor_log, warn) << "Exception in sample handler: " << e.what();
+				}
+			}
+		}
+		lock.lock();
+		if (sampled)
+			add_sample(progress);
+	}
+}
+
+void Migration_monitor::add_sample(const Migration_progress &progress)
+{
+	++samples;
+	last = progress;
+	min_data_remaining = std::min(min_data_remaining, progress.data_remaining);
+	max_dirty_rate = std::max(max_dirty_rate, progress.dirty_rate);
+	max_bandwidth = std::max(max_bandwidth, progress.bandwidth);
+}
+
+void Migration_monitor::publish(const Migration_progress &progress)
+{
+	if (!comm)
+		return;
+	try {
+		auto node = progress.emit();
+		node["progress"] = "vm migrating";
+		node["vm-name"] = vm_name;
+		node["destination"] = dest_hostname;
+		comm->send_message(YAML::Dump(node), topic, qos);
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(migration_monitor_log, warn) << "Exception while publishing migration progress: " << e.what();
+	}
+}
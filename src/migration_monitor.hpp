@@ -0,0 +1,128 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef MIGRATION_MONITOR_HPP
+#define MIGRATION_MONITOR_HPP
+
+#include <fast-lib/mqtt_communicator.hpp>
+#include <libvirt/libvirt.h>
+#include <yaml-cpp/yaml.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+
+/**
+ * \brief Progress of a migration job as reported by virDomainGetJobStats.
+ */
+struct Migration_progress
+{
+	// Milliseconds since the job started.
+	unsigned long long time_elapsed = 0;
+	// Bytes which still have to be transferred.
+	unsigned long long data_remaining = 0;
+	// Bytes of memory dirtied per second.
+	unsigned long long dirty_rate = 0;
+	// Number of memory iterations (pre-copy passes).
+	unsigned long long iteration = 0;
+	// Bytes of memory transferred per second.
+	unsigned long long bandwidth = 0;
+
+	YAML::Node emit() const;
+};
+
+/**
+ * \brief Get the statistics of the current or completed migration job.
+ *
+ * \returns False if no job statistics are available.
+ */
+bool get_job_progress(virDomainPtr domain, Migration_progress &progress, bool completed);
+
+/**
+ * \brief Samples the progress of a running migration job in a background thread.
+ *
+ * This monitor follows the RAII pattern by starting to sample in the constructor and stopping in the destructor.
+ * Each sample is published as progress message if a MQTT_communicator is used.
+ * A compact summary of all samples is returned by stop().
+ */
+class Migration_monitor
+{
+public:
+	/**
+	 * \brief Callback called from the monitor thread with every sample.
+	 */
+	using Sample_handler = std::function<void(const Migration_progress &progress)>;
+
+	/**
+	 * \brief Start monitoring the migration job of a domain.
+	 *
+	 * \param domain The domain on the source host which is migrated.
+	 * \param vm_name The name of the domain.
+	 * \param dest_hostname The host the domain is migrated to.
+	 * \param comm The communicator used to publish progress messages.
+	 * \param sample_handler Called with every sample (e.g., to switch to post-copy).
+	 */
+	Migration_monitor(std::shared_ptr<virDomain> domain, std::string vm_name, std::string dest_hostname, std::shared_ptr<fast::Communicator> comm, Sample_handler sample_handler = nullptr);
+	~Migration_monitor();
+	/**
+	 * \brief Stop sampling and get a summary of the migration progress.
+	 *
+	 * Should be called after the migration finished, so the statistics of the completed job are included.
+	 */
+	YAML::Node stop();
+	/**
+	 * \brief This static function may be used to alter the interval between two samples.
+	 *
+	 * The default interval is 1000 ms. An interval of 0 disables sampling during the migration
+	 * unless a sample handler is passed, which is then called every 1000 ms.
+	 */
+	static void set_interval(std::chrono::milliseconds interval);
+	/**
+	 * \brief This static function may be used to alter the topic for progress messages.
+	 *
+	 * The default topic is: "fast/migfra/<hostname>/progress".
+	 */
+	static void set_topic_template(std::string topic);
+	/**
+	 * \brief This static function may be used to alter the QoS.
+	 *
+	 * The default QoS is 0.
+	 */
+	static void set_qos(int qos);
+private:
+	void run();
+	void add_sample(const Migration_progress &progress);
+	void publish(const Migration_progress &progress);
+
+	std::shared_ptr<virDomain> domain;
+	const std::string vm_name;
+	const std::string dest_hostname;
+	std::shared_ptr<fast::MQTT_communicator> comm;
+	std::string topic;
+	Sample_handler sample_handler;
+	// Aggregated samples
+	unsigned int samples;
+	Migration_progress last;
+	unsigned long long min_data_remaining;
+	unsigned long long max_dirty_rate;
+	unsigned long long max_bandwidth;
+	bool stopped;
+	std::mutex monitor_mutex;
+	std::condition_variable monitor_cv;
+	std::thread thread;
+
+	static std::chrono::milliseconds interval;
+	static std::string topic_template;
+	static int qos;
+};
+
+#endif
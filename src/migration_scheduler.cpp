@@ -0,0 +1,149 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "migration_scheduler.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <future>
+#include <utility>
+
+FASTLIB_LOG_INIT(migration_scheduler_log, "Migration_scheduler")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(migration_scheduler_log, trace);
+
+//
+// Migration_scheduler implementation
+//
+
+Migration_scheduler::Migration_scheduler(Migration_limits limits) :
+	limits(limits),
+	outgoing(0),
+	bytes_in_flight(0)
+{
+}
+
+void Migration_scheduler::request(std::string destination, unsigned long long bytes, std::function<void(std::unique_ptr<Migration_slot>)> admitted)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto slot_destination = destination;
+	enqueue(std::move(destination), bytes, [this, slot_destination, bytes, start, admitted]
+	{
+		auto queue_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+		admitted(std::unique_ptr<Migration_slot>(new Migration_slot(*this, slot_destination, bytes, queue_time)));
+	});
+}
+
+void Migration_scheduler::enqueue(std::string destination, unsigned long long bytes, std::function<void()> admitted)
+{
+	std::vector<std::function<void()>> admitted_waiters;
+	{
+		std::lock_guard<std::mutex> lock(scheduler_mutex);
+		queue.push_back(Waiter{std::move(destination), bytes, std::move(admitted)});
+		admit_waiters(admitted_waiters);
+		if (admitted_waiters.empty())
+			FASTLIB_LOG(migration_scheduler_log, debug) << "Queue migration to " << queue.back().destination << " (" << outgoing << " outgoing, " << bytes_in_flight << " bytes in flight).";
+	}
+	// Called without the lock, since they may request further migrations.
+	for (auto &waiter_admitted : admitted_waiters)
+		waiter_admitted();
+}
+
+void Migration_scheduler::release(const std::string &destination, unsigned long long bytes)
+{
+	std::vector<std::function<void()>> admitted_waiters;
+	{
+		std::lock_guard<std::mutex> lock(scheduler_mutex);
+		--outgoing;
+		if (--incoming[destination] == 0)
+			incoming.erase(destination);
+		bytes_in_flight -= bytes;
+		admit_waiters(admitted_waiters);
+	}
+	for (auto &waiter_admitted : admitted_waiters)
+		waiter_admitted();
+}
+
+void Migration_scheduler::admit_waiters(std::vector<std::function<void()>> &admitted)
+{
+	// Earlier migrations go first unless they wait for their destination.
+	// Admitting a migration only fills its destination further, so the skipped migrations still wait for theirs.
+	auto waiter = queue.begin();
+	while (waiter != queue.end()) {
+		if (!fits(*waiter)) {
+			if (!is_destination_full(waiter->destination))
+				return;
+			++waiter;
+			continue;
+		}
+		++outgoing;
+		++incoming[waiter->destination];
+		bytes_in_flight += waiter->bytes;
+		admitted.push_back(std::move(waiter->admitted));
+		waiter = queue.erase(waiter);
+	}
+}
+
+bool Migration_scheduler::is_destination_full(const std::string &destination) const
+{
+	if (limits.max_incoming == 0)
+		return false;
+	auto incoming_it = incoming.find(destination);
+	return incoming_it != incoming.end() && incoming_it->second >= limits.max_incoming;
+}
+
+bool Migration_scheduler::fits(const Waiter &waiter) const
+{
+	if (limits.max_outgoing != 0 && outgoing >= limits.max_outgoing)
+		return false;
+	if (is_destination_full(waiter.destination))
+		return false;
+	if (limits.max_bytes_in_flight != 0 && bytes_in_flight != 0 && bytes_in_flight + waiter.bytes > limits.max_bytes_in_flight)
+		return false;
+	return true;
+}
+
+//
+// Migration_slot implementation
+//
+
+Migration_slot::Migration_slot(Migration_scheduler &scheduler, std::string destination, unsigned long long bytes) :
+	scheduler(scheduler),
+	destination(std::move(destination)),
+	bytes(bytes)
+{
+	auto start = std::chrono::steady_clock::now();
+	// Shared with the admitting thread which may still use it after this thread woke up.
+	auto admitted = std::make_shared<std::promise<void>>();
+	auto admission = admitted->get_future();
+	scheduler.enqueue(this->destination, bytes, [admitted] {admitted->set_value();});
+	admission.wait();
+	queue_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+}
+
+Migration_slot::Migration_slot(Migration_scheduler &scheduler, std::string destination, unsigned long long bytes, std::chrono::milliseconds queue_time) :
+	scheduler(scheduler),
+	destination(std::move(destination)),
+	bytes(bytes),
+	queue_time(queue_time)
+{
+}
+
+Migration_slot::~Migration_slot()
+{
+	scheduler.release(destination, bytes);
+}
+
+const std::string & Migration_slot::get_destination() const
+{
+	return destination;
+}
+
+std::chrono::milliseconds Migration_slot::get_queue_time() const
+{
+	return queue_time;
+}
@@ -0,0 +1,119 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef MIGRATION_SCHEDULER_HPP
+#define MIGRATION_SCHEDULER_HPP
+
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+/**
+ * \brief Limits of concurrent migrations leaving this host. A limit of 0 disables it.
+ */
+struct Migration_limits
+{
+	// Maximum number of concurrent outgoing migrations.
+	unsigned int max_outgoing = 0;
+	// Maximum number of concurrent incoming migrations per destination.
+	unsigned int max_incoming = 0;
+	// Maximum sum of the memory sizes of all concurrent migrations in bytes.
+	unsigned long long max_bytes_in_flight = 0;
+};
+
+class Migration_slot;
+
+/**
+ * \brief Queues migrations until they fit the Migration_limits.
+ *
+ * Migrations are admitted in order of arrival, except that a migration waiting for its destination
+ * does not hold back migrations to other destinations.
+ * A single migration larger than max_bytes_in_flight is admitted as soon as no other migration is in flight.
+ * Queued migrations are admitted by the thread releasing the slot which makes room for them,
+ * so a migration requested with request() does not occupy a thread while it is queued.
+ */
+class Migration_scheduler
+{
+public:
+	explicit Migration_scheduler(Migration_limits limits = Migration_limits());
+
+	/**
+	 * \brief Queue a migration without waiting for its admission.
+	 *
+	 * admitted is called with the slot of the migration as soon as it is admitted,
+	 * either from the calling thread or from the thread releasing the slot which made room for it.
+	 * \param bytes The memory size of the migrated domain.
+	 */
+	void request(std::string destination, unsigned long long bytes, std::function<void(std::unique_ptr<Migration_slot>)> admitted);
+private:
+	friend class Migration_slot;
+
+	struct Waiter
+	{
+		std::string destination;
+		unsigned long long bytes;
+		std::function<void()> admitted;
+	};
+
+	void enqueue(std::string destination, unsigned long long bytes, std::function<void()> admitted);
+	void release(const std::string &destination, unsigned long long bytes);
+	void admit_waiters(std::vector<std::function<void()>> &admitted);
+	bool is_destination_full(const std::string &destination) const;
+	bool fits(const Waiter &waiter) const;
+
+	const Migration_limits limits;
+	unsigned int outgoing;
+	// (destination : number of incoming migrations)
+	std::unordered_map<std::string, unsigned int> incoming;
+	unsigned long long bytes_in_flight;
+	std::list<Waiter> queue;
+	std::mutex scheduler_mutex;
+};
+
+/**
+ * \brief RAII-guard to wait for a migration to be admitted in constructor and to leave the scheduler in destructor.
+ */
+class Migration_slot
+{
+public:
+	/**
+	 * \brief Wait until the migration is admitted.
+	 *
+	 * \param bytes The memory size of the migrated domain.
+	 */
+	Migration_slot(Migration_scheduler &scheduler, std::string destination, unsigned long long bytes);
+	~Migration_slot();
+	Migration_slot(const Migration_slot &) = delete;
+	Migration_slot & operator=(const Migration_slot &) = delete;
+
+	/**
+	 * \brief Get the destination the migration was admitted for.
+	 */
+	const std::string & get_destination() const;
+	/**
+	 * \brief Get the time waited for admission.
+	 */
+	std::chrono::milliseconds get_queue_time() const;
+private:
+	friend class Migration_scheduler;
+
+	// Takes over a migration admitted by Migration_scheduler::request().
+	Migration_slot(Migration_scheduler &scheduler, std::string destination, unsigned long long bytes, std::chrono::milliseconds queue_time);
+
+	Migration_scheduler &scheduler;
+	const std::string destination;
+	const unsigned long long bytes;
+	std::chrono::milliseconds queue_time;
+};
+
+#endif
@@ -10,15 +10,19 @@
 
 #include "utility.hpp"
 #include "device_utility.hpp"
+#include "connection_pool.hpp"
+#include "domain_description.hpp"
+#include "xml_scanner.hpp"
 
+#include <libvirt/virterror.h>
 #include <fast-lib/log.hpp>
-#include <boost/property_tree/xml_parser.hpp>
 
 #include <iostream>
 #include <stdexcept>
 #include <sstream>
 #include <algorithm>
-#include <random>
+#include <unordered_set>
+#include <cstring>
 
 FASTLIB_LOG_INIT(pcidev_handler_log, "PCI_device_handler")
 FASTLIB_LOG_SET_LEVEL_GLOBAL(pcidev_handler_log, trace);
@@ -27,12 +31,43 @@ FASTLIB_LOG_SET_LEVEL_GLOBAL(pcidev_handler_log, trace);
 // PCI_id implementation
 //
 
-PCI_id make_pci_id_from_nodedev_xml(const std::string &nodedev_xml)
+/**
+ * \brief Parse PCI-id and address of the pci capability of a node device xml.
+ */
+PCI_address parse_nodedev_xml(boost::string_ref nodedev_xml, PCI_id &pci_id)
 {
-	auto nodedev_ptree = read_xml_from_string(nodedev_xml);
-	auto vendor = std::stoul(nodedev_ptree.get<std::string>("device.capability.vendor.<xmlattr>.id"), nullptr, 0);
-	auto device = std::stoul(nodedev_ptree.get<std::string>("device.capability.product.<xmlattr>.id"), nullptr, 0);
-	return PCI_id(vendor, device);
+	static const char *address_names[] = {"domain", "bus", "slot", "function"};
+	unsigned long long address_fields[4];
+	bool address_found[4] = {false, false, false, false};
+	bool vendor_found = false;
+	bool product_found = false;
+	Xml_scanner scanner(nodedev_xml);
+	if (scanner.next() != Xml_scanner::Token::start_element || scanner.get_name() != "device")
+		throw std::runtime_error("Node device xml does not describe a device.");
+	while (scanner.next_child(1)) {
+		if (scanner.get_name() != "capability" || scanner.get_attribute("type") != "pci")
+			continue;
+		while (scanner.next_child(2)) {
+			auto name = scanner.get_name();
+			if (name == "vendor") {
+				pci_id.vendor = to_unsigned(scanner.get_attribute("id"), 0);
+				vendor_found = true;
+			} else if (name == "product") {
+				pci_id.device = to_unsigned(scanner.get_attribute("id"), 0);
+				product_found = true;
+			} else {
+				for (size_t i = 0; i != 4; ++i) {
+					if (name == address_names[i]) {
+						address_fields[i] = to_unsigned(scanner.read_text());
+						address_found[i] = true;
+					}
+				}
+			}
+		}
+	}
+	if (!vendor_found || !product_found || !address_found[0] || !address_found[1] || !address_found[2] || !address_found[3])
+		throw std::runtime_error("Node device is not a PCI device.");
+	return PCI_address(address_fields[0], address_fields[1], address_fields[2], address_fields[3]);
 }
 
 PCI_id::PCI_id(vendor_t vendor, device_t device) :
@@ -78,24 +113,29 @@ void PCI_id::load(const YAML::Node &node)
 // PCI_address implementation
 //
 
-PCI_address make_pci_address_from_device_ptree(const boost::property_tree::ptree &device_ptree)
+PCI_address make_pci_address_from_address_element(const Xml_scanner &scanner)
 {
-	auto domain = device_ptree.get<PCI_address::domain_t>("device.capability.domain");
-	auto bus = device_ptree.get<PCI_address::bus_t>("device.capability.bus");
-	auto slot = device_ptree.get<PCI_address::slot_t>("device.capability.slot");
-	auto function = device_ptree.get<PCI_address::function_t>("device.capability.function");
+	auto domain = to_unsigned(scanner.get_attribute("domain"), 0);
+	auto bus = to_unsigned(scanner.get_attribute("bus"), 0);
+	auto slot = to_unsigned(scanner.get_attribute("slot"), 0);
+	auto function = to_unsigned(scanner.get_attribute("function"), 0);
 	return PCI_address(domain, bus, slot, function);
 }
 
-PCI_address make_pci_address_from_address_ptree(const boost::property_tree::ptree &address_ptree)
+// Parse the name of a PCI node device in the format of PCI_address::to_name_fmt, e.g. "pci_0000_03_00_1".
+PCI_address make_pci_address_from_name(const std::string &name)
 {
-	auto xmlattr = address_ptree.get_child("address.<xmlattr>"); 
-	// std::stoul has to be used since boost.property_tree cannot convert hex strings to integer types.
-	auto domain = std::stoul(xmlattr.get<std::string>("domain"), nullptr, 0);
-	auto bus = std::stoul(xmlattr.get<std::string>("bus"), nullptr, 0);
-	auto slot = std::stoul(xmlattr.get<std::string>("slot"), nullptr, 0);
-	auto function = std::stoul(xmlattr.get<std::string>("function"), nullptr, 0);
-	return PCI_address(domain, bus, slot, function);
+	std::vector<unsigned long> fields;
+	std::istringstream iss(name);
+	std::string field;
+	std::getline(iss, field, '_');
+	if (field != "pci")
+		throw std::runtime_error("\"" + name + "\" is not the name of a PCI device.");
+	while (std::getline(iss, field, '_'))
+		fields.push_back(std::stoul(field, nullptr, 16));
+	if (fields.size() != 4)
+		throw std::runtime_error("\"" + name + "\" is not the name of a PCI device.");
+	return PCI_address(fields[0], fields[1], fields[2], fields[3]);
 }
 
 PCI_address::PCI_address(domain_t domain, bus_t bus, slot_t slot, function_t function) :
@@ -103,14 +143,14 @@ PCI_address::PCI_address(domain_t domain, bus_t bus, slot_t slot, function_t fun
 {
 }
 
-boost::property_tree::ptree PCI_address::to_address_ptree() const
+void PCI_address::write_address_element(Xml_writer &writer) const
 {
-	boost::property_tree::ptree pt;
-	pt.put("address.<xmlattr>.domain", to_hex_string(domain, 4));
-	pt.put("address.<xmlattr>.bus", to_hex_string(bus, 2));
-	pt.put("address.<xmlattr>.slot", to_hex_string(slot, 2));
-	pt.put("address.<xmlattr>.function", to_hex_string(function, 1));
-	return pt;
+	writer.start_element("address")
+		.attribute("domain", to_hex_string(domain, 4))
+		.attribute("bus", to_hex_string(bus, 2))
+		.attribute("slot", to_hex_string(slot, 2))
+		.attribute("function", to_hex_string(function, 1))
+		.end_element();
 }
 
 std::string PCI_address::str() const
@@ -134,110 +174,403 @@ bool PCI_address::operator==(const PCI_address &rhs) const
 	return domain == rhs.domain && bus == rhs.bus && slot == rhs.slot && function == rhs.function;
 }
 
+size_t std::hash<PCI_address>::operator()(const PCI_address &address) const
+{
+	return (static_cast<size_t>(address.domain) << 24) | (static_cast<size_t>(address.bus) << 16)
+		| (static_cast<size_t>(address.slot) << 8) | address.function;
+}
+
 //
 // Device implementation
 //
 
-Device::Device(const std::string &xml_desc) :
-	xml_desc(xml_desc),
-	address(make_pci_address_from_device_ptree(read_xml_from_string(xml_desc))),
-	attached_hint(false)
+std::string render_hostdev_xml(const PCI_address &address)
 {
+	// Write hostdev xml
+	Xml_writer writer;
+	writer.start_element("hostdev")
+		.attribute("mode", "subsystem")
+		.attribute("type", "pci")
+		.attribute("managed", "yes")
+		.start_element("source");
+	address.write_address_element(writer);
+	writer.end_element().end_element();
+	return writer.str();
 }
 
-Device::Device(std::string &&xml_desc) :
-	xml_desc(std::move(xml_desc)),
-	address(make_pci_address_from_device_ptree(read_xml_from_string(this->xml_desc))),
-	attached_hint(false)
+Device::Device(PCI_id pci_id, PCI_address address) :
+	pci_id(std::move(pci_id)),
+	address(std::move(address)),
+	hostdev_xml(render_hostdev_xml(this->address))
 {
 }
 
-std::string Device::to_hostdev_xml() const
+bool Device::try_claim(const std::string &owner)
 {
-	using namespace boost::property_tree;
-	// Write hostdev xml
-	ptree hostdev_ptree;
-	hostdev_ptree.put("hostdev.<xmlattr>.mode", "subsystem");
-	hostdev_ptree.put("hostdev.<xmlattr>.type", "pci");
-	hostdev_ptree.put("hostdev.<xmlattr>.managed", "yes");
-	hostdev_ptree.put_child("hostdev.source", address.to_address_ptree());
-	return write_xml_to_string(hostdev_ptree);
+	std::shared_ptr<const std::string> unclaimed;
+	return std::atomic_compare_exchange_strong(&this->owner, &unclaimed, std::make_shared<const std::string>(owner));
+}
+
+void Device::release(const std::string &owner)
+{
+	auto current_owner = std::atomic_load(&this->owner);
+	// Another domain may have claimed the device meanwhile.
+	while (current_owner && *current_owner == owner) {
+		if (std::atomic_compare_exchange_weak(&this->owner, &current_owner, std::shared_ptr<const std::string>()))
+			break;
+	}
+}
+
+std::string Device::get_owner() const
+{
+	auto current_owner = std::atomic_load(&owner);
+	return current_owner ? *current_owner : "";
+}
+
+void Device::set_owner(const std::string &owner)
+{
+	std::atomic_store(&this->owner, owner.empty() ? nullptr : std::make_shared<const std::string>(owner));
+}
+
+std::shared_ptr<Device> make_device_from_nodedev_xml(const std::string &nodedev_xml)
+{
+	PCI_id pci_id;
+	auto address = parse_nodedev_xml(nodedev_xml, pci_id);
+	return std::make_shared<Device>(pci_id, address);
 }
 
 //
 // Device_cache implementation
 //
 
-std::vector<std::shared_ptr<Device>> Device_cache::get_devices(virConnectPtr host_connection, PCI_id pci_id, bool sort_and_shuffle) const
+struct Device_cache::Node_device_events
 {
-	auto host_uri = convert_and_free_cstr(virConnectGetURI(host_connection));
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Get devices on host " << host_uri << " with pci_id " << pci_id.str();
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Lock while accessing device cache.";
-	std::unique_lock<std::mutex> lock(devices_mutex);
-	// If no entry found try to find and cache devices.
-	if (devices[host_uri][pci_id].empty()) {
-		FASTLIB_LOG(pcidev_handler_log, trace) << "No entry found.";
-		// Find devices
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Search for devices.";
-		auto found_devices = list_all_node_devices_wrapper(host_connection, VIR_CONNECT_LIST_NODE_DEVICES_CAP_PCI_DEV);
-		// Fill cache with found devices
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Filtering " << found_devices.size() << " found PCI devices.";
-		for (const auto &device : found_devices) {
-			auto xml_desc = convert_and_free_cstr(virNodeDeviceGetXMLDesc(device.get(), 0));
-			auto found_device_id = xml_desc.find("<product id='" + pci_id.device_hex() + "'>");
-			auto found_vendor_id = xml_desc.find("<vendor id='" + pci_id.vendor_hex() + "'>");
-			if (found_device_id != std::string::npos && found_vendor_id != std::string::npos) {
-				auto dev = std::make_shared<Device>(std::move(xml_desc));
-				FASTLIB_LOG(pcidev_handler_log, trace) << "Adding device: " << dev->address.str();
-				devices[host_uri][pci_id].push_back(dev);
+	Node_device_events(std::shared_ptr<virConnect> conn, int callback_id) :
+		conn(std::move(conn)),
+		callback_id(callback_id)
+	{
+	}
+	~Node_device_events()
+	{
+		virConnectNodeDeviceEventDeregisterAny(conn.get(), callback_id);
+	}
+	Node_device_events(const Node_device_events &) = delete;
+	Node_device_events & operator=(const Node_device_events &) = delete;
+
+	bool is_alive() const
+	{
+		return virConnectIsAlive(conn.get()) == 1;
+	}
+
+	const std::shared_ptr<virConnect> conn;
+	const int callback_id;
+};
+
+Device_cache::Device_cache(std::shared_ptr<Connection_pool> connection_pool) :
+	connection_pool(std::move(connection_pool)),
+	shards(std::make_shared<const Shard_map>())
+{
+}
+
+void Device_cache::prewarm(const std::vector<std::string> &host_uris)
+{
+	if (!connection_pool)
+		throw std::runtime_error("Prewarming the device cache requires a connection pool.");
+	// Enumerate all hosts in parallel so a slow or unreachable host does not delay the others.
+	for (const auto &host_uri : host_uris) {
+		prewarming.push_back(std::async(std::launch::async, [this, host_uri]
+		{
+			try {
+				auto conn = connection_pool->get(host_uri);
+				get_host_devices(conn.get());
+			} catch (const std::exception &e) {
+				FASTLIB_LOG(pcidev_handler_log, warn) << "Error prewarming device cache of " << host_uri << ": " << e.what();
 			}
+		}));
+	}
+}
+
+void Device_cache::node_device_callback(virConnectPtr conn, virNodeDevicePtr dev, int event, int detail, void *opaque)
+{
+	(void) conn; (void) detail;
+	auto context = static_cast<Event_context *>(opaque);
+	auto shard = context->shard.lock();
+	if (!shard)
+		return;
+	try {
+		if (event != VIR_NODE_DEVICE_EVENT_CREATED && event != VIR_NODE_DEVICE_EVENT_DELETED)
+			return;
+		std::string name = virNodeDeviceGetName(dev);
+		if (name.compare(0, 4, "pci_") != 0)
+			return;
+		Device_event device_event{event, name, nullptr};
+		// The description of a deleted device is gone, it is removed by its name.
+		if (event == VIR_NODE_DEVICE_EVENT_CREATED)
+			device_event.device = make_device_from_nodedev_xml(convert_and_free_cstr(virNodeDeviceGetXMLDesc(dev, 0)));
+		FASTLIB_LOG(pcidev_handler_log, debug) << "Device " << name << (event == VIR_NODE_DEVICE_EVENT_CREATED ? " created" : " deleted") << " on " << context->host_uri << ".";
+		update(*shard, std::move(device_event));
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(pcidev_handler_log, warn) << "Exception while handling node device event of " << context->host_uri << ": " << e.what();
+	}
+}
+
+void Device_cache::free_event_context(void *opaque)
+{
+	delete static_cast<Event_context *>(opaque);
+}
+
+void Device_cache::apply_event(Host_devices &host_devices, const Device_event &device_event)
+{
+	auto address = device_event.device ? device_event.device->address : make_pci_address_from_name(device_event.name);
+	// Remove the known device, a created device replaces it.
+	auto address_device_it = host_devices.by_address.find(address);
+	if (address_device_it != host_devices.by_address.end()) {
+		auto &id_devices = host_devices.by_id[address_device_it->second->pci_id];
+		id_devices.erase(std::remove(id_devices.begin(), id_devices.end(), address_device_it->second), id_devices.end());
+		if (id_devices.empty())
+			host_devices.by_id.erase(address_device_it->second->pci_id);
+		host_devices.by_address.erase(address_device_it);
+	}
+	if (device_event.device) {
+		host_devices.by_id[device_event.device->pci_id].push_back(device_event.device);
+		host_devices.by_address.emplace(address, device_event.device);
+	}
+}
+
+void Device_cache::update(Shard &shard, Device_event device_event)
+{
+	std::lock_guard<std::mutex> lock(shard.update_mutex);
+	auto host_devices = std::atomic_load(&shard.devices);
+	if (!host_devices) {
+		shard.pending_events.push_back(std::move(device_event));
+		return;
+	}
+	// Copy-on-write so lookups never see a partial update.
+	auto new_host_devices = std::make_shared<Host_devices>(*host_devices);
+	apply_event(*new_host_devices, device_event);
+	std::atomic_store(&shard.devices, std::shared_ptr<const Host_devices>(std::move(new_host_devices)));
+}
+
+std::shared_ptr<const Device_cache::Node_device_events> Device_cache::register_events(const std::shared_ptr<Shard> &shard, const std::string &host_uri) const
+{
+	if (!connection_pool)
+		return nullptr;
+	auto conn = connection_pool->get(host_uri);
+	auto context = new Event_context{shard, host_uri};
+	auto callback_id = virConnectNodeDeviceEventRegisterAny(conn.get(), nullptr, VIR_NODE_DEVICE_EVENT_ID_LIFECYCLE,
+			to_generic_callback<virConnectNodeDeviceEventGenericCallback>(node_device_callback), context, free_event_context);
+	if (callback_id == -1) {
+		delete context;
+		FASTLIB_LOG(pcidev_handler_log, warn) << "Error registering node device events for " << host_uri << ": " << virGetLastErrorMessage();
+		return nullptr;
+	}
+	return std::make_shared<const Node_device_events>(std::move(conn), callback_id);
+}
+
+std::shared_ptr<Device_cache::Shard> Device_cache::get_shard(const std::string &host_uri) const
+{
+	auto current_shards = std::atomic_load(&shards);
+	auto shard_it = current_shards->find(host_uri);
+	if (shard_it != current_shards->end())
+		return shard_it->second;
+	// Add shard of new host by copy-on-write.
+	std::lock_guard<std::mutex> lock(shards_mutex);
+	current_shards = std::atomic_load(&shards);
+	shard_it = current_shards->find(host_uri);
+	if (shard_it != current_shards->end())
+		return shard_it->second;
+	auto new_shards = std::make_shared<Shard_map>(*current_shards);
+	auto shard = std::make_shared<Shard>();
+	(*new_shards)[host_uri] = shard;
+	std::atomic_store(&shards, std::shared_ptr<const Shard_map>(std::move(new_shards)));
+	return shard;
+}
+
+std::shared_ptr<const Device_cache::Host_devices> Device_cache::get_host_devices(virConnectPtr host_connection) const
+{
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(host_connection));
+	auto shard = get_shard(host_uri);
+	// Devices are outdated if events got lost with the connection.
+	auto is_current = [](const std::shared_ptr<const Host_devices> &host_devices)
+	{
+		return host_devices && (!host_devices->events || host_devices->events->is_alive());
+	};
+	auto host_devices = std::atomic_load(&shard->devices);
+	if (is_current(host_devices))
+		return host_devices;
+	// Only one caller enumerates the devices of a host, others wait for the result.
+	std::lock_guard<std::mutex> lock(shard->population_mutex);
+	host_devices = std::atomic_load(&shard->devices);
+	if (is_current(host_devices))
+		return host_devices;
+	{
+		// Queue events until the enumeration is done.
+		std::lock_guard<std::mutex> update_lock(shard->update_mutex);
+		std::atomic_store(&shard->devices, std::shared_ptr<const Host_devices>());
+		shard->pending_events.clear();
+	}
+	// Register events before enumerating so no created or deleted device is missed.
+	auto new_host_devices = std::make_shared<Host_devices>();
+	new_host_devices->events = register_events(shard, host_uri);
+	// Find devices and parse each description once.
+	FASTLIB_LOG(pcidev_handler_log, trace) << "No entry found for " << host_uri << ". Search for devices.";
+	auto found_devices = list_all_node_devices_wrapper(host_connection, VIR_CONNECT_LIST_NODE_DEVICES_CAP_PCI_DEV);
+	for (const auto &found_device : found_devices) {
+		std::shared_ptr<Device> device;
+		try {
+			device = make_device_from_nodedev_xml(convert_and_free_cstr(virNodeDeviceGetXMLDesc(found_device.get(), 0)));
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(pcidev_handler_log, debug) << "Skip device " << virNodeDeviceGetName(found_device.get()) << ": " << e.what();
+			continue;
 		}
+		new_host_devices->by_id[device->pci_id].push_back(device);
+		new_host_devices->by_address.emplace(device->address, device);
 	}
+	try {
+		reconcile_claims(*new_host_devices, host_connection);
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(pcidev_handler_log, warn) << "Error reconciling claims of " << host_uri << ": " << e.what();
+	}
+	std::lock_guard<std::mutex> update_lock(shard->update_mutex);
+	for (const auto &device_event : shard->pending_events)
+		apply_event(*new_host_devices, device_event);
+	shard->pending_events.clear();
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Cached " << new_host_devices->by_address.size() << " PCI devices of " << host_uri << ".";
+	host_devices = std::move(new_host_devices);
+	std::atomic_store(&shard->devices, host_devices);
+	return host_devices;
+}
+
+std::vector<std::shared_ptr<Device>> Device_cache::get_devices(virConnectPtr host_connection, PCI_id pci_id) const
+{
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Get devices with pci_id " << pci_id.str();
+	auto host_devices = get_host_devices(host_connection);
 	// Copy devices from cache.
-	auto vec = devices[host_uri][pci_id];
+	std::vector<std::shared_ptr<Device>> vec;
+	auto id_devices_it = host_devices->by_id.find(pci_id);
+	if (id_devices_it != host_devices->by_id.end())
+		vec = id_devices_it->second;
 	FASTLIB_LOG(pcidev_handler_log, trace) << "Found " << vec.size() << " devices on cache.";
-	// Unlock since no access to devices cache is needed anymore.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Unlock since no access to device cache is needed anymore.";
-	lock.unlock();
-	if (sort_and_shuffle) {
-		// Sort potentially attached devices to end of vector.
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Sort potentially attached devices to end of vector.";
-		std::sort(vec.begin(), vec.end(), 
-				[](const std::shared_ptr<Device> &lhs, const std::shared_ptr<Device> &rhs)
-				{
-					return lhs->attached_hint < rhs->attached_hint;
-				});
-		// Shuffle not attached devices to prevent parallel attachment when starting multiple VMs.
-		auto sorted_part_end = std::find_if(vec.begin(), vec.end(),
-				[](const std::shared_ptr<Device> &rhs)
-				{
-					return rhs->attached_hint == true;
-				});
-		FASTLIB_LOG(pcidev_handler_log, trace) << std::count_if(vec.begin(), sorted_part_end, 
-						[](const std::shared_ptr<Device>&){return true;})
-					 << " devices are marked as being not attached.";
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Shuffle not attached devices.";
-		std::random_device random_seed;
-		std::minstd_rand random_generator(random_seed());
-		std::shuffle(vec.begin(), sorted_part_end, random_generator);
-	}
+	// Move claimed devices to end of vector.
+	auto unclaimed_end = std::stable_partition(vec.begin(), vec.end(),
+			[](const std::shared_ptr<Device> &device)
+			{
+				return device->get_owner().empty();
+			});
+	FASTLIB_LOG(pcidev_handler_log, trace) << std::distance(vec.begin(), unclaimed_end) << " devices are not claimed.";
 	return vec;
 }
 
+std::shared_ptr<Device> Device_cache::find_device(virConnectPtr host_connection, const PCI_address &address) const
+{
+	auto host_devices = get_host_devices(host_connection);
+	auto address_device_it = host_devices->by_address.find(address);
+	return address_device_it == host_devices->by_address.end() ? nullptr : address_device_it->second;
+}
+
+void Device_cache::reconcile(virConnectPtr host_connection) const
+{
+	reconcile_claims(*get_host_devices(host_connection), host_connection);
+}
+
+void Device_cache::reconcile_claims(const Host_devices &host_devices, virConnectPtr host_connection)
+{
+	// (pci_address : owner)
+	std::unordered_map<PCI_address, std::string> owners;
+	std::unordered_set<std::string> active_domains;
+	for (const auto &domain : get_active_domains(host_connection)) {
+		auto uuid = get_domain_uuid(domain.get());
+		Domain_description description(domain.get());
+		for (const auto &address : description.get_hostdev_addresses())
+			owners.emplace(address, uuid);
+		active_domains.insert(std::move(uuid));
+	}
+	size_t claimed = 0;
+	for (const auto &address_device : host_devices.by_address) {
+		const auto &device = address_device.second;
+		auto owner_it = owners.find(address_device.first);
+		if (owner_it != owners.end()) {
+			device->set_owner(owner_it->second);
+			++claimed;
+			continue;
+		}
+		auto owner = device->get_owner();
+		if (owner.empty())
+			continue;
+		// A claim of an active domain is either a pending attach or marks a device in use outside of this connection.
+		if (active_domains.count(owner) == 0)
+			device->release(owner);
+		else
+			++claimed;
+	}
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Reconciled claims: " << claimed << " of " << host_devices.by_address.size() << " devices are claimed.";
+}
+
+std::unordered_map<PCI_id, size_t> Device_cache::count_free_devices(virConnectPtr host_connection) const
+{
+	std::unordered_map<PCI_id, size_t> free_counts;
+	auto host_devices = get_host_devices(host_connection);
+	if (host_devices->by_id.empty())
+		return free_counts;
+	// Devices attached to active domains are not free, even if their claim is outdated.
+	std::unordered_set<PCI_address> attached_addresses;
+	for (const auto &domain : get_active_domains(host_connection)) {
+		Domain_description description(domain.get());
+		for (const auto &address : description.get_hostdev_addresses())
+			attached_addresses.insert(address);
+	}
+	for (const auto &id_devices : host_devices->by_id) {
+		auto &free_count = free_counts[id_devices.first];
+		for (const auto &device : id_devices.second) {
+			if (device->get_owner().empty() && attached_addresses.count(device->address) == 0)
+				++free_count;
+		}
+	}
+	return free_counts;
+}
+
+std::vector<std::shared_ptr<Device>> Device_cache::find_devices(virConnectPtr host_connection, const std::vector<PCI_address> &addresses) const
+{
+	auto host_devices = get_host_devices(host_connection);
+	std::vector<std::shared_ptr<Device>> devices;
+	devices.reserve(addresses.size());
+	for (const auto &address : addresses) {
+		auto address_device_it = host_devices->by_address.find(address);
+		devices.push_back(address_device_it == host_devices->by_address.end() ? nullptr : address_device_it->second);
+	}
+	return devices;
+}
+
 //
 // PCI_device_handler implementation
 //
 
-PCI_device_handler::PCI_device_handler() :
-	device_cache(new Device_cache)
+PCI_device_handler::PCI_device_handler(std::shared_ptr<Connection_pool> connection_pool) :
+	device_cache(new Device_cache(std::move(connection_pool)))
 {
 }
 
+void PCI_device_handler::prewarm(const std::vector<std::string> &host_uris)
+{
+	device_cache->prewarm(host_uris);
+}
+
+/**
+ * \brief Check whether attaching a device failed since it is in use by another domain.
+ *
+ * libvirt has no error code of its own for this, so the message is checked.
+ */
+bool is_in_use_error(virErrorPtr error)
+{
+	return error && error->code == VIR_ERR_OPERATION_INVALID && error->message && std::strstr(error->message, "in use");
+}
+
 void PCI_device_handler::attach(virDomainPtr domain, PCI_id pci_id)
 {
 	// Get connection the domain belongs to.
 	FASTLIB_LOG(pcidev_handler_log, trace) << "Get connection the domain belongs to.";
 	auto connection = virDomainGetConnect(domain);
+	auto owner = get_domain_uuid(domain);
 	// Get vector of devices.
 	FASTLIB_LOG(pcidev_handler_log, trace) << "Get vector of devices.";
 	auto devices = device_cache->get_devices(connection, pci_id);
@@ -245,85 +578,101 @@ void PCI_device_handler::attach(virDomainPtr domain, PCI_id pci_id)
 		throw std::runtime_error("No devices of type \"" + pci_id.str() 
 			+ "\" found on \"" + convert_and_free_cstr(virConnectGetURI(connection)) + "\".");
 	}
-	// Try to attach a device until success or none is left.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Try to attach a device until success or none is left.";
-	int ret = -1;
-	for (const auto &device : devices) {
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Trying to attach device " << device->address.str();
-		auto hostdev_xml = device->to_hostdev_xml();
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Hostdev xml:";
-		FASTLIB_LOG(pcidev_handler_log, trace) << hostdev_xml;
-		ret = virDomainAttachDevice(domain, hostdev_xml.c_str());
-		device->attached_hint = true;
-		if (ret == 0) {
-			FASTLIB_LOG(pcidev_handler_log, trace) << "Success attaching device.";
-			break;
+	// Claim a device before attaching so concurrent attaches do not collide.
+	// If no device is left, claims may be outdated, e.g., by domains stopped meanwhile. Reconcile them once.
+	for (bool reconciled = false; ; reconciled = true) {
+		for (const auto &device : devices) {
+			if (!device->try_claim(owner))
+				continue;
+			FASTLIB_LOG(pcidev_handler_log, trace) << "Attach claimed device " << device->address.str();
+			FASTLIB_LOG(pcidev_handler_log, trace) << "Hostdev xml:";
+			FASTLIB_LOG(pcidev_handler_log, trace) << device->hostdev_xml;
+			if (virDomainAttachDevice(domain, device->hostdev_xml.c_str()) == 0) {
+				FASTLIB_LOG(pcidev_handler_log, trace) << "Success attaching device.";
+				return;
+			}
+			FASTLIB_LOG(pcidev_handler_log, debug) << "Error attaching claimed device " << device->address.str() << ": " << virGetLastErrorMessage();
+			// Keep the claim of a device in use by another domain so it is not tried again. Reconciling assigns it to its actual owner.
+			// Otherwise the device is released, since the claim of an active domain would be kept until the domain stops.
+			if (!is_in_use_error(virGetLastError()))
+				device->release(owner);
 		}
-		FASTLIB_LOG(pcidev_handler_log, trace) << "No success attaching device.";
+		if (reconciled)
+			break;
+		FASTLIB_LOG(pcidev_handler_log, debug) << "No device of type " << pci_id.str() << " left. Reconcile claims.";
+		device_cache->reconcile(connection);
 	}
-	if (ret != 0)
-		throw std::runtime_error("No pci device could be attached");
+	throw std::runtime_error("No pci device could be attached");
 }
 
-std::unordered_map<PCI_id, size_t> PCI_device_handler::detach(virDomainPtr domain)
+/**
+ * \brief Get the addresses of all hostdevs of a domain grouped by PCI-id.
+ */
+std::unordered_map<PCI_id, std::vector<PCI_address>> get_attached_addresses_by_type(virDomainPtr domain)
 {
-	// Parse domain xml to get all attached hostdevs.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Parse domain xml to get all attached hostdevs.";
-	// TODO: Consider reusing hostdev xml descriptions instead of generating later from cached devices.
-	auto domain_ptree = read_xml_from_string(get_domain_xml(domain));
-	auto attached_devices = domain_ptree.get_child("domain.devices");
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Find attached devices.";
-	std::vector<PCI_address> addresses;
-	for (const auto &device : attached_devices) {
-		if (device.first == "hostdev") {
-			addresses.push_back(make_pci_address_from_address_ptree(device.second.get_child("source")));
-		}
-	}
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Found " << addresses.size() << " attached devices.";
+	auto addresses = Domain_description(domain).get_hostdev_addresses();
 	// Get PCI-id of devices.
 	FASTLIB_LOG(pcidev_handler_log, trace) << "Get PCI-id of devices.";
-	// TODO: Add method to device cache to find devices 
 	auto connection = virDomainGetConnect(domain);	
 	std::unordered_map<PCI_id, std::vector<PCI_address>> id_addresses_map;
 	for (auto &address : addresses) {
 		std::unique_ptr<virNodeDevice, Deleter_virNodeDevice> nodedev;
 		nodedev.reset(virNodeDeviceLookupByName(connection, address.to_name_fmt().c_str()));
+		if (!nodedev)
+			throw std::runtime_error("Error looking up node device " + address.to_name_fmt() + ": " + virGetLastErrorMessage());
 		auto device_xml = convert_and_free_cstr(virNodeDeviceGetXMLDesc(nodedev.get(), 0));
-		auto pci_id = make_pci_id_from_nodedev_xml(device_xml);
+		PCI_id pci_id;
+		parse_nodedev_xml(device_xml, pci_id);
 		id_addresses_map[pci_id].push_back(std::move(address));
 	}
-	// Find devices in cache.
+	return id_addresses_map;
+}
+
+std::unordered_map<PCI_id, size_t> get_attached_device_types(virDomainPtr domain)
+{
+	std::unordered_map<PCI_id, size_t> types_counts;
+	for (const auto &id_addresses_pair : get_attached_addresses_by_type(domain))
+		types_counts[id_addresses_pair.first] = id_addresses_pair.second.size();
+	return types_counts;
+}
+
+std::unordered_map<PCI_id, size_t> PCI_device_handler::count_free_devices(virConnectPtr host_connection) const
+{
+	return device_cache->count_free_devices(host_connection);
+}
+
+std::unordered_map<PCI_id, size_t> PCI_device_handler::detach(virDomainPtr domain)
+{
+	return detach(domain, Domain_description(domain));
+}
+
+std::unordered_map<PCI_id, size_t> PCI_device_handler::detach(virDomainPtr domain, const Domain_description &description)
+{
+	auto connection = virDomainGetConnect(domain);	
+	// Find devices in cache by their address.
 	FASTLIB_LOG(pcidev_handler_log, trace) << "Find devices in cache.";
-	std::vector<std::shared_ptr<Device>> devices;
-	for (const auto &id_addresses_pair : id_addresses_map) {
-		auto pci_id = id_addresses_pair.first;
-		auto addresses = id_addresses_pair.second;
-		auto all_devices = device_cache->get_devices(connection, pci_id, false);
-		for (const auto &address : addresses) {
-			for (const auto &device : all_devices) {
-				if (device->address == address) {
-					devices.push_back(device);
-					break;
-				}
-			}
+	const auto &addresses = description.get_hostdev_addresses();
+	auto devices = device_cache->find_devices(connection, addresses);
+	// Detach and release claims.
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Detach and release claims.";
+	auto owner = get_domain_uuid(domain);
+	// Return detached device types with amount (may help reattaching on dest host)
+	std::unordered_map<PCI_id, size_t> types_counts;
+	for (size_t i = 0; i != devices.size(); ++i) {
+		const auto &device = devices[i];
+		if (!device) {
+			FASTLIB_LOG(pcidev_handler_log, warn) << "Skip unknown device " << addresses[i].str() << ".";
+			continue;
 		}
-	}
-	// Detach and reset attached hint.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Detach and reset attached hint.";
-	for (const auto &device : devices) {
-		if (virDomainDetachDevice(domain, device->to_hostdev_xml().c_str()) != 0) {
+		++types_counts[device->pci_id];
+		if (virDomainDetachDevice(domain, device->hostdev_xml.c_str()) != 0) {
 			auto domain_name = virDomainGetName(domain);
 			FASTLIB_LOG(pcidev_handler_log, trace) << "Error detaching device " << device->address.str() 
 						 << " from " << domain_name << ".";
+			continue;
 		}
-		device->attached_hint = false;
-	}
-	// Return detached device types with amount (may help reattaching on dest host)
-	std::unordered_map<PCI_id, size_t> types_counts;
-	for (const auto &id_addresses_pair : id_addresses_map) {
-		types_counts[id_addresses_pair.first] = id_addresses_pair.second.size();
+		device->release(owner);
 	}
-
 	return types_counts;
 }
 
@@ -332,9 +681,10 @@ std::unordered_map<PCI_id, size_t> PCI_device_handler::detach(virDomainPtr domai
 //
 
 Migrate_devices_guard::Migrate_devices_guard(std::shared_ptr<PCI_device_handler> pci_device_handler,
-		std::shared_ptr<virDomain> domain, Time_measurement &time_measurement, std::string tag_postfix) :
+		std::shared_ptr<virDomain> domain, std::shared_ptr<const Domain_description> description, Time_measurement &time_measurement, std::string tag_postfix) :
 	pci_device_handler(pci_device_handler),
 	domain(domain),
+	description(std::move(description)),
 	time_measurement(time_measurement),
 	tag_postfix(std::move(tag_postfix))
 {
@@ -342,7 +692,7 @@ Migrate_devices_guard::Migrate_devices_guard(std::shared_ptr<PCI_device_handler>
 		this->tag_postfix = "-" + this->tag_postfix;
 	FASTLIB_LOG(pcidev_handler_log, trace) << "Detach all devices.";
 	time_measurement.tick("detach-pci-devs" + this->tag_postfix);
-	detached_types_counts = pci_device_handler->detach(domain.get());
+	detached_types_counts = pci_device_handler->detach(domain.get(), *this->description);
 	time_measurement.tock("detach-pci-devs" + this->tag_postfix);
 }
 
@@ -15,18 +15,23 @@
 #include <fast-lib/serializable.hpp>
 
 #include <libvirt/libvirt.h>
-#include <boost/property_tree/ptree.hpp>
 
 #include <memory>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <future>
+
+class Connection_pool;
+class Domain_description;
+class Xml_scanner;
+class Xml_writer;
 
 using PCI_id = fast::msg::migfra::PCI_id;
 using Time_measurement = fast::msg::migfra::Time_measurement;
 
-// Contains pci address and methods to convert from and to ptree.
+// Contains pci address and methods to convert to xml and strings.
 struct PCI_address
 {
 	using domain_t = unsigned short;
@@ -37,7 +42,7 @@ struct PCI_address
 	PCI_address(domain_t domain, bus_t bus, slot_t slot, function_t function);
 
 	bool operator==(const PCI_address &rhs) const;
-	boost::property_tree::ptree to_address_ptree() const;
+	void write_address_element(Xml_writer &writer) const;
 	std::string str() const;
 	std::string to_name_fmt() const;
 
@@ -47,30 +52,147 @@ struct PCI_address
 	const function_t function;
 };
 
-// Contains xml description of device which can be used to attach/detach.
-// Also contains a hint to mark the device as already in use.
-// Nevertheless the device might still be tried to attach but has lower priority.
+// Parse the attributes of the address element the scanner is at, e.g., the address of the source of a hostdev.
+PCI_address make_pci_address_from_address_element(const Xml_scanner &scanner);
+
+namespace std
+{
+	template<> struct hash<PCI_address>
+	{
+		size_t operator()(const PCI_address &address) const;
+	};
+}
+
+// Contains a parsed PCI device and its pre-rendered hostdev xml which can be used to attach/detach.
+// Also contains the UUID of the domain which claimed the device.
+// A device is claimed by compare-and-swap before it is attached so concurrent attaches never pick the same device.
 struct Device
 {
-	Device(const std::string &xml_desc);
-	Device(std::string &&xml_desc);
+	Device(PCI_id pci_id, PCI_address address);
 
-	std::string to_hostdev_xml() const;
+	/**
+	 * \brief Claim the device for a domain if it is not claimed yet.
+	 *
+	 * \returns True if the device is claimed by this call.
+	 */
+	bool try_claim(const std::string &owner);
+	/**
+	 * \brief Release the claim if the device is claimed by this domain.
+	 */
+	void release(const std::string &owner);
+	/**
+	 * \brief Get the UUID of the domain which claimed the device or an empty string if unclaimed.
+	 */
+	std::string get_owner() const;
+	void set_owner(const std::string &owner);
 
-	const std::string xml_desc;
+	const PCI_id pci_id;
 	const PCI_address address;
-	std::atomic<bool> attached_hint;
+	const std::string hostdev_xml;
+private:
+	// Accessed by std::atomic_load/std::atomic_store/std::atomic_compare_exchange_strong only.
+	std::shared_ptr<const std::string> owner;
 };
 
+// Parse the xml description of a node device.
+std::shared_ptr<Device> make_device_from_nodedev_xml(const std::string &nodedev_xml);
+
 // A lazy initialized cache to store devices in.
+// All PCI devices of a host are enumerated and parsed once and indexed by PCI-id and PCI-address.
+// The cache is sharded per host: Concurrent callers wait for a single enumeration of that host only.
+// Once a host is cached, lookups read an immutable snapshot without taking a lock.
+// Claims of the devices are reconciled with the hostdevs of the active domains when a host is enumerated.
+// If a connection pool is passed, node device lifecycle events keep the cache up to date:
+// Created and deleted PCI devices are added to or removed from a new snapshot without enumerating the host again.
+// A host is enumerated again if the connection its events are received on is lost.
 class Device_cache
 {
 public:
-	std::vector<std::shared_ptr<Device>> get_devices(virConnectPtr host_connection, PCI_id pci_id, bool sort_and_shuffle = true) const;
+	explicit Device_cache(std::shared_ptr<Connection_pool> connection_pool = nullptr);
+
+	/**
+	 * \brief Enumerate the devices of hosts in the background.
+	 *
+	 * Requires a connection pool. Errors are logged only, the host is enumerated again on first use.
+	 */
+	void prewarm(const std::vector<std::string> &host_uris);
+	// Unclaimed devices are returned first.
+	std::vector<std::shared_ptr<Device>> get_devices(virConnectPtr host_connection, PCI_id pci_id) const;
+	// Returns nullptr if no device with this address is found.
+	std::shared_ptr<Device> find_device(virConnectPtr host_connection, const PCI_address &address) const;
+	// Looks up all addresses in a single snapshot. Contains nullptr for each address no device is found for.
+	std::vector<std::shared_ptr<Device>> find_devices(virConnectPtr host_connection, const std::vector<PCI_address> &addresses) const;
+	/**
+	 * \brief Claim the devices attached to active domains for them and release claims of inactive domains.
+	 *
+	 * Claims of active domains without the device attached are kept since the device may be being attached.
+	 * Attaching keeps such a claim also if the device is in use by a domain not found on this connection.
+	 */
+	void reconcile(virConnectPtr host_connection) const;
+	/**
+	 * \brief Count the cached devices of each type which are neither claimed nor attached to an active domain.
+	 */
+	std::unordered_map<PCI_id, size_t> count_free_devices(virConnectPtr host_connection) const;
 private:
-	// (hosturi : (pci_id : xml_desc))
-	mutable std::unordered_map<std::string, std::unordered_map<PCI_id, std::vector<std::shared_ptr<Device>>>> devices;
-	mutable std::mutex devices_mutex;
+	// Registration of the node device event callback which is deregistered on destruction.
+	struct Node_device_events;
+
+	struct Host_devices
+	{
+		// (pci_id : devices)
+		std::unordered_map<PCI_id, std::vector<std::shared_ptr<Device>>> by_id;
+		// (pci_address : device)
+		std::unordered_map<PCI_address, std::shared_ptr<Device>> by_address;
+		// Events this snapshot is updated by. Is nullptr if events could not be registered.
+		std::shared_ptr<const Node_device_events> events;
+	};
+
+	// A created (device is set) or deleted device.
+	struct Device_event
+	{
+		int event;
+		std::string name;
+		std::shared_ptr<Device> device;
+	};
+
+	struct Shard
+	{
+		// Accessed by std::atomic_load/std::atomic_store only.
+		std::shared_ptr<const Host_devices> devices;
+		// Held while the devices of the host are enumerated.
+		std::mutex population_mutex;
+		// Held while devices is replaced and while accessing pending_events.
+		std::mutex update_mutex;
+		// Events received while the devices of the host are enumerated.
+		std::vector<Device_event> pending_events;
+	};
+
+	// Passed to the node device event callback.
+	struct Event_context
+	{
+		std::weak_ptr<Shard> shard;
+		std::string host_uri;
+	};
+
+	using Shard_map = std::unordered_map<std::string, std::shared_ptr<Shard>>;
+
+	static void node_device_callback(virConnectPtr conn, virNodeDevicePtr dev, int event, int detail, void *opaque);
+	static void free_event_context(void *opaque);
+	static void apply_event(Host_devices &host_devices, const Device_event &device_event);
+	static void update(Shard &shard, Device_event device_event);
+	static void reconcile_claims(const Host_devices &host_devices, virConnectPtr host_connection);
+	std::shared_ptr<const Node_device_events> register_events(const std::shared_ptr<Shard> &shard, const std::string &host_uri) const;
+	std::shared_ptr<Shard> get_shard(const std::string &host_uri) const;
+	std::shared_ptr<const Host_devices> get_host_devices(virConnectPtr host_connection) const;
+
+	std::shared_ptr<Connection_pool> connection_pool;
+	// (hosturi : shard)
+	// Accessed by std::atomic_load/std::atomic_store only and copied on adding a host.
+	mutable std::shared_ptr<const Shard_map> shards;
+	// Held while adding a host.
+	mutable std::mutex shards_mutex;
+	// Declared last to wait for prewarming before the other members are destroyed.
+	std::vector<std::future<void>> prewarming;
 };
 
 // Provides methods to attach, detach and handle those during migration.
@@ -78,30 +200,61 @@ private:
 class PCI_device_handler
 {
 public:
-	PCI_device_handler();
+	/**
+	 * \param connection_pool The pool to receive node device events on. If nullptr, cached devices are never updated.
+	 */
+	explicit PCI_device_handler(std::shared_ptr<Connection_pool> connection_pool = nullptr);
+	/**
+	 * \brief Enumerate the devices of hosts in the background so the first attach does not have to.
+	 */
+	void prewarm(const std::vector<std::string> &host_uris);
 	/**
 	 * \brief Attach device of certain type to domain.
+	 *
+	 * A free device is claimed before attaching. If no device is free, the claims are reconciled once.
+	 * The claim is released if attaching fails, unless the device is in use by another domain.
 	 */
 	void attach(virDomainPtr domain, PCI_id pci_id);
 	/**
 	 * \brief Detach device of certain type to domain.
 	 *
+	 * The hostdevs of the domain are looked up in the device cache by address, no node device is queried.
+	 *
 	 * \returns A map with type id as key and the number of detached devices of that type as value.
 	 */
 	std::unordered_map<PCI_id, size_t> detach(virDomainPtr domain);
+	/**
+	 * \brief Detach the hostdevs of an already parsed domain description.
+	 */
+	std::unordered_map<PCI_id, size_t> detach(virDomainPtr domain, const Domain_description &description);
+	/**
+	 * \brief Count the PCI devices of each type on a host which are free to be attached.
+	 *
+	 * The devices are taken from the device cache, so only the active domains of the host are queried.
+	 * Types without any device on the host are left out.
+	 */
+	std::unordered_map<PCI_id, size_t> count_free_devices(virConnectPtr host_connection) const;
 private:
-	std::unique_ptr<const Device_cache> device_cache;	
+	std::unique_ptr<Device_cache> device_cache;
 };
 
+/**
+ * \brief Get the types of all PCI devices attached to a domain.
+ *
+ * \returns A map with type id as key and the number of attached devices of that type as value.
+ */
+std::unordered_map<PCI_id, size_t> get_attached_device_types(virDomainPtr domain);
+
 /**
  * \brief RAII-guard to detach devices in constructor and reattach in destructor.
- * 
+ *
+ * The devices are taken from the description of the domain.
  * If no error occures during migration the domain on destination should be set.
  */
 class Migrate_devices_guard
 {
 public:
-	Migrate_devices_guard(std::shared_ptr<PCI_device_handler> pci_device_handler, std::shared_ptr<virDomain> domain, Time_measurement &time_measurement, std::string tag_postfix = "");
+	Migrate_devices_guard(std::shared_ptr<PCI_device_handler> pci_device_handler, std::shared_ptr<virDomain> domain, std::shared_ptr<const Domain_description> description, Time_measurement &time_measurement, std::string tag_postfix = "");
 	~Migrate_devices_guard() noexcept(false);
 
 	void set_destination_domain(std::shared_ptr<virDomain> dest_domain);
@@ -110,6 +263,7 @@ private:
 
 	std::shared_ptr<PCI_device_handler> pci_device_handler;
 	std::shared_ptr<virDomain> domain;
+	std::shared_ptr<const Domain_description> description;
 	std::unordered_map<PCI_id, size_t> detached_types_counts;
 	Time_measurement &time_measurement;
 	std::string tag_postfix;
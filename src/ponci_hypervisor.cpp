@@ -63,15 +63,15 @@ void Ponci_hypervisor::stop(const fast::msg::migfra::Stop &task, fast::msg::migf
 
 }
 
-void Ponci_hypervisor::migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Ponci_hypervisor::migrate(const fast::msg::migfra::Migrate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm)
 {
-	(void) task; (void) time_measurement; (void) comm;
+	(void) task; (void) options; (void) time_measurement; (void) details; (void) comm;
 	throw std::runtime_error("Ponci_hypervisor has no support for migrations.");
 }
 
-void Ponci_hypervisor::evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Ponci_hypervisor::evacuate(const fast::msg::migfra::Evacuate &task, const Migration_options &options, fast::msg::migfra::Time_measurement &time_measurement, Result_details &details, std::shared_ptr<fast::Communicator> comm)
 {
-	(void) task; (void) time_measurement; (void) comm;
+	(void) task; (void) options; (void) time_measurement; (void) details; (void) comm;
 	throw std::runtime_error("Ponci_hypervisor has no support for evacuation.");
 }
 
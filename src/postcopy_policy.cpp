@@ -0,0 +1,21 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "postcopy_policy.hpp"
+
+std::string Postcopy_policy::get_switchover_reason(const Migration_progress &progress) const
+{
+	if (max_iterations != 0 && progress.iteration > max_iterations)
+		return "iterations";
+	// The dirty rate is not known before the first iteration finished.
+	if (dirty_rate_exceeds_bandwidth && progress.iteration >= 1 && progress.bandwidth != 0 && progress.dirty_rate > progress.bandwidth)
+		return "dirty-rate";
+	if (time_budget != 0 && progress.time_elapsed >= time_budget)
+		return "time-budget";
+	return "";
+}
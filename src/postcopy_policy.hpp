@@ -0,0 +1,39 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef POSTCOPY_POLICY_HPP
+#define POSTCOPY_POLICY_HPP
+
+#include "migration_monitor.hpp"
+
+#include <string>
+
+/**
+ * \brief Decides when a post-copy migration switches from pre-copy to post-copy.
+ *
+ * A post-copy migration starts as pre-copy migration, so domains which converge never switch.
+ * The policy is evaluated on every sample of the Migration_monitor.
+ */
+struct Postcopy_policy
+{
+	/**
+	 * \brief Check if the migration should switch to post-copy.
+	 *
+	 * \returns The reason for switching or an empty string if the migration should stay in pre-copy.
+	 */
+	std::string get_switchover_reason(const Migration_progress &progress) const;
+
+	// Switch after this many pre-copy iterations (0 disables this criterion).
+	unsigned long long max_iterations = 5;
+	// Switch as soon as the memory is dirtied faster than it is transferred.
+	bool dirty_rate_exceeds_bandwidth = true;
+	// Switch after this many milliseconds in pre-copy (0 disables this criterion).
+	unsigned long long time_budget = 0;
+};
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "result_details.hpp"
+
+bool Result_details::empty() const
+{
+	std::lock_guard<std::mutex> lock(details_mutex);
+	return details.size() == 0;
+}
+
+std::string Result_details::str() const
+{
+	std::lock_guard<std::mutex> lock(details_mutex);
+	if (details.size() == 0)
+		return "";
+	YAML::Emitter emitter;
+	emitter << YAML::Flow << details;
+	return emitter.c_str();
+}
@@ -0,0 +1,52 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef RESULT_DETAILS_HPP
+#define RESULT_DETAILS_HPP
+
+#include <yaml-cpp/yaml.h>
+
+#include <string>
+#include <mutex>
+
+/**
+ * \brief Collects details of a successful task which are returned in the details of its result.
+ *
+ * Details are stored as YAML map and returned in flow style (e.g., "{retries: 0}").
+ * Details may be set concurrently (e.g., by both migrations of a swap migration).
+ */
+class Result_details
+{
+public:
+	/**
+	 * \brief Set a detail.
+	 *
+	 * \param key The key of the detail in the map.
+	 * \param value The value to set (scalar or YAML::Node).
+	 */
+	template<typename T> void set(const std::string &key, const T &value)
+	{
+		std::lock_guard<std::mutex> lock(details_mutex);
+		details[key] = value;
+	}
+	/**
+	 * \brief Check if no details are set.
+	 */
+	bool empty() const;
+	/**
+	 * \brief Get all details in YAML flow style.
+	 *
+	 * Returns an empty string if no details are set.
+	 */
+	std::string str() const;
+private:
+	YAML::Node details;
+	mutable std::mutex details_mutex;
+};
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "retry_policy.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+std::chrono::milliseconds Retry_policy::get_backoff(unsigned int retry) const
+{
+	if (retry == 0)
+		return std::chrono::milliseconds(0);
+	double backoff = initial_backoff * std::pow(backoff_multiplier, retry - 1);
+	return std::chrono::milliseconds(static_cast<long long>(std::min(backoff, static_cast<double>(max_backoff))));
+}
@@ -0,0 +1,36 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef RETRY_POLICY_HPP
+#define RETRY_POLICY_HPP
+
+#include <chrono>
+
+/**
+ * \brief Exponential backoff between retries of failed migrations.
+ *
+ * The number of retries is defined by the retry-counter of the task.
+ */
+struct Retry_policy
+{
+	/**
+	 * \brief Get the time to wait before a retry.
+	 *
+	 * \param retry The number of the retry starting with 1.
+	 */
+	std::chrono::milliseconds get_backoff(unsigned int retry) const;
+
+	// Backoff before the first retry in milliseconds.
+	unsigned int initial_backoff = 1000;
+	// Factor the backoff is multiplied with on each further retry.
+	double backoff_multiplier = 2.0;
+	// Upper limit of the backoff in milliseconds.
+	unsigned int max_backoff = 30000;
+};
+
+#endif
@@ -0,0 +1,649 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "shmem_transfer.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <stdexcept>
+#include <memory>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+FASTLIB_LOG_INIT(shmem_transfer_log, "Shmem_transfer")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(shmem_transfer_log, trace);
+
+// Starts every request ("MFSH").
+const uint32_t shmem_transfer_magic = 0x4d465348;
+// Limits of the chunk size accepted by the receiver.
+const uint64_t min_chunk_size = 4096;
+const uint64_t max_chunk_size = 1ull << 30;
+const std::string shmem_directory = "/dev/shm/";
+
+std::string get_errno_string()
+{
+	return std::strerror(errno);
+}
+
+/**
+ * \brief Closes a file descriptor on destruction.
+ */
+class File_descriptor
+{
+public:
+	explicit File_descriptor(int fd) :
+		fd(fd)
+	{
+	}
+	File_descriptor(const File_descriptor &) = delete;
+	File_descriptor & operator=(const File_descriptor &) = delete;
+	~File_descriptor()
+	{
+		if (fd != -1)
+			close(fd);
+	}
+
+	int get() const
+	{
+		return fd;
+	}
+private:
+	int fd;
+};
+
+/**
+ * \brief Blocks SIGPIPE in the calling thread, so writing to a closed connection fails with EPIPE instead of terminating the daemon.
+ *
+ * sendfile() has no equivalent to MSG_NOSIGNAL.
+ */
+class Sigpipe_guard
+{
+public:
+	Sigpipe_guard()
+	{
+		sigemptyset(&sigpipe);
+		sigaddset(&sigpipe, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+	}
+	~Sigpipe_guard()
+	{
+		// Discard a SIGPIPE raised meanwhile, else it is delivered when unblocked.
+		struct timespec no_wait = {0, 0};
+		while (sigtimedwait(&sigpipe, nullptr, &no_wait) > 0)
+			;
+		pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+	}
+private:
+	sigset_t sigpipe;
+	sigset_t old_mask;
+};
+
+void check_region_name(const std::string &name)
+{
+	if (name.empty() || name.size() > 255 || name == "." || name == ".." || name.find_first_of(std::string("/\0", 2)) != std::string::npos)
+		throw std::runtime_error("Invalid name of shmem region \"" + name + "\".");
+}
+
+std::string get_region_path(const std::string &name)
+{
+	check_region_name(name);
+	return shmem_directory + name;
+}
+
+uint64_t rotate_left(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+/**
+ * \brief Hash a chunk of a region, eight bytes at a time, mixed as in MurmurHash3.
+ */
+uint64_t hash_chunk(const char *data, uint64_t size)
+{
+	uint64_t hash = 0x9e3779b97f4a7c15ull ^ size;
+	uint64_t offset = 0;
+	for (; offset + 8 <= size; offset += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + offset, sizeof(word));
+		word *= 0x87c37b91114253d5ull;
+		word = rotate_left(word, 31);
+		word *= 0x4cf5ad432745937full;
+		hash ^= word;
+		hash = rotate_left(hash, 27) * 5 + 0x52dce729;
+	}
+	uint64_t tail = 0;
+	std::memcpy(&tail, data + offset, size - offset);
+	hash ^= tail * 0x87c37b91114253d5ull;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+uint64_t get_chunk_count(uint64_t size, uint64_t chunk_size)
+{
+	return size / chunk_size + (size % chunk_size != 0 ? 1 : 0);
+}
+
+/**
+ * \brief Hash all chunks of a region through a read-only mapping.
+ */
+std::vector<uint64_t> hash_chunks(int fd, uint64_t size, uint64_t chunk_size)
+{
+	std::vector<uint64_t> hashes;
+	if (size == 0)
+		return hashes;
+	auto addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		throw std::runtime_error("Error mapping shmem region: " + get_errno_string());
+	std::shared_ptr<void> mapping(addr, [size](void *addr){munmap(addr, size);});
+	madvise(addr, size, MADV_SEQUENTIAL);
+	auto data = static_cast<const char *>(addr);
+	hashes.reserve(get_chunk_count(size, chunk_size));
+	for (uint64_t offset = 0; offset < size; offset += chunk_size)
+		hashes.push_back(hash_chunk(data + offset, std::min(chunk_size, size - offset)));
+	return hashes;
+}
+
+//
+// Protocol helpers
+//
+// A request consists of the magic, name, domain name, size, chunk size, mode and the hashes of all chunks.
+// The receiver answers with a status and the indices of the chunks it needs, which are sent in this order.
+// After writing them, the receiver answers with a final status.
+// A status is a byte which is 0 on success, else it is followed by an error message.
+// All numbers are sent in big endian, strings are prefixed by their length.
+//
+
+void append_u32(std::string &buffer, uint32_t value)
+{
+	value = htobe32(value);
+	buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void append_u64(std::string &buffer, uint64_t value)
+{
+	value = htobe64(value);
+	buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void append_string(std::string &buffer, const std::string &str)
+{
+	append_u32(buffer, str.size());
+	buffer += str;
+}
+
+void write_all(int fd, const char *data, size_t size)
+{
+	while (size != 0) {
+		auto ret = ::send(fd, data, size, MSG_NOSIGNAL);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Error sending to shmem transfer connection: " + get_errno_string());
+		}
+		data += ret;
+		size -= ret;
+	}
+}
+
+void read_all(int fd, void *buffer, size_t size)
+{
+	auto data = static_cast<char *>(buffer);
+	while (size != 0) {
+		auto ret = recv(fd, data, size, 0);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Error receiving from shmem transfer connection: " + get_errno_string());
+		}
+		if (ret == 0)
+			throw std::runtime_error("Shmem transfer connection closed by peer.");
+		data += ret;
+		size -= ret;
+	}
+}
+
+uint32_t read_u32(int fd)
+{
+	uint32_t value;
+	read_all(fd, &value, sizeof(value));
+	return be32toh(value);
+}
+
+uint64_t read_u64(int fd)
+{
+	uint64_t value;
+	read_all(fd, &value, sizeof(value));
+	return be64toh(value);
+}
+
+std::vector<uint64_t> read_u64_array(int fd, uint64_t count)
+{
+	std::vector<uint64_t> values(count);
+	read_all(fd, values.data(), count * sizeof(uint64_t));
+	for (auto &value : values)
+		value = be64toh(value);
+	return values;
+}
+
+std::string read_string(int fd, uint32_t max_size)
+{
+	auto size = read_u32(fd);
+	if (size > max_size)
+		throw std::runtime_error("String in shmem transfer exceeds " + std::to_string(max_size) + " bytes.");
+	std::string str(size, '\0');
+	read_all(fd, &str[0], size);
+	return str;
+}
+
+void send_status(int fd, const std::string &error)
+{
+	std::string status(1, error.empty() ? '\0' : '\1');
+	if (!error.empty())
+		append_string(status, error);
+	write_all(fd, status.data(), status.size());
+}
+
+void check_status(int fd)
+{
+	char status;
+	read_all(fd, &status, sizeof(status));
+	if (status != '\0')
+		throw std::runtime_error("Destination could not receive shmem region: " + read_string(fd, 4096));
+}
+
+void set_timeouts(int fd, unsigned int timeout)
+{
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0 || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0)
+		throw std::runtime_error("Error setting timeout of shmem transfer connection: " + get_errno_string());
+}
+
+/**
+ * \brief Get the numeric address of a socket address. IPv4 addresses mapped to IPv6 are returned as IPv4 addresses.
+ */
+std::string get_numeric_address(const struct sockaddr *address, socklen_t size)
+{
+	char host[NI_MAXHOST];
+	if (getnameinfo(address, size, host, sizeof(host), nullptr, 0, NI_NUMERICHOST) != 0)
+		return "";
+	std::string numeric_address(host);
+	if (numeric_address.compare(0, 7, "::ffff:") == 0)
+		numeric_address.erase(0, 7);
+	return numeric_address;
+}
+
+std::shared_ptr<struct addrinfo> resolve(const std::string &hostname, const char *service)
+{
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *servinfo_tmp_ptr = nullptr;
+	int ret;
+	if ((ret = getaddrinfo(hostname.c_str(), service, &hints, &servinfo_tmp_ptr)) != 0)
+		throw std::runtime_error("Error resolving " + hostname + ": getaddrinfo: " + std::string(gai_strerror(ret)));
+	return std::shared_ptr<struct addrinfo>(servinfo_tmp_ptr, [](struct addrinfo *ai){freeaddrinfo(ai);});
+}
+
+int connect_to_receiver(const std::string &hostname, unsigned short port, unsigned int timeout)
+{
+	auto servinfo = resolve(hostname, std::to_string(port).c_str());
+	std::string error = "No address found.";
+	for (auto p = servinfo.get(); p != nullptr; p = p->ai_next) {
+		int fd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+		if (fd == -1) {
+			error = get_errno_string();
+			continue;
+		}
+		try {
+			// Also limits the time connect() blocks.
+			set_timeouts(fd, timeout);
+		} catch (...) {
+			close(fd);
+			throw;
+		}
+		if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+			return fd;
+		error = get_errno_string();
+		close(fd);
+	}
+	throw std::runtime_error("Could not connect to shmem receiver on " + hostname + ": " + error);
+}
+
+void send_chunk(int socket_fd, int file_fd, off_t offset, uint64_t length)
+{
+	while (length != 0) {
+		auto ret = sendfile(socket_fd, file_fd, &offset, length);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Error sending chunk of shmem region: " + get_errno_string());
+		}
+		if (ret == 0)
+			throw std::runtime_error("Shmem region was truncated during the transfer.");
+		length -= ret;
+	}
+}
+
+/**
+ * \brief Move a chunk from the connection through a pipe to the region without copying it to user space.
+ */
+void receive_chunk(int socket_fd, int pipe_read_fd, int pipe_write_fd, int file_fd, loff_t offset, uint64_t length)
+{
+	while (length != 0) {
+		auto in_pipe = splice(socket_fd, nullptr, pipe_write_fd, nullptr, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (in_pipe == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Error receiving chunk of shmem region: " + get_errno_string());
+		}
+		if (in_pipe == 0)
+			throw std::runtime_error("Shmem transfer connection closed by peer.");
+		length -= in_pipe;
+		while (in_pipe != 0) {
+			auto written = splice(pipe_read_fd, nullptr, file_fd, &offset, in_pipe, SPLICE_F_MOVE);
+			if (written == -1) {
+				if (errno == EINTR)
+					continue;
+				throw std::runtime_error("Error writing chunk of shmem region: " + get_errno_string());
+			}
+			in_pipe -= written;
+		}
+	}
+}
+
+/**
+ * \brief Open a shmem region below the directory and create it only if it does not exist yet.
+ *
+ * Names contain no slash, so O_NOFOLLOW covers the whole path below the directory.
+ * \param created Set to true if the region was created by this call.
+ */
+int open_region(int directory_fd, const std::string &name, mode_t mode, bool &created)
+{
+	created = false;
+	int fd = openat(directory_fd, name.c_str(), O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1 && errno == ENOENT) {
+		fd = openat(directory_fd, name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode);
+		created = fd != -1;
+	}
+	return fd;
+}
+
+//
+// Shmem_transfer implementation
+//
+
+Shmem_transfer::Shmem_transfer(std::string dest_hostname, std::string domain_name, Shmem_transfer_config config) :
+	dest_hostname(std::move(dest_hostname)),
+	domain_name(std::move(domain_name)),
+	config(std::move(config))
+{
+	if (this->config.chunk_size < min_chunk_size || this->config.chunk_size > max_chunk_size)
+		throw std::runtime_error("Chunk size of shmem transfer has to be between " + std::to_string(min_chunk_size) + " and " + std::to_string(max_chunk_size) + " bytes.");
+}
+
+unsigned long long Shmem_transfer::send(const std::string &name) const
+{
+	Sigpipe_guard sigpipe_guard;
+	File_descriptor file(open(get_region_path(name).c_str(), O_RDONLY | O_CLOEXEC));
+	if (file.get() == -1)
+		throw std::runtime_error("Could not open shmem region " + name + ": " + get_errno_string());
+	struct stat file_stat;
+	if (fstat(file.get(), &file_stat) != 0)
+		throw std::runtime_error("Could not get size of shmem region " + name + ": " + get_errno_string());
+	uint64_t size = file_stat.st_size;
+	auto hashes = hash_chunks(file.get(), size, config.chunk_size);
+	File_descriptor connection(connect_to_receiver(dest_hostname, config.port, config.timeout));
+	std::string request;
+	request.reserve(64 + name.size() + hashes.size() * sizeof(uint64_t));
+	append_u32(request, shmem_transfer_magic);
+	append_string(request, name);
+	append_string(request, domain_name);
+	append_u64(request, size);
+	append_u64(request, config.chunk_size);
+	append_u32(request, file_stat.st_mode & 0666);
+	for (auto hash : hashes)
+		append_u64(request, hash);
+	write_all(connection.get(), request.data(), request.size());
+	check_status(connection.get());
+	auto dirty_count = read_u64(connection.get());
+	if (dirty_count > hashes.size())
+		throw std::runtime_error("Destination requested more chunks than shmem region " + name + " has.");
+	auto dirty_chunks = read_u64_array(connection.get(), dirty_count);
+	unsigned long long sent_bytes = 0;
+	for (auto chunk : dirty_chunks) {
+		if (chunk >= hashes.size())
+			throw std::runtime_error("Destination requested unknown chunk of shmem region " + name + ".");
+		uint64_t offset = chunk * config.chunk_size;
+		auto length = std::min<uint64_t>(config.chunk_size, size - offset);
+		send_chunk(connection.get(), file.get(), offset, length);
+		sent_bytes += length;
+	}
+	check_status(connection.get());
+	FASTLIB_LOG(shmem_transfer_log, trace) << "Sent " << dirty_count << " of " << hashes.size() << " chunks (" << sent_bytes << " bytes) of shmem region "
+		<< name << " to " << dest_hostname << ".";
+	return sent_bytes;
+}
+
+//
+// Shmem_receiver implementation
+//
+
+void Shmem_receiver::receive_region(int socket_fd, const std::string &peer_address) const
+{
+	File_descriptor connection(socket_fd);
+	// A region created for a request which fails is removed again.
+	std::string name;
+	bool created = false;
+	try {
+		set_timeouts(socket_fd, config.timeout);
+		if (read_u32(socket_fd) != shmem_transfer_magic)
+			throw std::runtime_error("Unknown request.");
+		name = read_string(socket_fd, 255);
+		check_region_name(name);
+		auto domain_name = read_string(socket_fd, 4096);
+		auto size = read_u64(socket_fd);
+		auto chunk_size = read_u64(socket_fd);
+		auto mode = read_u32(socket_fd) & 0666;
+		if (chunk_size < min_chunk_size || chunk_size > max_chunk_size)
+			throw std::runtime_error("Invalid chunk size " + std::to_string(chunk_size) + ".");
+		// Only the domain being migrated in may use the region on this host.
+		for (const auto &region_domain : get_region_domains(name)) {
+			if (region_domain != domain_name)
+				throw std::runtime_error("Shmem region " + name + " is in use by domain " + region_domain + ".");
+		}
+		// Validate the request before the region is created or opened.
+		struct stat file_stat;
+		uint64_t existing_size = 0;
+		if (fstatat(shmem_directory_fd, name.c_str(), &file_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+			if (!S_ISREG(file_stat.st_mode))
+				throw std::runtime_error("Shmem region " + name + " is no regular file.");
+			existing_size = file_stat.st_size;
+		} else if (errno != ENOENT) {
+			throw std::runtime_error("Could not get status of shmem region " + name + ": " + get_errno_string());
+		}
+		// Check the space before reading the hashes, whose number depends on the size.
+		struct statvfs shm_stat;
+		if (fstatvfs(shmem_directory_fd, &shm_stat) != 0)
+			throw std::runtime_error("Could not get free space of " + shmem_directory + ": " + get_errno_string());
+		if (size > existing_size && size - existing_size > static_cast<uint64_t>(shm_stat.f_bavail) * shm_stat.f_frsize)
+			throw std::runtime_error("Not enough space in " + shmem_directory + " for shmem region " + name + ".");
+		auto hashes = read_u64_array(socket_fd, get_chunk_count(size, chunk_size));
+		// A region created here is owned by this daemon, an existing region keeps its owner.
+		File_descriptor file(open_region(shmem_directory_fd, name, mode, created));
+		if (file.get() == -1)
+			throw std::runtime_error("Could not open shmem region " + name + ": " + get_errno_string());
+		// The region may have changed since it was validated.
+		if (fstat(file.get(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode))
+			throw std::runtime_error("Shmem region " + name + " is no regular file.");
+		existing_size = file_stat.st_size;
+		std::vector<uint64_t> dirty_chunks;
+		if (existing_size == size) {
+			auto own_hashes = hash_chunks(file.get(), size, chunk_size);
+			for (uint64_t chunk = 0; chunk != hashes.size(); ++chunk) {
+				if (own_hashes[chunk] != hashes[chunk])
+					dirty_chunks.push_back(chunk);
+			}
+		} else {
+			if (ftruncate(file.get(), size) != 0)
+				throw std::runtime_error("Could not resize shmem region " + name + ": " + get_errno_string());
+			for (uint64_t chunk = 0; chunk != hashes.size(); ++chunk)
+				dirty_chunks.push_back(chunk);
+		}
+		// The hypervisor on this host has to be able to open the region as on the source.
+		if (fchmod(file.get(), mode) != 0)
+			FASTLIB_LOG(shmem_transfer_log, warn) << "Could not apply mode of shmem region " << name << ": " << get_errno_string();
+		std::string reply(1, '\0');
+		append_u64(reply, dirty_chunks.size());
+		for (auto chunk : dirty_chunks)
+			append_u64(reply, chunk);
+		write_all(socket_fd, reply.data(), reply.size());
+		int pipe_fds[2];
+		if (pipe2(pipe_fds, O_CLOEXEC) != 0)
+			throw std::runtime_error("Could not create pipe: " + get_errno_string());
+		File_descriptor pipe_read(pipe_fds[0]);
+		File_descriptor pipe_write(pipe_fds[1]);
+		// A larger pipe moves more pages per splice(), the default size is kept if not permitted.
+		fcntl(pipe_write.get(), F_SETPIPE_SZ, 1024 * 1024);
+		for (auto chunk : dirty_chunks) {
+			auto offset = chunk * chunk_size;
+			receive_chunk(socket_fd, pipe_read.get(), pipe_write.get(), file.get(), offset, std::min(chunk_size, size - offset));
+		}
+		send_status(socket_fd, "");
+		FASTLIB_LOG(shmem_transfer_log, trace) << "Received " << dirty_chunks.size() << " of " << hashes.size() << " chunks of shmem region "
+			<< name << " of domain " << domain_name << " from " << peer_address << ".";
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(shmem_transfer_log, warn) << "Error receiving shmem region from " << peer_address << ": " << e.what();
+		if (created && unlinkat(shmem_directory_fd, name.c_str(), 0) != 0)
+			FASTLIB_LOG(shmem_transfer_log, warn) << "Could not remove shmem region " << name << ": " << get_errno_string();
+		try {
+			send_status(socket_fd, e.what());
+		} catch (...) {
+			// The peer is gone or has to time out.
+		}
+	}
+}
+
+Shmem_receiver::Shmem_receiver(Shmem_transfer_config config, std::vector<std::string> allowed_hosts, Region_domains get_region_domains) :
+	config(std::move(config)),
+	allowed_hosts(std::move(allowed_hosts)),
+	get_region_domains(std::move(get_region_domains)),
+	shmem_directory_fd(-1),
+	listen_fd(-1),
+	connections(std::max(this->config.max_connections, 1u), 1, Thread_pool::Overflow_policy::reject)
+{
+	if (this->allowed_hosts.empty())
+		FASTLIB_LOG(shmem_transfer_log, warn) << "No hosts allowed to send shmem regions, all connections are refused.";
+	shmem_directory_fd = open(shmem_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (shmem_directory_fd == -1)
+		throw std::runtime_error("Could not open " + shmem_directory + ": " + get_errno_string());
+	// Dual-stack socket accepting IPv4 and IPv6 connections.
+	listen_fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1) {
+		auto error = get_errno_string();
+		close(shmem_directory_fd);
+		throw std::runtime_error("Could not create socket of shmem receiver: " + error);
+	}
+	int on = 1;
+	int off = 0;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+	struct sockaddr_in6 address = {};
+	address.sin6_family = AF_INET6;
+	address.sin6_addr = in6addr_any;
+	address.sin6_port = htons(this->config.port);
+	if (bind(listen_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || listen(listen_fd, 16) != 0) {
+		auto error = get_errno_string();
+		close(listen_fd);
+		close(shmem_directory_fd);
+		throw std::runtime_error("Could not listen for shmem regions on port " + std::to_string(this->config.port) + ": " + error);
+	}
+	accept_thread = std::thread(&Shmem_receiver::accept_connections, this);
+	FASTLIB_LOG(shmem_transfer_log, trace) << "Receiving shmem regions on port " << this->config.port << ".";
+}
+
+Shmem_receiver::~Shmem_receiver()
+{
+	// Makes the blocking accept() fail.
+	shutdown(listen_fd, SHUT_RDWR);
+	accept_thread.join();
+	close(listen_fd);
+	// Connections end at the latest when their timeout expires.
+	connections.wait_for_tasks_to_finish();
+	close(shmem_directory_fd);
+}
+
+void Shmem_receiver::accept_connections()
+{
+	while (true) {
+		struct sockaddr_storage peer = {};
+		socklen_t peer_size = sizeof(peer);
+		int fd = accept4(listen_fd, reinterpret_cast<struct sockaddr *>(&peer), &peer_size, SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			// The socket is shut down.
+			if (errno == EINVAL)
+				return;
+			FASTLIB_LOG(shmem_transfer_log, warn) << "Error accepting shmem transfer connection: " << get_errno_string();
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
+		auto peer_address = get_numeric_address(reinterpret_cast<struct sockaddr *>(&peer), peer_size);
+		if (!is_allowed(peer_address)) {
+			FASTLIB_LOG(shmem_transfer_log, warn) << "Rejected shmem transfer connection from " << peer_address << ".";
+			close(fd);
+			continue;
+		}
+		try {
+			connections.submit({[this, fd, peer_address] {receive_region(fd, peer_address);}});
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(shmem_transfer_log, warn) << "Rejected shmem transfer connection from " << peer_address << ": " << e.what();
+			close(fd);
+		}
+	}
+}
+
+bool Shmem_receiver::is_allowed(const std::string &peer_address) const
+{
+	// Resolved on each connection, so changed addresses of the hosts are picked up.
+	for (const auto &host : allowed_hosts) {
+		try {
+			auto servinfo = resolve(host, nullptr);
+			for (auto p = servinfo.get(); p != nullptr; p = p->ai_next) {
+				if (get_numeric_address(p->ai_addr, p->ai_addrlen) == peer_address)
+					return true;
+			}
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(shmem_transfer_log, warn) << e.what();
+		}
+	}
+	return false;
+}
@@ -0,0 +1,99 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef SHMEM_TRANSFER_HPP
+#define SHMEM_TRANSFER_HPP
+
+#include "thread_pool.hpp"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+
+/**
+ * \brief Configuration of the transfer of shared memory regions between daemons.
+ */
+struct Shmem_transfer_config
+{
+	// Port the daemons receive regions on, transfers are disabled if 0.
+	unsigned short port = 0;
+	// Size of the chunks which are compared to skip unchanged parts of a region in bytes.
+	unsigned long long chunk_size = 2 * 1024 * 1024;
+	// Timeout of sending and receiving on a connection in milliseconds.
+	unsigned int timeout = 30000;
+	// Number of regions received in parallel, further connections are refused.
+	unsigned int max_connections = 4;
+};
+
+/**
+ * \brief Copies shared memory regions (/dev/shm/<name>) to the daemon of a destination host.
+ *
+ * The region is divided into chunks. The destination compares hashes of the chunks with its own copy of the region
+ * and only requests the chunks which differ, so a transfer following a pre-copy only sends the chunks dirtied since.
+ * The chunks are sent with sendfile() and written to the region by the destination with splice().
+ */
+class Shmem_transfer
+{
+public:
+	/**
+	 * \param domain_name The domain the regions belong to. The destination refuses regions in use by other domains.
+	 */
+	Shmem_transfer(std::string dest_hostname, std::string domain_name, Shmem_transfer_config config);
+
+	/**
+	 * \brief Copy a region to the destination and wait until it is written.
+	 *
+	 * \returns The number of bytes of the sent chunks.
+	 */
+	unsigned long long send(const std::string &name) const;
+private:
+	std::string dest_hostname;
+	std::string domain_name;
+	Shmem_transfer_config config;
+};
+
+/**
+ * \brief Receives shared memory regions sent by Shmem_transfer in a background thread.
+ *
+ * Connections are handled by a bounded number of threads, which are waited for on destruction.
+ * Existing regions are only overwritten if no domain other than the one they are sent for uses them.
+ * Regions are created with the mode of the source, but owned by this daemon.
+ */
+class Shmem_receiver
+{
+public:
+	/**
+	 * \brief Returns the names of the local domains with an ivshmem device of a region.
+	 */
+	using Region_domains = std::function<std::vector<std::string>(const std::string &region_name)>;
+
+	/**
+	 * \param allowed_hosts Only connections from these hosts are accepted. All connections are refused if empty.
+	 */
+	Shmem_receiver(Shmem_transfer_config config, std::vector<std::string> allowed_hosts, Region_domains get_region_domains);
+	~Shmem_receiver();
+	Shmem_receiver(const Shmem_receiver &) = delete;
+	Shmem_receiver & operator=(const Shmem_receiver &) = delete;
+private:
+	void accept_connections();
+	bool is_allowed(const std::string &peer_address) const;
+	// Receive a region on a connection. Errors are sent to the peer.
+	void receive_region(int socket_fd, const std::string &peer_address) const;
+
+	Shmem_transfer_config config;
+	std::vector<std::string> allowed_hosts;
+	Region_domains get_region_domains;
+	// Regions are opened relative to /dev/shm.
+	int shmem_directory_fd;
+	int listen_fd;
+	Thread_pool connections;
+	std::thread accept_thread;
+};
+
+#endif
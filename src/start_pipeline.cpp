@@ -0,0 +1,416 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "start_pipeline.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+FASTLIB_LOG_INIT(start_pipeline_log, "Start_pipeline")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(start_pipeline_log, trace);
+
+//
+// Start_pipeline implementation
+//
+
+struct Start_pipeline::Start
+{
+	std::vector<Step> steps;
+	size_t next_step;
+	std::function<std::string()> get_probe_host;
+	std::chrono::seconds probe_timeout;
+	Callback callback;
+};
+
+Start_pipeline::Start_pipeline(Start_pipeline_limits limits) :
+	prober(new Boot_prober(limits.max_probes, std::chrono::milliseconds(limits.probe_interval))),
+	attach_workers(limits.attach_workers, limits.queue_size, Thread_pool::Overflow_policy::block),
+	create_workers(limits.create_workers, limits.queue_size, Thread_pool::Overflow_policy::block),
+	define_workers(limits.define_workers, limits.queue_size, Thread_pool::Overflow_policy::block)
+{
+}
+
+Start_pipeline::~Start_pipeline()
+{
+}
+
+void Start_pipeline::run(std::vector<Step> steps, std::function<std::string()> get_probe_host, std::chrono::seconds probe_timeout, Callback callback)
+{
+	auto start = std::make_shared<Start>();
+	start->steps = std::move(steps);
+	start->next_step = 0;
+	start->get_probe_host = std::move(get_probe_host);
+	start->probe_timeout = probe_timeout;
+	start->callback = std::move(callback);
+	advance(std::move(start));
+}
+
+void Start_pipeline::advance(std::shared_ptr<Start> start)
+{
+	if (start->next_step != start->steps.size()) {
+		auto stage = start->steps[start->next_step].first;
+		auto job = [this, start]
+		{
+			try {
+				start->steps[start->next_step++].second();
+			} catch (...) {
+				start->callback(std::current_exception());
+				return;
+			}
+			advance(start);
+		};
+		// Workers only wait for space in the queue of a later stage, so the stages never wait for each other in a cycle.
+		if (start->next_step != 0 && stage <= start->steps[start->next_step - 1].first)
+			get_workers(stage).resubmit(job);
+		else
+			get_workers(stage).submit({job});
+		return;
+	}
+	std::string probe_host;
+	try {
+		probe_host = start->get_probe_host();
+	} catch (...) {
+		start->callback(std::current_exception());
+		return;
+	}
+	if (probe_host.empty())
+		start->callback(nullptr);
+	else
+		prober->add(std::move(probe_host), start->probe_timeout, std::move(start->callback));
+}
+
+Thread_pool & Start_pipeline::get_workers(Stage stage)
+{
+	switch (stage) {
+	case Stage::define:
+		return define_workers;
+	case Stage::create:
+		return create_workers;
+	case Stage::attach:
+		return attach_workers;
+	}
+	throw std::logic_error("Unknown stage of start pipeline.");
+}
+
+//
+// Boot_prober implementation
+//
+
+/**
+ * \brief Number of threads resolving the hosts of probes.
+ */
+const unsigned int resolver_count = 4;
+
+struct Boot_prober::Probe
+{
+	enum class State
+	{
+		// Waiting for the next connection attempt.
+		idle,
+		// Waiting for a resolver thread to resolve the host.
+		resolving,
+		connecting,
+		// Connected and waiting for the identification string.
+		reading,
+		answered
+	};
+	// Result of getaddrinfo() passed from a resolver thread to the probing thread.
+	struct Resolution
+	{
+		std::mutex mutex;
+		bool done = false;
+		std::shared_ptr<struct addrinfo> addresses;
+		std::string error;
+	};
+
+	Probe(std::string host, std::chrono::seconds timeout, Start_pipeline::Callback callback) :
+		host(std::move(host)),
+		timeout(timeout),
+		callback(std::move(callback)),
+		state(State::idle),
+		fd(-1),
+		next_address(nullptr)
+	{
+	}
+	~Probe()
+	{
+		if (fd != -1)
+			close(fd);
+	}
+
+	void connect(std::chrono::steady_clock::time_point now, std::chrono::milliseconds interval);
+	void fail_attempt(const std::string &error, std::chrono::steady_clock::time_point now, std::chrono::milliseconds interval);
+	void read(std::chrono::steady_clock::time_point now, std::chrono::milliseconds interval);
+
+	const std::string host;
+	const std::chrono::seconds timeout;
+	Start_pipeline::Callback callback;
+	State state;
+	int fd;
+	std::chrono::steady_clock::time_point deadline;
+	std::chrono::steady_clock::time_point next_attempt;
+	std::shared_ptr<Resolution> resolution;
+	std::shared_ptr<struct addrinfo> addresses;
+	// Address to try after the current one failed.
+	struct addrinfo *next_address;
+	std::string received;
+	std::string last_error;
+};
+
+void Boot_prober::Probe::connect(std::chrono::steady_clock::time_point now, std::chrono::milliseconds interval)
+{
+	if (state == State::resolving) {
+		std::lock_guard<std::mutex> lock(resolution->mutex);
+		if (!resolution->done)
+			return;
+		addresses = std::move(resolution->addresses);
+		next_address = addresses ? addresses.get() : nullptr;
+		last_error = resolution->error;
+		resolution.reset();
+	}
+	if (!next_address)
+		return fail_attempt(last_error, now, interval);
+	auto address = next_address;
+	next_address = address->ai_next;
+	fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+	if (fd == -1)
+		return fail_attempt(std::strerror(errno), now, interval);
+	received.clear();
+	if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0)
+		state = State::reading;
+	else if (errno == EINPROGRESS)
+		state = State::connecting;
+	else
+		fail_attempt(std::strerror(errno), now, interval);
+}
+
+void Boot_prober::Probe::fail_attempt(const std::string &error, std::chrono::steady_clock::time_point now, std::chrono::milliseconds interval)
+{
+	FASTLIB_LOG(start_pipeline_log, debug) << "Exception while connecting to " << host << " with SSH: " << error;
+	if (fd != -1) {
+		close(fd);
+		fd = -1;
+	}
+	last_error = error;
+	// Try the remaining addresses before waiting for the next attempt.
+	if (next_address)
+		return connect(now, interval);
+	addresses.reset();
+	state = State::idle;
+	next_attempt = now + interval;
+}
+
+void Boot_prober::Probe::read(std::chrono::steady_clock::time_point now, std::chrono::milliseconds interval)
+{
+	char buffer[64];
+	auto ret = recv(fd, buffer, sizeof(buffer), 0);
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (ret == -1)
+		return fail_attempt(std::strerror(errno), now, interval);
+	if (ret == 0)
+		return fail_attempt("Connection closed.", now, interval);
+	received.append(buffer, ret);
+	if (received.size() < 4)
+		return;
+	if (received.compare(0, 4, "SSH-") != 0)
+		return fail_attempt("No SSH identification string received.", now, interval);
+	FASTLIB_LOG(start_pipeline_log, trace) << "Domain (" << host << ") is ready.";
+	close(fd);
+	fd = -1;
+	state = State::answered;
+}
+
+Boot_prober::Boot_prober(unsigned int max_probes, std::chrono::milliseconds interval) :
+	max_probes(std::max(max_probes, 1u)),
+	interval(interval),
+	stopping(false),
+	// Each probe resolves its host at most once at a time, so the queue never overflows.
+	resolvers(resolver_count, this->max_probes, Thread_pool::Overflow_policy::reject)
+{
+	if (pipe2(wake_up_fds, O_NONBLOCK | O_CLOEXEC) != 0)
+		throw std::runtime_error("Could not create pipe of boot prober: " + std::string(std::strerror(errno)));
+	probing_thread = std::thread(&Boot_prober::probe, this);
+}
+
+Boot_prober::~Boot_prober()
+{
+	{
+		std::lock_guard<std::mutex> lock(waiting_mutex);
+		stopping = true;
+	}
+	wake_up();
+	probing_thread.join();
+	// Resolvers wake up the probing thread through the pipe.
+	resolvers.wait_for_tasks_to_finish();
+	close(wake_up_fds[0]);
+	close(wake_up_fds[1]);
+}
+
+void Boot_prober::add(std::string host, std::chrono::seconds timeout, Start_pipeline::Callback callback)
+{
+	{
+		std::lock_guard<std::mutex> lock(waiting_mutex);
+		waiting.emplace_back(new Probe(std::move(host), timeout, std::move(callback)));
+	}
+	wake_up();
+}
+
+void Boot_prober::resolve(Probe &probe)
+{
+	FASTLIB_LOG(start_pipeline_log, trace) << "Try to connect to domain (" << probe.host << ") with SSH.";
+	auto resolution = std::make_shared<Probe::Resolution>();
+	auto host = probe.host;
+	try {
+		// Resolved on each attempt, since the name of a booting domain may only be registered once it requested an address.
+		resolvers.submit({[this, host, resolution]
+		{
+			struct addrinfo hints = {};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = AI_NUMERICSERV;
+			struct addrinfo *servinfo_tmp_ptr = nullptr;
+			int ret = getaddrinfo(host.c_str(), "22", &hints, &servinfo_tmp_ptr);
+			{
+				std::lock_guard<std::mutex> lock(resolution->mutex);
+				if (ret != 0)
+					resolution->error = "getaddrinfo: " + std::string(gai_strerror(ret));
+				else
+					resolution->addresses.reset(servinfo_tmp_ptr, [](struct addrinfo *ai){freeaddrinfo(ai);});
+				resolution->done = true;
+			}
+			wake_up();
+		}});
+	} catch (const std::exception &e) {
+		return probe.fail_attempt(e.what(), std::chrono::steady_clock::now(), interval);
+	}
+	probe.resolution = std::move(resolution);
+	probe.state = Probe::State::resolving;
+}
+
+void Boot_prober::wake_up()
+{
+	char byte = 0;
+	// If the pipe is full, the thread is woken up anyway.
+	if (write(wake_up_fds[1], &byte, 1) == -1 && errno != EAGAIN)
+		FASTLIB_LOG(start_pipeline_log, warn) << "Could not wake up boot prober: " << std::strerror(errno);
+}
+
+/**
+ * \brief Call the callback of a finished probe. Exceptions of the callback must not stop probing.
+ */
+void finish_probe(const Start_pipeline::Callback &callback, std::exception_ptr error)
+{
+	try {
+		callback(error);
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(start_pipeline_log, warn) << "Exception in callback of probe: " << e.what();
+	}
+}
+
+void Boot_prober::probe()
+{
+	std::vector<std::unique_ptr<Probe>> active;
+	std::vector<struct pollfd> fds;
+	while (true) {
+		auto now = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock(waiting_mutex);
+			if (stopping)
+				break;
+			while (!waiting.empty() && active.size() < max_probes) {
+				active.push_back(std::move(waiting.front()));
+				waiting.pop_front();
+				active.back()->deadline = now + active.back()->timeout;
+				active.back()->next_attempt = now;
+			}
+		}
+		for (auto &probe : active) {
+			if (probe->state == Probe::State::idle && probe->next_attempt <= now)
+				resolve(*probe);
+			else if (probe->state == Probe::State::resolving)
+				probe->connect(now, interval);
+		}
+		// Wait for the sockets, the next attempt, the next deadline or new probes.
+		auto wake_up_time = std::chrono::steady_clock::time_point::max();
+		fds.clear();
+		fds.push_back({wake_up_fds[0], POLLIN, 0});
+		for (auto &probe : active) {
+			wake_up_time = std::min(wake_up_time, probe->deadline);
+			if (probe->state == Probe::State::idle)
+				wake_up_time = std::min(wake_up_time, probe->next_attempt);
+			else if (probe->state == Probe::State::connecting)
+				fds.push_back({probe->fd, POLLOUT, 0});
+			else if (probe->state == Probe::State::reading)
+				fds.push_back({probe->fd, POLLIN, 0});
+		}
+		int poll_timeout = -1;
+		if (wake_up_time != std::chrono::steady_clock::time_point::max()) {
+			auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(wake_up_time - now).count() + 1;
+			poll_timeout = static_cast<int>(std::min<decltype(wait)>(std::max<decltype(wait)>(wait, 0), std::numeric_limits<int>::max()));
+		}
+		if (poll(fds.data(), fds.size(), poll_timeout) == -1 && errno != EINTR)
+			FASTLIB_LOG(start_pipeline_log, warn) << "Error polling probes: " << std::strerror(errno);
+		now = std::chrono::steady_clock::now();
+		if (fds[0].revents & POLLIN) {
+			char buffer[64];
+			while (::read(wake_up_fds[0], buffer, sizeof(buffer)) > 0)
+				;
+		}
+		for (size_t i = 1; i != fds.size(); ++i) {
+			if (fds[i].revents == 0)
+				continue;
+			auto probe = std::find_if(active.begin(), active.end(), [&fds, i](const std::unique_ptr<Probe> &probe) {return probe->fd == fds[i].fd;});
+			if (probe == active.end())
+				continue;
+			if ((*probe)->state == Probe::State::connecting) {
+				int error = 0;
+				socklen_t error_size = sizeof(error);
+				if (getsockopt((*probe)->fd, SOL_SOCKET, SO_ERROR, &error, &error_size) == -1)
+					error = errno;
+				if (error != 0)
+					(*probe)->fail_attempt(std::strerror(error), now, interval);
+				else
+					(*probe)->state = Probe::State::reading;
+			} else {
+				(*probe)->read(now, interval);
+			}
+		}
+		// Finish answered probes and those out of time.
+		for (auto it = active.begin(); it != active.end();) {
+			auto &probe = *it;
+			if (probe->state == Probe::State::answered) {
+				finish_probe(probe->callback, nullptr);
+			} else if (now >= probe->deadline) {
+				auto error = "Timeout while trying to reach domain with SSH." + (probe->last_error.empty() ? "" : " Last error: " + probe->last_error);
+				finish_probe(probe->callback, std::make_exception_ptr(std::runtime_error(error)));
+			} else {
+				++it;
+				continue;
+			}
+			it = active.erase(it);
+		}
+	}
+	std::lock_guard<std::mutex> lock(waiting_mutex);
+	for (auto &probe : active)
+		finish_probe(probe->callback, std::make_exception_ptr(std::runtime_error("Probing of domain stopped.")));
+	for (auto &probe : waiting)
+		finish_probe(probe->callback, std::make_exception_ptr(std::runtime_error("Probing of domain stopped.")));
+	waiting.clear();
+}
@@ -0,0 +1,140 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef START_PIPELINE_HPP
+#define START_PIPELINE_HPP
+
+#include "thread_pool.hpp"
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
+#include <utility>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <chrono>
+
+/**
+ * \brief Concurrency of the stages of starting domains.
+ */
+struct Start_pipeline_limits
+{
+	// Number of domains defined in parallel (including setting memory and vCPUs).
+	unsigned int define_workers = 4;
+	// Number of domains created in parallel.
+	unsigned int create_workers = 4;
+	// Number of domains devices are attached to in parallel.
+	unsigned int attach_workers = 2;
+	// Number of domains waiting for the workers of each stage, further domains wait until a worker took one.
+	unsigned int queue_size = 64;
+	// Number of domains probed in parallel, further domains wait until a probe finished.
+	unsigned int max_probes = 256;
+	// Time between two connection attempts to a domain in milliseconds.
+	unsigned int probe_interval = 1000;
+};
+
+class Boot_prober;
+
+/**
+ * \brief Runs the starts of domains as a pipeline of stages with a bounded concurrency each.
+ *
+ * Each stage has a fixed number of workers, so a batch of starts does not issue all libvirt calls at once,
+ * while the domains of a batch are in different stages at the same time.
+ * After the last stage the domain is probed until its SSH server answers.
+ * All probes are multiplexed by a single thread, so booting domains do not occupy workers.
+ */
+class Start_pipeline
+{
+public:
+	enum class Stage
+	{
+		define,
+		create,
+		attach
+	};
+	using Step = std::pair<Stage, std::function<void()>>;
+	/**
+	 * \brief Called with the exception of the failed step or probe or nullptr if the domain is started.
+	 */
+	using Callback = std::function<void(std::exception_ptr)>;
+
+	explicit Start_pipeline(Start_pipeline_limits limits);
+	/**
+	 * \brief Waits for all queued and running steps. Pending probes fail.
+	 */
+	~Start_pipeline();
+	Start_pipeline(const Start_pipeline &) = delete;
+	Start_pipeline & operator=(const Start_pipeline &) = delete;
+
+	/**
+	 * \brief Run the steps of one domain in order, each by the workers of its stage, and probe the domain afterwards.
+	 *
+	 * Returns as soon as the first stage queued the domain, the callback is called from a worker or the probing thread.
+	 * A domain is handed on to a later stage as soon as there is space in its queue, so a slow stage holds back the earlier ones.
+	 * \param get_probe_host Called after the last step. Returns the host to probe or an empty string to skip probing.
+	 * \param probe_timeout Time until a domain which does not answer is considered failed.
+	 */
+	void run(std::vector<Step> steps, std::function<std::string()> get_probe_host, std::chrono::seconds probe_timeout, Callback callback);
+private:
+	struct Start;
+
+	void advance(std::shared_ptr<Start> start);
+	Thread_pool & get_workers(Stage stage);
+
+	// The prober is destructed last, since the stages finish their starts by adding probes.
+	std::unique_ptr<Boot_prober> prober;
+	// Later stages are destructed after earlier ones, which hand their starts on to them.
+	Thread_pool attach_workers;
+	Thread_pool create_workers;
+	Thread_pool define_workers;
+};
+
+/**
+ * \brief Probes domains until their SSH server answers, multiplexing all connection attempts in a single thread.
+ *
+ * A domain counts as booted as soon as its SSH server sends its identification string.
+ * Host names are resolved by a few resolver threads, since getaddrinfo() blocks.
+ * Each attempt tries all addresses of the host in turn.
+ */
+class Boot_prober
+{
+public:
+	Boot_prober(unsigned int max_probes, std::chrono::milliseconds interval);
+	/**
+	 * \brief Stops probing. Pending probes fail.
+	 */
+	~Boot_prober();
+	Boot_prober(const Boot_prober &) = delete;
+	Boot_prober & operator=(const Boot_prober &) = delete;
+
+	/**
+	 * \brief Probe a host until it answers or the timeout expired. The timeout starts when probing starts.
+	 */
+	void add(std::string host, std::chrono::seconds timeout, Start_pipeline::Callback callback);
+private:
+	struct Probe;
+
+	void probe();
+	void resolve(Probe &probe);
+	void wake_up();
+
+	const unsigned int max_probes;
+	const std::chrono::milliseconds interval;
+	std::deque<std::unique_ptr<Probe>> waiting;
+	bool stopping;
+	std::mutex waiting_mutex;
+	// Written to wake up the probing thread waiting in poll().
+	int wake_up_fds[2];
+	Thread_pool resolvers;
+	std::thread probing_thread;
+};
+
+#endif
@@ -19,38 +19,16 @@
 #include <iostream>
 #include <array>
 #include <regex>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <memory>
 
 FASTLIB_LOG_INIT(migfra_task_log, "Task")
 FASTLIB_LOG_SET_LEVEL_GLOBAL(migfra_task_log, trace);
 
 using namespace fast::msg::migfra;
 
-Thread_counter::Thread_counter()
-{
-	std::unique_lock<std::mutex> lock(count_mutex);
-	++count;
-}
-
-Thread_counter::~Thread_counter()
-{
-	std::unique_lock<std::mutex> lock(count_mutex);
-	if (--count == 0)
-		count_cv.notify_one();
-}
-
-void Thread_counter::wait_for_threads_to_finish()
-{
-	FASTLIB_LOG(migfra_task_log, trace) << "Waiting for threads to finish...";
-	std::unique_lock<std::mutex> lock(count_mutex);
-	while (count != 0)
-		count_cv.wait(lock);
-	FASTLIB_LOG(migfra_task_log, trace) << "All threads are finished.";
-}
-
-unsigned int Thread_counter::count;
-std::mutex Thread_counter::count_mutex;
-std::condition_variable Thread_counter::count_cv;
-
 void send_parse_error(std::shared_ptr<fast::Communicator> comm, const std::string &msg, const std::string &id)
 {
 	FASTLIB_LOG(migfra_task_log, warn) << msg;
@@ -71,79 +49,254 @@ void send_quit_result(std::shared_ptr<fast::Communicator> comm, const std::strin
 	comm->send_message(Result_container("quit", {Result("n/a", "success")}, id).to_string());
 }
 
-std::future<Result> execute(std::shared_ptr<Task> task, 
-		std::shared_ptr<Hypervisor> hypervisor, 
-		std::shared_ptr<fast::Communicator> comm)
+/**
+ * \brief Shared state of the tasks of one Task_container.
+ *
+ * Collects the results of the tasks in their original order.
+ * The worker finishing the last task sends the Result_container.
+ * If results are streamed, each result is additionally sent as soon as its task finished.
+ */
+struct Task_batch
 {
-	auto func = [task, hypervisor, comm]
+	Task_batch(std::string result_type, std::string id, size_t task_count, bool stream_results, std::shared_ptr<fast::Communicator> comm) :
+		result_type(std::move(result_type)),
+		id(std::move(id)),
+		results(task_count, Result("unknown", "error", "Task was not executed.")),
+		remaining(task_count),
+		stream_results(stream_results),
+		sequence_number(0),
+		comm(std::move(comm))
+	{
+	}
+
+	void finish_task(size_t index, Result result)
+	{
+		if (stream_results)
+			send_streamed_result(result);
+		results[index] = std::move(result);
+		if (--remaining != 0)
+			return;
+		try {
+			comm->send_message(Result_container(result_type, results, id).to_string());
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(migfra_task_log, warn) << "Exception while sending result: " << e.what();
+		}
+		sent.set_value();
+	}
+
+	// Sends a single result tagged with its sequence number in order of completion.
+	void send_streamed_result(const Result &result)
 	{
-		Time_measurement time_measurement(task->time_measurement.get_or(false));
-		std::string vm_name;
-		auto start_task = std::dynamic_pointer_cast<Start>(task);
-		auto stop_task = std::dynamic_pointer_cast<Stop>(task);
-		auto migrate_task = std::dynamic_pointer_cast<Migrate>(task);
-		auto evacuate_task = std::dynamic_pointer_cast<Evacuate>(task);
-		auto repin_task = std::dynamic_pointer_cast<Repin>(task);
-		auto suspend_task = std::dynamic_pointer_cast<Suspend>(task);
-		auto resume_task = std::dynamic_pointer_cast<Resume>(task);
 		try {
-			time_measurement.tick("overall");
-			if (start_task) {
-				if (start_task->vm_name.is_valid())
-					vm_name = start_task->vm_name.get();
-				else if (start_task->xml.is_valid()) {
-					std::regex regex(R"(<name>(.+)</name>)");
-					auto xml = start_task->xml.get();
-					std::smatch match;
-					auto found = std::regex_search(xml, match, regex);
-					if (found && match.size() == 2) {
-						vm_name = match[1].str();
-						start_task->vm_name = vm_name;
-					} else {
-						vm_name = xml;
-						throw std::runtime_error("Could not find vm-name in xml.");
-					}
+			auto node = Result_container(result_type, {result}, id).emit();
+			node["task-count"] = results.size();
+			// Numbering and sending under one lock, so results are sent in order of their sequence numbers.
+			std::lock_guard<std::mutex> lock(stream_mutex);
+			node["sequence-number"] = ++sequence_number;
+			comm->send_message(YAML::Dump(node));
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(migfra_task_log, warn) << "Exception while sending streamed result: " << e.what();
+		}
+	}
+
+	const std::string result_type;
+	const std::string id;
+	std::vector<Result> results;
+	std::atomic<size_t> remaining;
+	const bool stream_results;
+	size_t sequence_number;
+	std::mutex stream_mutex;
+	std::shared_ptr<fast::Communicator> comm;
+	std::promise<void> sent;
+};
+
+/**
+ * \brief Get the vm-name of a start task. If not set, it is taken from the xml and set in the task.
+ *
+ * \param vm_name Set to the name or to the xml if it does not contain a name.
+ */
+void find_vm_name(Start &start_task, std::string &vm_name)
+{
+	if (start_task.vm_name.is_valid())
+		vm_name = start_task.vm_name.get();
+	else if (start_task.xml.is_valid()) {
+		std::regex regex(R"(<name>(.+)</name>)");
+		auto xml = start_task.xml.get();
+		std::smatch match;
+		auto found = std::regex_search(xml, match, regex);
+		if (found && match.size() == 2) {
+			vm_name = match[1].str();
+			start_task.vm_name = vm_name;
+		} else {
+			vm_name = xml;
+			throw std::runtime_error("Could not find vm-name in xml.");
+		}
+	}
+}
+
+/**
+ * \brief Start a domain without waiting for it to boot and pass the result to done once it finished.
+ */
+void execute_start_async(std::shared_ptr<Start> start_task, std::shared_ptr<Hypervisor> hypervisor, std::function<void(Result)> done)
+{
+	auto time_measurement = std::make_shared<Time_measurement>(start_task->time_measurement.get_or(false));
+	std::string vm_name;
+	try {
+		time_measurement->tick("overall");
+		find_vm_name(*start_task, vm_name);
+		hypervisor->start_async(start_task, time_measurement, [vm_name, time_measurement, done](std::exception_ptr error)
+		{
+			if (error) {
+				try {
+					std::rethrow_exception(error);
+				} catch (const std::exception &e) {
+					FASTLIB_LOG(migfra_task_log, warn) << "Exception in task: " << e.what();
+					done(Result(vm_name, "error", *time_measurement, e.what()));
 				}
-				hypervisor->start(*start_task, time_measurement);
-			} else if (stop_task) {
-				if (stop_task->vm_name)
-					vm_name = *stop_task->vm_name;
-				else if (stop_task->regex)
-					vm_name = *stop_task->regex;
-				else
-					throw std::runtime_error("Neither vm-name or regex is defined in stop task.");
-				hypervisor->stop(*stop_task, time_measurement);
-			} else if (migrate_task) {
-				vm_name = migrate_task->vm_name;
-				hypervisor->migrate(*migrate_task, time_measurement, comm);
-			} else if (evacuate_task) {
-				if (task->concurrent_execution.get_or(true))
-					FASTLIB_LOG(migfra_task_log, warn) << "Concurrent execution might result in uneven distribution of domains.";
-				vm_name = evacuate_task->vm_name.get();
-				hypervisor->evacuate(*evacuate_task, time_measurement, comm);
-			} else if (repin_task) {
-				vm_name = repin_task->vm_name;
-				hypervisor->repin(*repin_task, time_measurement);
-			} else if (suspend_task) {
-				vm_name = suspend_task->vm_name;
-				hypervisor->suspend(*suspend_task, time_measurement);
-			} else if (resume_task) {
-				vm_name = resume_task->vm_name;
-				hypervisor->resume(*resume_task, time_measurement);
+				return;
 			}
-		} catch (const std::exception &e) {
-			FASTLIB_LOG(migfra_task_log, warn) << "Exception in task: " << e.what();
-			return Result(vm_name, "error", time_measurement, e.what());
+			time_measurement->tock("overall");
+			done(Result(vm_name, "success", *time_measurement, ""));
+		});
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(migfra_task_log, warn) << "Exception in task: " << e.what();
+		done(Result(vm_name, "error", *time_measurement, e.what()));
+	}
+}
+
+/**
+ * \brief Execute a task and return its result.
+ *
+ * \param admitted Execute_later is passed on to the caller if the task was admitted, else it is reported as error.
+ */
+Result execute(std::shared_ptr<Task> task,
+		const Task_options &task_options,
+		std::shared_ptr<Hypervisor> hypervisor,
+		std::shared_ptr<fast::Communicator> comm,
+		bool admitted)
+{
+	Time_measurement time_measurement(task->time_measurement.get_or(false));
+	Result_details details;
+	std::string vm_name;
+	auto start_task = std::dynamic_pointer_cast<Start>(task);
+	auto stop_task = std::dynamic_pointer_cast<Stop>(task);
+	auto migrate_task = std::dynamic_pointer_cast<Migrate>(task);
+	auto evacuate_task = std::dynamic_pointer_cast<Evacuate>(task);
+	auto repin_task = std::dynamic_pointer_cast<Repin>(task);
+	auto suspend_task = std::dynamic_pointer_cast<Suspend>(task);
+	auto resume_task = std::dynamic_pointer_cast<Resume>(task);
+	try {
+		time_measurement.tick("overall");
+		if (start_task) {
+			find_vm_name(*start_task, vm_name);
+			hypervisor->start(*start_task, time_measurement);
+		} else if (stop_task) {
+			if (stop_task->vm_name)
+				vm_name = *stop_task->vm_name;
+			else if (stop_task->regex)
+				vm_name = *stop_task->regex;
+			else
+				throw std::runtime_error("Neither vm-name or regex is defined in stop task.");
+			hypervisor->stop(*stop_task, time_measurement);
+		} else if (migrate_task) {
+			vm_name = migrate_task->vm_name;
+			hypervisor->migrate(*migrate_task, task_options.migration, time_measurement, details, comm);
+		} else if (evacuate_task) {
+			if (task->concurrent_execution.get_or(true))
+				FASTLIB_LOG(migfra_task_log, warn) << "Concurrent execution might result in uneven distribution of domains.";
+			vm_name = evacuate_task->vm_name.get();
+			hypervisor->evacuate(*evacuate_task, task_options.migration, time_measurement, details, comm);
+		} else if (repin_task) {
+			vm_name = repin_task->vm_name;
+			hypervisor->repin(*repin_task, time_measurement);
+		} else if (suspend_task) {
+			vm_name = suspend_task->vm_name;
+			hypervisor->suspend(*suspend_task, time_measurement);
+		} else if (resume_task) {
+			vm_name = resume_task->vm_name;
+			hypervisor->resume(*resume_task, time_measurement);
+		}
+	} catch (const std::exception &e) {
+		// A task which was not admitted would be executed later over and over again.
+		if (admitted && dynamic_cast<const Execute_later *>(&e))
+			throw;
+		FASTLIB_LOG(migfra_task_log, warn) << "Exception in task: " << e.what();
+		// Details set before the failure (e.g., retries) are appended to the error.
+		auto error = details.empty() ? std::string(e.what()) : std::string(e.what()) + " " + details.str();
+		return Result(vm_name, "error", time_measurement, error);
+	}
+	time_measurement.tock("overall");
+	return Result(vm_name, "success", time_measurement, details.str());
+}
+
+/**
+ * \brief Wait for the admission of a task without blocking the worker and execute it in a job of its own once admitted.
+ *
+ * Start tasks only hand the domain over to the start pipeline of the hypervisor, so their job does not wait for the boot.
+ */
+void admit_and_execute(std::shared_ptr<Task> task, const Task_options &task_options, std::shared_ptr<Hypervisor> hypervisor, std::shared_ptr<fast::Communicator> comm, std::shared_ptr<Thread_pool> thread_pool, std::function<void(Result)> done)
+{
+	auto execute_admitted = [task, task_options, hypervisor, comm, thread_pool, done](std::shared_ptr<void> reservation, bool admitted)
+	{
+		auto start_task = std::dynamic_pointer_cast<Start>(task);
+		if (start_task) {
+			// Counts as running job until the domain is started, so waiting for the pool also waits for the start pipeline.
+			auto hold = thread_pool->hold();
+			execute_start_async(start_task, hypervisor, [done, hold](Result result) mutable
+			{
+				done(std::move(result));
+				hold.reset();
+			});
+			return;
+		}
+		try {
+			done(execute(task, task_options, hypervisor, comm, admitted));
+		} catch (const Execute_later &later) {
+			FASTLIB_LOG(migfra_task_log, debug) << later.what() << " Admit again in " << later.delay.count() << " ms.";
+			// Resources left are released before the task is admitted again.
+			reservation.reset();
+			thread_pool->resubmit_after(later.delay, [task, task_options, hypervisor, comm, thread_pool, done]
+			{
+				admit_and_execute(task, task_options, hypervisor, comm, thread_pool, done);
+			});
 		}
-		time_measurement.tock("overall");
-		return Result(vm_name, "success", time_measurement);
 	};
-	bool concurrent_execution = task->concurrent_execution.get_or(true);
-	return std::async(concurrent_execution ? std::launch::async : std::launch::deferred, func);
+	try {
+		// Counts as running job while the task waits for admission.
+		auto hold = thread_pool->hold();
+		hypervisor->admit(task, [thread_pool, execute_admitted, hold](std::shared_ptr<void> reservation)
+		{
+			// The job passes on its reference, so the reservation is released as soon as the task is done with it.
+			thread_pool->resubmit([execute_admitted, reservation]() mutable {execute_admitted(std::move(reservation), true);});
+		});
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(migfra_task_log, warn) << "Exception while admitting task: " << e.what() << " Execute without admission.";
+		execute_admitted(nullptr, false);
+	}
 }
 
+/**
+ * \brief Execute tasks one after another, each admitted before it is executed.
+ *
+ * The next task is admitted in a job of its own, since a task may finish in a thread outside the pool (e.g., a booted domain).
+ */
+void execute_in_order(std::shared_ptr<Task_batch> batch, std::shared_ptr<const std::vector<std::pair<size_t, std::shared_ptr<Task>>>> tasks, size_t position, const Task_options &task_options, std::shared_ptr<Hypervisor> hypervisor, std::shared_ptr<fast::Communicator> comm, std::shared_ptr<Thread_pool> thread_pool)
+{
+	if (position == tasks->size())
+		return;
+	auto index = (*tasks)[position].first;
+	admit_and_execute((*tasks)[position].second, task_options, hypervisor, comm, thread_pool,
+			[batch, tasks, position, index, task_options, hypervisor, comm, thread_pool](Result result)
+			{
+				batch->finish_task(index, std::move(result));
+				thread_pool->resubmit([batch, tasks, position, task_options, hypervisor, comm, thread_pool]
+				{
+					execute_in_order(batch, tasks, position + 1, task_options, hypervisor, comm, thread_pool);
+				});
+			});
+}
 
-void execute(const Task_container &task_cont, std::shared_ptr<Hypervisor> hypervisor, std::shared_ptr<fast::Communicator> comm)
+void execute(const Task_container &task_cont, const Task_options &task_options, std::shared_ptr<Hypervisor> hypervisor, std::shared_ptr<fast::Communicator> comm, std::shared_ptr<Thread_pool> thread_pool)
 {
 	auto &id = task_cont.id.get_or("");
 	if (task_cont.tasks.empty()) {
@@ -157,17 +310,37 @@ void execute(const Task_container &task_cont, std::shared_ptr<Hypervisor> hyperv
 	}
 	// If Evacuate task -> get one task for every local domain
 	auto &tasks = result_type == "node evacuated" ? hypervisor->get_evacuate_tasks(task_cont) : task_cont.tasks;
-	auto func = [hypervisor, comm, tasks, result_type, id]
-	{
-		std::vector<std::future<Result>> future_results;
-		for (auto &task : tasks) // start subtasks
-			future_results.push_back(execute(task, hypervisor, comm));
-		std::vector<Result> results;
-		for (auto &future_result : future_results) // wait for tasks to finish
-			results.push_back(future_result.get());
-		comm->send_message(Result_container(result_type, results, id).to_string());
-	};
-	bool concurrent_execution = task_cont.concurrent_execution.get_or(true);
-	concurrent_execution ? std::thread([func] {Thread_counter cnt; func();}).detach() : func();
+	if (tasks.empty()) {
+		comm->send_message(Result_container(result_type, {}, id).to_string());
+		return;
+	}
+	auto batch = std::make_shared<Task_batch>(result_type, id, tasks.size(), task_options.stream_results, comm);
+	// Concurrent tasks get a job each, all other tasks are executed one after another starting from a single job.
+	// The jobs only request the admission of their task, which is executed in a resubmitted job once admitted.
+	std::vector<std::function<void()>> jobs;
+	auto sequential_tasks = std::make_shared<std::vector<std::pair<size_t, std::shared_ptr<Task>>>>();
+	for (size_t i = 0; i != tasks.size(); ++i) {
+		auto task = tasks[i];
+		if (task->concurrent_execution.get_or(true)) {
+			jobs.push_back([batch, i, task, task_options, hypervisor, comm, thread_pool]
+			{
+				admit_and_execute(task, task_options, hypervisor, comm, thread_pool, [batch, i](Result result) {batch->finish_task(i, std::move(result));});
+			});
+		} else {
+			sequential_tasks->emplace_back(i, task);
+		}
+	}
+	if (!sequential_tasks->empty()) {
+		std::shared_ptr<const std::vector<std::pair<size_t, std::shared_ptr<Task>>>> ordered_tasks = std::move(sequential_tasks);
+		jobs.push_back([batch, ordered_tasks, task_options, hypervisor, comm, thread_pool]
+		{
+			execute_in_order(batch, ordered_tasks, 0, task_options, hypervisor, comm, thread_pool);
+		});
+	}
+	auto sent = batch->sent.get_future();
+	thread_pool->submit(std::move(jobs));
+	FASTLIB_LOG(migfra_task_log, trace) << "Submitted " << tasks.size() << " tasks, queue depth: " << thread_pool->queue_depth() << ".";
+	// Wait for the result to be sent if the container must not be executed concurrently.
+	if (!task_cont.concurrent_execution.get_or(true))
+		sent.wait();
 }
-
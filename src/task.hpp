@@ -10,6 +10,8 @@
 #define TASK_HPP
 
 #include "hypervisor.hpp"
+#include "thread_pool.hpp"
+#include "task_options.hpp"
 
 #include <fast-lib/communicator.hpp>
 #include <fast-lib/message/migfra/task.hpp>
@@ -17,49 +19,22 @@
 #include <string>
 #include <vector>
 #include <memory>
-#include <future>
-#include <mutex>
-#include <condition_variable>
-
-/**
- * \brief RAII-style thread counter.
- *
- * Each instance of Thread_counter represents a running thread.
- * The constructor increments and the destructor decrements the counter.
- * A condition variable is used to wait for the counter to become zero.
- * 
- * TODO: Move static member variables to seperate class to provide multiple thread counters.
- * TODO: Proper testing.
- */
-class Thread_counter
-{
-public:
-	/**
-	 * \brief Constructor increments counter.
-	 */
-	Thread_counter();
-
-	/**
-	 * \brief Destructor decrements counter.
-	 */
-	~Thread_counter();
-
-	/**
-	 * \brief Wait until count is zero using a condition variable.
-	 */
-	static void wait_for_threads_to_finish();
-private:
-	static unsigned int count;
-	static std::mutex count_mutex;
-	static std::condition_variable count_cv;
-};
 
 void send_parse_error(std::shared_ptr<fast::Communicator> comm, const std::string &msg, const std::string &id = "");
 
 void send_parse_error_nothrow(std::shared_ptr<fast::Communicator> comm, const std::string &msg, const std::string &id = "");
 
-void execute(const fast::msg::migfra::Task_container &task_cont, 
+/**
+ * \brief Execute the tasks of a Task_container using the workers of thread_pool.
+ *
+ * The Result_container is sent by the worker finishing the last task.
+ * If results are streamed, each Result is also sent on its own as soon as its task finished.
+ * If concurrent execution of the container is disabled, this function waits until the result is sent.
+ */
+void execute(const fast::msg::migfra::Task_container &task_cont,
+		const Task_options &task_options,
 		std::shared_ptr<Hypervisor> hypervisor, 
-		std::shared_ptr<fast::Communicator> comm);
+		std::shared_ptr<fast::Communicator> comm,
+		std::shared_ptr<Thread_pool> thread_pool);
 
 #endif
@@ -9,10 +9,13 @@
 #include "task_handler.hpp"
 
 #include "libvirt_hypervisor.hpp"
+#include "connection_pool.hpp"
+#include "capacity_prober.hpp"
 #include "dummy_hypervisor.hpp"
 #include "ponci_hypervisor.hpp"
 #include "task.hpp"
 #include "pscom_handler.hpp"
+#include "migration_monitor.hpp"
 #include "utility.hpp"
 
 #include <fast-lib/mqtt_communicator.hpp>
@@ -25,6 +28,8 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <thread>
+#include <algorithm>
 
 FASTLIB_LOG_INIT(migfra_task_handler_log, "Task_handler")
 FASTLIB_LOG_SET_LEVEL_GLOBAL(migfra_task_handler_log, trace);
@@ -49,7 +54,7 @@ Task_handler::Task_handler(const std::string &config_file) :
 
 Task_handler::~Task_handler()
 {
-	Thread_counter::wait_for_threads_to_finish();
+	thread_pool->wait_for_tasks_to_finish();
 }
 
 
@@ -59,9 +64,12 @@ void Task_handler::loop()
 		std::string msg;
 		try {
 			msg = comm->get_message();
+			auto node = YAML::Load(msg);
 			Task_container task_cont;
-			task_cont.from_string(msg);
-			execute(task_cont, hypervisor, comm);
+			task_cont.load(node);
+			Task_options task_options;
+			task_options.load(node);
+			execute(task_cont, task_options, hypervisor, comm, thread_pool);
 		} catch (const YAML::Exception &e) {
 			send_parse_error_nothrow(comm, std::string("Exception while parsing message: ") + e.what());
 			FASTLIB_LOG(migfra_task_handler_log, trace) << "msg dump: " << msg;
@@ -133,7 +141,108 @@ void Task_handler::load(const YAML::Node &node)
 			unsigned int default_stop_timeout = 60;
 			if (hypervisor_node["stop-timeout"])
 				default_stop_timeout = hypervisor_node["stop-timeout"].as<decltype(default_stop_timeout)>();
-			hypervisor = std::make_shared<Libvirt_hypervisor>(std::move(nodes), default_driver, default_transport, default_start_timeout, default_stop_timeout);
+			unsigned int max_connections_per_host = 4;
+			int keepalive_interval = 5;
+			unsigned int keepalive_count = 5;
+			if (hypervisor_node["connection-pool"]) {
+				auto pool_node = hypervisor_node["connection-pool"];
+				if (pool_node["max-connections-per-host"])
+					max_connections_per_host = pool_node["max-connections-per-host"].as<decltype(max_connections_per_host)>();
+				if (pool_node["keepalive-interval"])
+					keepalive_interval = pool_node["keepalive-interval"].as<decltype(keepalive_interval)>();
+				if (pool_node["keepalive-count"])
+					keepalive_count = pool_node["keepalive-count"].as<decltype(keepalive_count)>();
+			}
+			auto connection_pool = std::make_shared<Connection_pool>(max_connections_per_host, keepalive_interval, keepalive_count);
+			unsigned int probe_timeout = 5000;
+			unsigned int probe_cache_ttl = 10000;
+			unsigned int probe_workers = 8;
+			size_t probe_max_pending = 256;
+			if (hypervisor_node["capacity-probe"]) {
+				auto probe_node = hypervisor_node["capacity-probe"];
+				if (probe_node["timeout"])
+					probe_timeout = probe_node["timeout"].as<decltype(probe_timeout)>();
+				if (probe_node["cache-ttl"])
+					probe_cache_ttl = probe_node["cache-ttl"].as<decltype(probe_cache_ttl)>();
+				if (probe_node["workers"])
+					probe_workers = probe_node["workers"].as<decltype(probe_workers)>();
+				if (probe_node["max-pending"])
+					probe_max_pending = probe_node["max-pending"].as<decltype(probe_max_pending)>();
+			}
+			auto capacity_prober = std::make_shared<Capacity_prober>(connection_pool, std::chrono::milliseconds(probe_timeout), std::chrono::milliseconds(probe_cache_ttl), probe_workers, probe_max_pending);
+			Migration_limits migration_limits;
+			if (hypervisor_node["migration-limits"]) {
+				auto limits_node = hypervisor_node["migration-limits"];
+				if (limits_node["max-outgoing"])
+					migration_limits.max_outgoing = limits_node["max-outgoing"].as<decltype(migration_limits.max_outgoing)>();
+				if (limits_node["max-incoming"])
+					migration_limits.max_incoming = limits_node["max-incoming"].as<decltype(migration_limits.max_incoming)>();
+				if (limits_node["max-bytes-in-flight"])
+					migration_limits.max_bytes_in_flight = limits_node["max-bytes-in-flight"].as<decltype(migration_limits.max_bytes_in_flight)>();
+			}
+			Aimd_policy aimd_policy;
+			if (hypervisor_node["evacuation-concurrency"]) {
+				auto policy_node = hypervisor_node["evacuation-concurrency"];
+				if (policy_node["adaptive"])
+					aimd_policy.adaptive = policy_node["adaptive"].as<decltype(aimd_policy.adaptive)>();
+				if (policy_node["initial"])
+					aimd_policy.initial = policy_node["initial"].as<decltype(aimd_policy.initial)>();
+				if (policy_node["max"])
+					aimd_policy.max = policy_node["max"].as<decltype(aimd_policy.max)>();
+				if (policy_node["decrease-factor"])
+					aimd_policy.decrease_factor = policy_node["decrease-factor"].as<decltype(aimd_policy.decrease_factor)>();
+				if (policy_node["interval"])
+					aimd_policy.interval = policy_node["interval"].as<decltype(aimd_policy.interval)>();
+			}
+			Postcopy_policy postcopy_policy;
+			if (hypervisor_node["postcopy-policy"]) {
+				auto policy_node = hypervisor_node["postcopy-policy"];
+				if (policy_node["max-iterations"])
+					postcopy_policy.max_iterations = policy_node["max-iterations"].as<decltype(postcopy_policy.max_iterations)>();
+				if (policy_node["dirty-rate-exceeds-bandwidth"])
+					postcopy_policy.dirty_rate_exceeds_bandwidth = policy_node["dirty-rate-exceeds-bandwidth"].as<decltype(postcopy_policy.dirty_rate_exceeds_bandwidth)>();
+				if (policy_node["time-budget"])
+					postcopy_policy.time_budget = policy_node["time-budget"].as<decltype(postcopy_policy.time_budget)>();
+			}
+			Retry_policy retry_policy;
+			if (hypervisor_node["retry-policy"]) {
+				auto policy_node = hypervisor_node["retry-policy"];
+				if (policy_node["initial-backoff"])
+					retry_policy.initial_backoff = policy_node["initial-backoff"].as<decltype(retry_policy.initial_backoff)>();
+				if (policy_node["backoff-multiplier"])
+					retry_policy.backoff_multiplier = policy_node["backoff-multiplier"].as<decltype(retry_policy.backoff_multiplier)>();
+				if (policy_node["max-backoff"])
+					retry_policy.max_backoff = policy_node["max-backoff"].as<decltype(retry_policy.max_backoff)>();
+			}
+			Shmem_transfer_config shmem_transfer_config;
+			if (hypervisor_node["shmem-transfer"]) {
+				auto transfer_node = hypervisor_node["shmem-transfer"];
+				if (transfer_node["port"])
+					shmem_transfer_config.port = transfer_node["port"].as<decltype(shmem_transfer_config.port)>();
+				if (transfer_node["chunk-size"])
+					shmem_transfer_config.chunk_size = transfer_node["chunk-size"].as<decltype(shmem_transfer_config.chunk_size)>();
+				if (transfer_node["timeout"])
+					shmem_transfer_config.timeout = transfer_node["timeout"].as<decltype(shmem_transfer_config.timeout)>();
+				if (transfer_node["max-connections"])
+					shmem_transfer_config.max_connections = transfer_node["max-connections"].as<decltype(shmem_transfer_config.max_connections)>();
+			}
+			Start_pipeline_limits start_pipeline_limits;
+			if (hypervisor_node["start-pipeline"]) {
+				auto pipeline_node = hypervisor_node["start-pipeline"];
+				if (pipeline_node["define-workers"])
+					start_pipeline_limits.define_workers = pipeline_node["define-workers"].as<decltype(start_pipeline_limits.define_workers)>();
+				if (pipeline_node["create-workers"])
+					start_pipeline_limits.create_workers = pipeline_node["create-workers"].as<decltype(start_pipeline_limits.create_workers)>();
+				if (pipeline_node["attach-workers"])
+					start_pipeline_limits.attach_workers = pipeline_node["attach-workers"].as<decltype(start_pipeline_limits.attach_workers)>();
+				if (pipeline_node["queue-size"])
+					start_pipeline_limits.queue_size = pipeline_node["queue-size"].as<decltype(start_pipeline_limits.queue_size)>();
+				if (pipeline_node["max-probes"])
+					start_pipeline_limits.max_probes = pipeline_node["max-probes"].as<decltype(start_pipeline_limits.max_probes)>();
+				if (pipeline_node["probe-interval"])
+					start_pipeline_limits.probe_interval = pipeline_node["probe-interval"].as<decltype(start_pipeline_limits.probe_interval)>();
+			}
+			hypervisor = std::make_shared<Libvirt_hypervisor>(std::move(nodes), default_driver, default_transport, default_start_timeout, default_stop_timeout, connection_pool, capacity_prober, migration_limits, aimd_policy, postcopy_policy, retry_policy, shmem_transfer_config, start_pipeline_limits);
 		} else if (type == "ponci") {
 			hypervisor = std::make_shared<Ponci_hypervisor>();
 		} else if (type == "dummy") {
@@ -144,6 +253,21 @@ void Task_handler::load(const YAML::Node &node)
 			throw std::invalid_argument("Unknown communcation type in configuration found");
 		}
 	}
+	{
+		unsigned int workers = std::max(std::thread::hardware_concurrency(), 4u);
+		size_t queue_size = 1024;
+		auto overflow_policy = Thread_pool::Overflow_policy::block;
+		if (node["thread-pool"]) {
+			auto thread_pool_node = node["thread-pool"];
+			if (thread_pool_node["workers"])
+				workers = thread_pool_node["workers"].as<decltype(workers)>();
+			if (thread_pool_node["queue-size"])
+				queue_size = thread_pool_node["queue-size"].as<decltype(queue_size)>();
+			if (thread_pool_node["overflow-policy"])
+				overflow_policy = overflow_policy_from_string(thread_pool_node["overflow-policy"].as<std::string>());
+		}
+		thread_pool = std::make_shared<Thread_pool>(workers, queue_size, overflow_policy);
+	}
 	if (node["pscom-handler"]) {
 		auto pscom_node = node["pscom-handler"];
 		if (pscom_node["request-topic"])
@@ -153,5 +277,14 @@ void Task_handler::load(const YAML::Node &node)
 		if (pscom_node["qos"])
 			Pscom_handler::set_qos(pscom_node["qos"].as<int>());
 	}
+	if (node["migration-monitor"]) {
+		auto monitor_node = node["migration-monitor"];
+		if (monitor_node["interval"])
+			Migration_monitor::set_interval(std::chrono::milliseconds(monitor_node["interval"].as<unsigned int>()));
+		if (monitor_node["topic"])
+			Migration_monitor::set_topic_template(monitor_node["topic"].as<std::string>());
+		if (monitor_node["qos"])
+			Migration_monitor::set_qos(monitor_node["qos"].as<int>());
+	}
 }
 
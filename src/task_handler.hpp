@@ -10,6 +10,7 @@
 #define TASK_HANDLER_HPP
 
 #include "hypervisor.hpp"
+#include "thread_pool.hpp"
 
 #include <fast-lib/communicator.hpp>
 #include <fast-lib/serializable.hpp>
@@ -39,7 +40,7 @@ public:
 	/**
 	 * \brief Destruct Task_handler.
 	 *
-	 * The destructor waits for all threads to finish.
+	 * The destructor waits for all tasks in the thread pool to finish.
 	 */
 	~Task_handler();
 	/**
@@ -60,12 +61,13 @@ public:
 	 * \brief Loads Task_handler from YAML::Node.
 	 *
 	 * Implements fast::Serializable::load().
-	 * Creates the Communicator and Hypervisor from YAML.
+	 * Creates the Communicator, Hypervisor and Thread_pool from YAML.
 	 */
 	void load(const YAML::Node &node) override;
 private:
 	std::shared_ptr<fast::Communicator> comm;
 	std::shared_ptr<Hypervisor> hypervisor;
+	std::shared_ptr<Thread_pool> thread_pool;
 	bool running;
 };
 
@@ -0,0 +1,91 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "task_options.hpp"
+
+#include <stdexcept>
+
+YAML::Node Compression_options::emit() const
+{
+	YAML::Node node;
+	node["methods"] = methods;
+	if (xbzrle_cache != 0)
+		node["xbzrle-cache"] = xbzrle_cache;
+	if (mt_level != -1)
+		node["mt-level"] = mt_level;
+	if (mt_threads != 0)
+		node["mt-threads"] = mt_threads;
+	if (mt_dthreads != 0)
+		node["mt-dthreads"] = mt_dthreads;
+	return node;
+}
+
+void Compression_options::load(const YAML::Node &node)
+{
+	if (node["methods"])
+		methods = node["methods"].as<decltype(methods)>();
+	for (const auto &method : methods) {
+		if (method != "xbzrle" && method != "mt")
+			throw std::invalid_argument("Unknown compression method: " + method);
+	}
+	if (node["xbzrle-cache"])
+		xbzrle_cache = node["xbzrle-cache"].as<decltype(xbzrle_cache)>();
+	if (node["mt-level"])
+		mt_level = node["mt-level"].as<decltype(mt_level)>();
+	if (node["mt-threads"])
+		mt_threads = node["mt-threads"].as<decltype(mt_threads)>();
+	if (node["mt-dthreads"])
+		mt_dthreads = node["mt-dthreads"].as<decltype(mt_dthreads)>();
+}
+
+std::string Compression_options::str() const
+{
+	std::string str;
+	for (const auto &method : methods)
+		str += (str.empty() ? "" : "+") + method;
+	return str;
+}
+
+YAML::Node Migration_options::emit() const
+{
+	YAML::Node node;
+	node["retry-counter"] = retry_counter;
+	node["parallel-connections"] = parallel_connections;
+	if (!compression.methods.empty())
+		node["compression"] = compression.emit();
+	node["transfer-ivshmem"] = transfer_ivshmem;
+	return node;
+}
+
+void Migration_options::load(const YAML::Node &node)
+{
+	if (node["retry-counter"])
+		retry_counter = node["retry-counter"].as<decltype(retry_counter)>();
+	if (node["parallel-connections"])
+		parallel_connections = node["parallel-connections"].as<decltype(parallel_connections)>();
+	if (node["compression"])
+		compression.load(node["compression"]);
+	if (node["transfer-ivshmem"])
+		transfer_ivshmem = node["transfer-ivshmem"].as<decltype(transfer_ivshmem)>();
+}
+
+YAML::Node Task_options::emit() const
+{
+	YAML::Node node;
+	node["stream-results"] = stream_results;
+	node["parameter"] = migration.emit();
+	return node;
+}
+
+void Task_options::load(const YAML::Node &node)
+{
+	if (node["stream-results"])
+		stream_results = node["stream-results"].as<decltype(stream_results)>();
+	if (node["parameter"])
+		migration.load(node["parameter"]);
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef TASK_OPTIONS_HPP
+#define TASK_OPTIONS_HPP
+
+#include <fast-lib/serializable.hpp>
+
+#include <string>
+#include <vector>
+
+/**
+ * \brief Compression of the memory transferred by a migration.
+ *
+ * Loaded from the "compression" map in the parameters of a task.
+ * Unset values keep the defaults of the hypervisor.
+ */
+struct Compression_options :
+	public fast::Serializable
+{
+	YAML::Node emit() const override;
+	void load(const YAML::Node &node) override;
+	/**
+	 * \brief Get a short name of the compression methods (e.g., "xbzrle+mt") used in time measurement tags.
+	 */
+	std::string str() const;
+
+	// Compression methods ("xbzrle" and/or "mt"), compression is disabled if empty.
+	std::vector<std::string> methods;
+	// Size of the page cache for xbzrle compression in bytes.
+	unsigned long long xbzrle_cache = 0;
+	// Level of mt compression (0-9).
+	int mt_level = -1;
+	// Number of compression threads of mt compression.
+	int mt_threads = 0;
+	// Number of decompression threads of mt compression.
+	int mt_dthreads = 0;
+};
+
+/**
+ * \brief Migration options of migrate and evacuate tasks which are not covered by the fast-lib message types.
+ *
+ * Loaded from the "parameter" map of the task.
+ * Evacuate tasks pass their options unchanged to the resulting migrations.
+ */
+struct Migration_options :
+	public fast::Serializable
+{
+	YAML::Node emit() const override;
+	void load(const YAML::Node &node) override;
+
+	// Maximum number of retries of a failed migration.
+	unsigned int retry_counter = 0;
+	// Number of parallel connections used to transfer memory (0 disables parallel migration).
+	unsigned int parallel_connections = 0;
+	Compression_options compression;
+	// Transfer the contents of the shared memory regions of ivshmem devices to the destination.
+	bool transfer_ivshmem = false;
+};
+
+/**
+ * \brief Options of a task message which are not covered by the fast-lib message types.
+ *
+ * Loaded from the same YAML message as the Task_container.
+ */
+struct Task_options :
+	public fast::Serializable
+{
+	YAML::Node emit() const override;
+	void load(const YAML::Node &node) override;
+
+	// Publish every result as soon as its task finished.
+	bool stream_results = false;
+	Migration_options migration;
+};
+
+#endif
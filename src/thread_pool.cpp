@@ -0,0 +1,186 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "thread_pool.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <utility>
+
+FASTLIB_LOG_INIT(thread_pool_log, "Thread_pool")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(thread_pool_log, trace);
+
+Thread_pool::Thread_pool(unsigned int worker_count, size_t max_queue_size, Overflow_policy overflow_policy) :
+	max_queue_size(std::max<size_t>(max_queue_size, 1)),
+	overflow_policy(overflow_policy),
+	active(0),
+	held(0),
+	stopping(false)
+{
+	worker_count = std::max(worker_count, 1u);
+	FASTLIB_LOG(thread_pool_log, trace) << "Start " << worker_count << " workers with a queue size of " << this->max_queue_size << ".";
+	workers.reserve(worker_count);
+	for (unsigned int i = 0; i != worker_count; ++i)
+		workers.emplace_back(&Thread_pool::work, this);
+}
+
+Thread_pool::~Thread_pool()
+{
+	wait_for_tasks_to_finish();
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	job_available_cv.notify_all();
+	delayed_cv.notify_all();
+	for (auto &worker : workers)
+		worker.join();
+	if (scheduler.joinable())
+		scheduler.join();
+}
+
+void Thread_pool::submit(std::vector<std::function<void()>> jobs)
+{
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	if (overflow_policy == Overflow_policy::reject && queue.size() + jobs.size() > max_queue_size)
+		throw std::runtime_error("Task queue is full (" + std::to_string(queue.size()) + " of "
+				+ std::to_string(max_queue_size) + " queued), " + std::to_string(jobs.size()) + " tasks rejected.");
+	for (auto &job : jobs) {
+		while (queue.size() >= max_queue_size)
+			space_available_cv.wait(lock);
+		queue.push_back(std::move(job));
+		job_available_cv.notify_one();
+	}
+	FASTLIB_LOG(thread_pool_log, trace) << "Queue depth: " << queue.size() << ", active: " << active << ".";
+}
+
+void Thread_pool::resubmit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		queue.push_back(std::move(job));
+	}
+	job_available_cv.notify_one();
+}
+
+void Thread_pool::resubmit_after(std::chrono::milliseconds delay, std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		delayed.emplace(std::chrono::steady_clock::now() + delay, std::move(job));
+		if (!scheduler.joinable())
+			scheduler = std::thread(&Thread_pool::schedule, this);
+	}
+	delayed_cv.notify_one();
+}
+
+std::shared_ptr<void> Thread_pool::hold()
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		++held;
+	}
+	// The deleter is called on destruction although no object is owned.
+	return std::shared_ptr<void>(nullptr, [this](void *)
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		--held;
+		if (is_idle())
+			idle_cv.notify_all();
+	});
+}
+
+void Thread_pool::wait_for_tasks_to_finish()
+{
+	FASTLIB_LOG(thread_pool_log, trace) << "Waiting for tasks to finish...";
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	while (!is_idle())
+		idle_cv.wait(lock);
+	FASTLIB_LOG(thread_pool_log, trace) << "All tasks are finished.";
+}
+
+size_t Thread_pool::queue_depth() const
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	return queue.size();
+}
+
+unsigned int Thread_pool::active_count() const
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	return active;
+}
+
+unsigned int Thread_pool::worker_count() const
+{
+	return workers.size();
+}
+
+void Thread_pool::work()
+{
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	while (true) {
+		while (queue.empty() && !stopping)
+			job_available_cv.wait(lock);
+		if (queue.empty())
+			return;
+		auto job = std::move(queue.front());
+		queue.pop_front();
+		++active;
+		space_available_cv.notify_one();
+		lock.unlock();
+		try {
+			job();
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(thread_pool_log, warn) << "Exception in worker: " << e.what();
+		} catch (...) {
+			FASTLIB_LOG(thread_pool_log, warn) << "Unknown exception in worker.";
+		}
+		job = nullptr;
+		lock.lock();
+		--active;
+		if (is_idle())
+			idle_cv.notify_all();
+	}
+}
+
+void Thread_pool::schedule()
+{
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	while (!stopping || !delayed.empty()) {
+		if (delayed.empty()) {
+			delayed_cv.wait(lock);
+			continue;
+		}
+		auto due_job_it = delayed.begin();
+		if (std::chrono::steady_clock::now() < due_job_it->first) {
+			delayed_cv.wait_until(lock, due_job_it->first);
+			continue;
+		}
+		queue.push_back(std::move(due_job_it->second));
+		delayed.erase(due_job_it);
+		job_available_cv.notify_one();
+	}
+}
+
+bool Thread_pool::is_idle() const
+{
+	return queue.empty() && delayed.empty() && active == 0 && held == 0;
+}
+
+Thread_pool::Overflow_policy overflow_policy_from_string(const std::string &str)
+{
+	if (str == "block")
+		return Thread_pool::Overflow_policy::block;
+	if (str == "reject")
+		return Thread_pool::Overflow_policy::reject;
+	throw std::invalid_argument("Unknown overflow policy \"" + str + "\" in configuration found.");
+}
@@ -0,0 +1,136 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <chrono>
+#include <cstddef>
+
+/**
+ * \brief A fixed number of worker threads executing jobs from a bounded queue.
+ *
+ * All tasks are executed by the workers of a Thread_pool, so the number of threads stays constant
+ * regardless of how many tasks are received at once.
+ * If the queue is full, the overflow policy decides whether the submitting thread blocks until
+ * there is enough space or the jobs are rejected.
+ * Exceptions thrown by a job are caught and logged by the worker.
+ */
+class Thread_pool
+{
+public:
+	/**
+	 * \brief Defines the behavior of submit() if the queue is full.
+	 */
+	enum class Overflow_policy
+	{
+		block,
+		reject
+	};
+
+	/**
+	 * \brief Construct a Thread_pool and start the workers.
+	 *
+	 * \param worker_count The number of worker threads (at least one).
+	 * \param max_queue_size The maximum number of jobs waiting for a worker (at least one).
+	 * \param overflow_policy The behavior of submit() if the queue is full.
+	 */
+	Thread_pool(unsigned int worker_count, size_t max_queue_size, Overflow_policy overflow_policy);
+	/**
+	 * \brief Destruct Thread_pool.
+	 *
+	 * Waits for all queued and running jobs to finish and joins the workers.
+	 */
+	~Thread_pool();
+	Thread_pool(const Thread_pool &) = delete;
+	Thread_pool & operator=(const Thread_pool &) = delete;
+	/**
+	 * \brief Enqueue jobs to be executed by the workers.
+	 *
+	 * With Overflow_policy::reject either all jobs are enqueued or none and an exception is thrown.
+	 * With Overflow_policy::block the calling thread waits for free space in the queue.
+	 * Must not be called from inside a job if Overflow_policy::block is used.
+	 */
+	void submit(std::vector<std::function<void()>> jobs);
+	/**
+	 * \brief Enqueue a job continuing a job which was accepted by submit() before.
+	 *
+	 * E.g., a job which waited for a resource outside the pool is continued once the resource is free.
+	 * The queue bound does not apply, so this never blocks or rejects and may be called from inside a job.
+	 */
+	void resubmit(std::function<void()> job);
+	/**
+	 * \brief Resubmit a job after a delay, e.g., to retry a failed job without occupying a worker meanwhile.
+	 *
+	 * The delayed job counts as queued, so wait_for_tasks_to_finish() also waits for it.
+	 */
+	void resubmit_after(std::chrono::milliseconds delay, std::function<void()> job);
+	/**
+	 * \brief Get a token which counts as a running job until it is destroyed.
+	 *
+	 * Jobs handing their work to another thread keep it until the work is finished or resubmitted,
+	 * so wait_for_tasks_to_finish() also waits for work in progress outside the pool.
+	 * The token must not outlive the Thread_pool.
+	 */
+	std::shared_ptr<void> hold();
+	/**
+	 * \brief Wait until the queue is empty, no job is running and no token of hold() is left.
+	 */
+	void wait_for_tasks_to_finish();
+	/**
+	 * \brief Returns the number of jobs waiting for a worker.
+	 */
+	size_t queue_depth() const;
+	/**
+	 * \brief Returns the number of jobs being executed at the moment.
+	 */
+	unsigned int active_count() const;
+	/**
+	 * \brief Returns the number of worker threads.
+	 */
+	unsigned int worker_count() const;
+private:
+	void work();
+	// Moves delayed jobs to the queue when they are due.
+	void schedule();
+	bool is_idle() const;
+
+	const size_t max_queue_size;
+	const Overflow_policy overflow_policy;
+	std::deque<std::function<void()>> queue;
+	// (due time : job) of delayed jobs.
+	std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> delayed;
+	unsigned int active;
+	// Number of tokens of hold() alive.
+	unsigned int held;
+	bool stopping;
+	mutable std::mutex queue_mutex;
+	std::condition_variable job_available_cv;
+	std::condition_variable space_available_cv;
+	std::condition_variable idle_cv;
+	std::condition_variable delayed_cv;
+	std::vector<std::thread> workers;
+	// Started with the first delayed job.
+	std::thread scheduler;
+};
+
+/**
+ * \brief Convert the overflow policy of the configuration ("block" or "reject") to Thread_pool::Overflow_policy.
+ */
+Thread_pool::Overflow_policy overflow_policy_from_string(const std::string &str);
+
+#endif
@@ -9,6 +9,39 @@
 
 // TODO: Consider using utility namespace and splitting the file
 
+Typed_parameters::~Typed_parameters()
+{
+	virTypedParamsFree(params, nparams);
+}
+
+void Typed_parameters::add_string(const char *name, const std::string &value)
+{
+	if (virTypedParamsAddString(&params, &nparams, &maxparams, name, value.c_str()) == -1)
+		throw std::runtime_error(std::string("Error adding typed parameter ") + name + ": " + virGetLastErrorMessage());
+}
+
+void Typed_parameters::add_int(const char *name, int value)
+{
+	if (virTypedParamsAddInt(&params, &nparams, &maxparams, name, value) == -1)
+		throw std::runtime_error(std::string("Error adding typed parameter ") + name + ": " + virGetLastErrorMessage());
+}
+
+void Typed_parameters::add_ullong(const char *name, unsigned long long value)
+{
+	if (virTypedParamsAddULLong(&params, &nparams, &maxparams, name, value) == -1)
+		throw std::runtime_error(std::string("Error adding typed parameter ") + name + ": " + virGetLastErrorMessage());
+}
+
+virTypedParameterPtr Typed_parameters::get() const
+{
+	return params;
+}
+
+int Typed_parameters::size() const
+{
+	return nparams;
+}
+
 std::string convert_and_free_cstr(char *cstr)
 {
 	std::string str;
@@ -27,6 +60,30 @@ std::string get_domain_xml(virDomainPtr domain)
 	return xml_str;
 }
 
+std::string get_domain_name(virDomainPtr domain)
+{
+	auto ret = virDomainGetName(domain);
+	if (!ret)
+		throw std::runtime_error(std::string("Error getting name of domain.") + virGetLastErrorMessage());
+	return std::string(ret);
+}
+
+std::string get_domain_uuid(virDomainPtr domain)
+{
+	char uuid[VIR_UUID_STRING_BUFLEN];
+	if (virDomainGetUUIDString(domain, uuid) == -1)
+		throw std::runtime_error(std::string("Error getting UUID of domain: ") + virGetLastErrorMessage());
+	return std::string(uuid);
+}
+
+unsigned char get_domain_state(virDomainPtr domain)
+{
+	virDomainInfo domain_info;
+	if (virDomainGetInfo(domain, &domain_info) == -1)
+		throw std::runtime_error("Failed getting domain info.");
+	return domain_info.state;
+}
+
 Memory_stats::Memory_stats(virDomainPtr domain) :
 	domain(domain)
 {
@@ -59,6 +116,45 @@ unsigned long long get_memory_size(virDomainPtr domain)
 	return mem_stats.actual_balloon;
 }
 
+unsigned int get_vcpu_count(virDomainPtr domain)
+{
+	virDomainInfo info;
+	if (virDomainGetInfo(domain, &info) == -1)
+		throw std::runtime_error(std::string("Error getting domain info: ") + virGetLastErrorMessage());
+	return info.nrVirtCpu;
+}
+
+std::vector<std::unique_ptr<virDomain, Deleter_virDomain>> get_active_domains(virConnectPtr conn)
+{
+	virDomainPtr *domains;
+	auto num = virConnectListAllDomains(conn, &domains, VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+	if (num < 0)
+		throw std::runtime_error(std::string("Error getting list of active domains: ") + virGetLastErrorMessage());
+	// Take ownership of all domains first so none is leaked if an exception is thrown.
+	std::vector<std::unique_ptr<virDomain, Deleter_virDomain>> owned_domains;
+	owned_domains.reserve(num);
+	for (int i = 0; i != num; ++i)
+		owned_domains.emplace_back(domains[i]);
+	free(domains);
+	return owned_domains;
+}
+
+int get_host_cpu_count(virConnectPtr conn)
+{
+	int cpu_count = -1;
+	if ((cpu_count = virNodeGetCPUMap(conn, nullptr, nullptr, 0)) == -1)
+		throw std::runtime_error(std::string("Error getting number of node CPUs: ") + virGetLastErrorMessage());
+	return cpu_count;
+}
+
+unsigned long long get_free_memory(virConnectPtr conn)
+{
+	auto memory = virNodeGetFreeMemory(conn);
+	if (memory == 0)
+		throw std::runtime_error(std::string("Error geting free node memory: ") + virGetLastErrorMessage());
+	return memory;
+}
+
 std::string get_hostname()
 {
 	char hostname_cstr[HOST_NAME_MAX];
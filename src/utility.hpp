@@ -3,6 +3,7 @@
 
 #include <libvirt/libvirt.h>
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -37,6 +38,27 @@ struct Deleter_virDomainSnapshot
 	}
 };
 
+// Owns a list of typed parameters built with virTypedParamsAdd*.
+class Typed_parameters
+{
+public:
+	Typed_parameters() = default;
+	Typed_parameters(const Typed_parameters &) = delete;
+	Typed_parameters & operator=(const Typed_parameters &) = delete;
+	~Typed_parameters();
+
+	void add_string(const char *name, const std::string &value);
+	void add_int(const char *name, int value);
+	void add_ullong(const char *name, unsigned long long value);
+
+	virTypedParameterPtr get() const;
+	int size() const;
+private:
+	virTypedParameterPtr params = nullptr;
+	int nparams = 0;
+	int maxparams = 0;
+};
+
 // Libvirt sometimes returns a dynamically allocated cstring.
 // As we prefer std::string this function converts and frees.
 std::string convert_and_free_cstr(char *cstr);
@@ -58,9 +80,31 @@ struct Memory_stats
 	virDomainPtr domain = nullptr;
 };
 
+// Get name of the domain
+std::string get_domain_name(virDomainPtr domain);
+
+// Get UUID of the domain
+std::string get_domain_uuid(virDomainPtr domain);
+
+// Get state of the domain as one of enum virDomainState
+unsigned char get_domain_state(virDomainPtr domain);
+
 // Get memory size in KiB
 unsigned long long get_memory_size(virDomainPtr domain);
 
+// Get number of virtual CPUs of the domain
+unsigned int get_vcpu_count(virDomainPtr domain);
+
+// Get all active domains of a connection
+std::vector<std::unique_ptr<virDomain, Deleter_virDomain>> get_active_domains(virConnectPtr conn);
+
+// Get number of CPUs of the host
+// TODO: Check for actually online CPUs
+int get_host_cpu_count(virConnectPtr conn);
+
+// Get free memory of the host in bytes
+unsigned long long get_free_memory(virConnectPtr conn);
+
 // Get hostname
 std::string get_hostname();
 
@@ -73,6 +117,15 @@ void resume_domain(virDomainPtr domain);
 // Repinning the vcpus to cpus
 void repin_vcpus(virDomainPtr domain, const std::vector<std::vector<unsigned int>> &vcpu_map);
 
+// Convert an event callback to the generic callback type expected by the register functions.
+// Libvirt casts it back to the type matching the event id before calling it.
+// Casting via void (*)() avoids the warning about casting between incompatible function types.
+template<typename Generic_callback, typename Callback>
+Generic_callback to_generic_callback(Callback callback)
+{
+	return reinterpret_cast<Generic_callback>(reinterpret_cast<void (*)()>(callback));
+}
+
 
 
 #endif
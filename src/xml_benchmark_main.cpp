@@ -0,0 +1,221 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "xml_scanner.hpp"
+#include "device_utility.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+
+// Values extracted from a domain xml, as needed by a migration.
+struct Extracted
+{
+	std::vector<std::string> hostdev_buses;
+	std::vector<std::string> shmem_names;
+	unsigned long long vcpus = 0;
+	unsigned long long memory = 0;
+
+	bool operator==(const Extracted &rhs) const
+	{
+		return hostdev_buses == rhs.hostdev_buses && shmem_names == rhs.shmem_names && vcpus == rhs.vcpus && memory == rhs.memory;
+	}
+};
+
+std::string generate_domain_xml(unsigned int disks, unsigned int interfaces, unsigned int hostdevs)
+{
+	std::string xml = "<domain type='kvm' id='1'>\n"
+		"  <name>benchmark</name>\n"
+		"  <uuid>5d2d4a8e-7a4c-4bd4-9d7e-3f1a0f3b7c11</uuid>\n"
+		"  <memory unit='KiB'>4194304</memory>\n"
+		"  <currentMemory unit='KiB'>2097152</currentMemory>\n"
+		"  <vcpu placement='static' current='4'>8</vcpu>\n"
+		"  <os>\n    <type arch='x86_64' machine='pc-i440fx-2.5'>hvm</type>\n    <boot dev='hd'/>\n  </os>\n"
+		"  <devices>\n";
+	for (unsigned int i = 0; i != disks; ++i) {
+		xml += "    <disk type='file' device='disk'>\n"
+			"      <driver name='qemu' type='qcow2'/>\n"
+			"      <source file='/var/lib/libvirt/images/disk" + std::to_string(i) + ".qcow2'/>\n"
+			"      <target dev='vd" + std::to_string(i) + "' bus='virtio'/>\n"
+			"      <address type='pci' domain='0x0000' bus='0x00' slot='0x0" + std::to_string(i % 10) + "' function='0x0'/>\n"
+			"    </disk>\n";
+	}
+	for (unsigned int i = 0; i != interfaces; ++i) {
+		xml += "    <interface type='bridge'>\n"
+			"      <mac address='52:54:00:00:00:" + std::to_string(10 + i % 90) + "'/>\n"
+			"      <source bridge='br0'/>\n"
+			"      <model type='virtio'/>\n"
+			"    </interface>\n";
+	}
+	for (unsigned int i = 0; i != hostdevs; ++i) {
+		xml += "    <hostdev mode='subsystem' type='pci' managed='yes'>\n"
+			"      <source>\n"
+			"        <address domain='0x0000' bus='0x" + std::to_string(10 + i % 90) + "' slot='0x00' function='0x1'/>\n"
+			"      </source>\n"
+			"    </hostdev>\n";
+	}
+	xml += "    <shmem name='ivshmem'>\n"
+		"      <model type='ivshmem-plain'/>\n"
+		"      <size unit='M'>64</size>\n"
+		"      <alias name='shmem0'/>\n"
+		"    </shmem>\n"
+		"  </devices>\n"
+		"</domain>\n";
+	return xml;
+}
+
+Extracted extract_with_ptree(const std::string &xml)
+{
+	Extracted extracted;
+	auto domain_ptree = read_xml_from_string(xml);
+	const auto &domain_node = domain_ptree.get_child("domain");
+	for (const auto &device : domain_node.get_child("devices")) {
+		if (device.first == "hostdev")
+			extracted.hostdev_buses.push_back(device.second.get<std::string>("source.address.<xmlattr>.bus"));
+		else if (device.first == "shmem")
+			extracted.shmem_names.push_back(device.second.get<std::string>("alias.<xmlattr>.name"));
+	}
+	extracted.vcpus = domain_node.get<unsigned long long>("vcpu.<xmlattr>.current");
+	extracted.memory = domain_node.get<unsigned long long>("currentMemory");
+	return extracted;
+}
+
+Extracted extract_with_scanner(const std::string &xml)
+{
+	Extracted extracted;
+	Xml_scanner scanner(xml);
+	if (scanner.next() != Xml_scanner::Token::start_element)
+		throw std::runtime_error("No root element.");
+	while (scanner.next_child(1)) {
+		auto name = scanner.get_name();
+		if (name == "vcpu") {
+			extracted.vcpus = to_unsigned(scanner.get_attribute("current"));
+		} else if (name == "currentMemory") {
+			extracted.memory = to_unsigned(scanner.read_text());
+		} else if (name == "devices") {
+			while (scanner.next_child(2)) {
+				if (scanner.get_name() == "hostdev") {
+					while (scanner.next_child(3)) {
+						if (scanner.get_name() != "source")
+							continue;
+						while (scanner.next_child(4)) {
+							auto bus = scanner.get_attribute("bus");
+							extracted.hostdev_buses.emplace_back(bus.data(), bus.size());
+						}
+					}
+				} else if (scanner.get_name() == "shmem") {
+					while (scanner.next_child(3)) {
+						if (scanner.get_name() == "alias")
+							extracted.shmem_names.push_back(decode_xml(scanner.get_attribute("name")));
+					}
+				}
+			}
+		}
+	}
+	return extracted;
+}
+
+std::string render_with_ptree(unsigned int bus)
+{
+	boost::property_tree::ptree hostdev_ptree;
+	hostdev_ptree.put("hostdev.<xmlattr>.mode", "subsystem");
+	hostdev_ptree.put("hostdev.<xmlattr>.type", "pci");
+	hostdev_ptree.put("hostdev.<xmlattr>.managed", "yes");
+	hostdev_ptree.put("hostdev.source.address.<xmlattr>.domain", to_hex_string(0, 4));
+	hostdev_ptree.put("hostdev.source.address.<xmlattr>.bus", to_hex_string(bus, 2));
+	hostdev_ptree.put("hostdev.source.address.<xmlattr>.slot", to_hex_string(0, 2));
+	hostdev_ptree.put("hostdev.source.address.<xmlattr>.function", to_hex_string(1, 1));
+	return write_xml_to_string(hostdev_ptree);
+}
+
+std::string render_with_writer(unsigned int bus)
+{
+	Xml_writer writer;
+	writer.start_element("hostdev")
+		.attribute("mode", "subsystem")
+		.attribute("type", "pci")
+		.attribute("managed", "yes")
+		.start_element("source")
+		.start_element("address")
+		.attribute("domain", to_hex_string(0, 4))
+		.attribute("bus", to_hex_string(bus, 2))
+		.attribute("slot", to_hex_string(0, 2))
+		.attribute("function", to_hex_string(1, 1))
+		.end_element()
+		.end_element()
+		.end_element();
+	return writer.str();
+}
+
+// Returns the average duration of a call in microseconds.
+double measure(unsigned int n, const std::function<void(unsigned int)> &func)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i != n; ++i)
+		func(i);
+	std::chrono::duration<double, std::micro> duration = std::chrono::steady_clock::now() - start;
+	return duration.count() / n;
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+		unsigned int n;
+		unsigned int disks;
+		unsigned int interfaces;
+		unsigned int hostdevs;
+
+		namespace po = boost::program_options;
+		po::options_description desc("Options");
+		desc.add_options()
+			("help,h", "produce help message")
+			(",n", po::value<decltype(n)>(&n)->default_value(10000), "run each benchmark n times")
+			("disks,d", po::value<decltype(disks)>(&disks)->default_value(16), "number of disks in the domain xml")
+			("interfaces,i", po::value<decltype(interfaces)>(&interfaces)->default_value(8), "number of network interfaces in the domain xml")
+			("hostdevs,p", po::value<decltype(hostdevs)>(&hostdevs)->default_value(4), "number of PCI hostdevs in the domain xml");
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return EXIT_SUCCESS;
+		}
+		po::notify(vm);
+		if (n == 0) {
+			std::cout << "n is set to 0 -> exit immediately." << std::endl;
+			return EXIT_SUCCESS;
+		}
+
+		auto xml = generate_domain_xml(disks, interfaces, hostdevs);
+		if (!(extract_with_ptree(xml) == extract_with_scanner(xml)))
+			throw std::runtime_error("property_tree and scanner extract different values.");
+		std::cout << "Domain xml of " << xml.size() << " bytes with " << disks << " disks, " << interfaces << " interfaces and " << hostdevs << " hostdevs." << std::endl;
+
+		size_t sink = 0;
+		auto ptree_parse = measure(n, [&](unsigned int) {sink += extract_with_ptree(xml).hostdev_buses.size();});
+		auto scanner_parse = measure(n, [&](unsigned int) {sink += extract_with_scanner(xml).hostdev_buses.size();});
+		auto ptree_render = measure(n, [&](unsigned int i) {sink += render_with_ptree(i % 256).size();});
+		auto writer_render = measure(n, [&](unsigned int i) {sink += render_with_writer(i % 256).size();});
+
+		std::cout << "Results (average of " << n << " runs):" << std::endl;
+		std::cout << "parse domain xml:  property_tree " << ptree_parse << " usec, scanner " << scanner_parse << " usec (x" << ptree_parse / scanner_parse << ")" << std::endl;
+		std::cout << "render hostdev:    property_tree " << ptree_render << " usec, writer " << writer_render << " usec (x" << ptree_render / writer_render << ")" << std::endl;
+		// Print sink so the work is not optimized away.
+		std::cout << "(" << sink << ")" << std::endl;
+		return EXIT_SUCCESS;
+	} catch (const std::exception &e) {
+		std::cout << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,416 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "xml_scanner.hpp"
+
+#include <stdexcept>
+#include <limits>
+
+bool is_xml_whitespace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+boost::string_ref trim_xml_whitespace(boost::string_ref str)
+{
+	while (!str.empty() && is_xml_whitespace(str.front()))
+		str.remove_prefix(1);
+	while (!str.empty() && is_xml_whitespace(str.back()))
+		str.remove_suffix(1);
+	return str;
+}
+
+//
+// Xml_scanner implementation
+//
+
+Xml_scanner::Xml_scanner(boost::string_ref document) :
+	document(document),
+	pos(0),
+	token(Token::text),
+	depth(0),
+	pending_end(false)
+{
+}
+
+Xml_scanner::Token Xml_scanner::next()
+{
+	// The element returned last is closed now.
+	if (token == Token::end_element)
+		--depth;
+	if (pending_end) {
+		pending_end = false;
+		return token = Token::end_element;
+	}
+	while (pos < document.size()) {
+		auto rest = document.substr(pos);
+		if (rest.front() != '<') {
+			auto end = rest.find('<');
+			if (end == boost::string_ref::npos)
+				end = rest.size();
+			pos += end;
+			auto trimmed = trim_xml_whitespace(rest.substr(0, end));
+			// Whitespace between elements is not returned.
+			if (trimmed.empty() || depth == 0)
+				continue;
+			text = trimmed;
+			return token = Token::text;
+		}
+		if (rest.starts_with("<!--")) {
+			auto end = rest.find("-->");
+			if (end == boost::string_ref::npos)
+				throw std::runtime_error("Malformed xml: Unterminated comment.");
+			pos += end + 3;
+			continue;
+		}
+		if (rest.starts_with("<![CDATA[")) {
+			auto end = rest.find("]]>");
+			if (end == boost::string_ref::npos)
+				throw std::runtime_error("Malformed xml: Unterminated CDATA section.");
+			text = rest.substr(9, end - 9);
+			pos += end + 3;
+			return token = Token::text;
+		}
+		if (rest.starts_with("<?") || rest.starts_with("<!")) {
+			auto end = rest.find('>');
+			if (end == boost::string_ref::npos)
+				throw std::runtime_error("Malformed xml: Unterminated markup.");
+			pos += end + 1;
+			continue;
+		}
+		if (rest.starts_with("</")) {
+			auto end = rest.find('>');
+			if (end == boost::string_ref::npos || depth == 0)
+				throw std::runtime_error("Malformed xml: Unexpected end tag.");
+			name = trim_xml_whitespace(rest.substr(2, end - 2));
+			pos += end + 1;
+			return token = Token::end_element;
+		}
+		// Find the end of the start tag, '>' may be part of an attribute value.
+		size_t end = 1;
+		char quote = 0;
+		for (; end != rest.size(); ++end) {
+			auto c = rest[end];
+			if (quote != 0) {
+				if (c == quote)
+					quote = 0;
+			} else if (c == '"' || c == '\'') {
+				quote = c;
+			} else if (c == '>') {
+				break;
+			}
+		}
+		if (end == rest.size())
+			throw std::runtime_error("Malformed xml: Unterminated start tag.");
+		auto tag = rest.substr(1, end - 1);
+		pos += end + 1;
+		pending_end = !tag.empty() && tag.back() == '/';
+		if (pending_end)
+			tag.remove_suffix(1);
+		auto name_end = tag.find_first_of(" \t\n\r");
+		name = tag.substr(0, name_end);
+		attributes = (name_end == boost::string_ref::npos) ? boost::string_ref() : tag.substr(name_end);
+		if (name.empty())
+			throw std::runtime_error("Malformed xml: Start tag without name.");
+		++depth;
+		return token = Token::start_element;
+	}
+	if (depth != 0)
+		throw std::runtime_error("Malformed xml: Unexpected end of document.");
+	return token = Token::end_of_document;
+}
+
+boost::string_ref Xml_scanner::get_name() const
+{
+	return name;
+}
+
+boost::string_ref Xml_scanner::get_text() const
+{
+	return text;
+}
+
+/**
+ * \brief Split the next attribute off the attributes of a start tag.
+ *
+ * \returns False if no attribute is left.
+ */
+bool next_xml_attribute(boost::string_ref &rest, boost::string_ref &name, boost::string_ref &value)
+{
+	rest = trim_xml_whitespace(rest);
+	if (rest.empty())
+		return false;
+	auto equals = rest.find('=');
+	if (equals == boost::string_ref::npos)
+		throw std::runtime_error("Malformed xml: Attribute without value.");
+	name = trim_xml_whitespace(rest.substr(0, equals));
+	rest = trim_xml_whitespace(rest.substr(equals + 1));
+	if (rest.empty() || (rest.front() != '"' && rest.front() != '\''))
+		throw std::runtime_error("Malformed xml: Unquoted attribute value.");
+	auto value_end = rest.substr(1).find(rest.front());
+	if (value_end == boost::string_ref::npos)
+		throw std::runtime_error("Malformed xml: Unterminated attribute value.");
+	value = rest.substr(1, value_end);
+	rest = rest.substr(value_end + 2);
+	return true;
+}
+
+boost::string_ref Xml_scanner::get_attribute(boost::string_ref attribute_name, boost::string_ref default_value) const
+{
+	auto rest = attributes;
+	boost::string_ref name;
+	boost::string_ref value;
+	while (next_xml_attribute(rest, name, value)) {
+		if (name == attribute_name)
+			return value;
+	}
+	return default_value;
+}
+
+std::vector<std::pair<boost::string_ref, boost::string_ref>> Xml_scanner::get_attributes() const
+{
+	std::vector<std::pair<boost::string_ref, boost::string_ref>> name_value_pairs;
+	auto rest = attributes;
+	boost::string_ref name;
+	boost::string_ref value;
+	while (next_xml_attribute(rest, name, value))
+		name_value_pairs.emplace_back(name, value);
+	return name_value_pairs;
+}
+
+unsigned int Xml_scanner::get_depth() const
+{
+	return depth;
+}
+
+bool Xml_scanner::next_child(unsigned int parent_depth)
+{
+	while (true) {
+		switch (next()) {
+		case Token::start_element:
+			if (depth == parent_depth + 1)
+				return true;
+			break;
+		case Token::end_element:
+			if (depth == parent_depth)
+				return false;
+			break;
+		case Token::end_of_document:
+			return false;
+		case Token::text:
+			break;
+		}
+	}
+}
+
+boost::string_ref Xml_scanner::read_text()
+{
+	if (token != Token::start_element)
+		throw std::runtime_error("Reading text requires a start element.");
+	auto element_depth = depth;
+	boost::string_ref element_text;
+	while (!(next() == Token::end_element && depth == element_depth)) {
+		if (token == Token::text && depth == element_depth && element_text.empty())
+			element_text = text;
+		else if (token == Token::end_of_document)
+			throw std::runtime_error("Malformed xml: Unexpected end of document.");
+	}
+	return element_text;
+}
+
+//
+// Xml_writer implementation
+//
+
+/**
+ * \brief Append a string and replace the characters which must not occur in attribute values or text.
+ */
+void append_escaped(std::string &buffer, boost::string_ref str)
+{
+	for (auto c : str) {
+		switch (c) {
+		case '&': buffer += "&amp;"; break;
+		case '<': buffer += "&lt;"; break;
+		case '>': buffer += "&gt;"; break;
+		case '"': buffer += "&quot;"; break;
+		case '\'': buffer += "&apos;"; break;
+		default: buffer += c;
+		}
+	}
+}
+
+Xml_writer::Xml_writer(size_t capacity) :
+	start_tag_open(false)
+{
+	buffer.reserve(capacity);
+}
+
+void Xml_writer::close_start_tag()
+{
+	if (start_tag_open) {
+		buffer += '>';
+		start_tag_open = false;
+	}
+}
+
+Xml_writer & Xml_writer::start_element(boost::string_ref name)
+{
+	close_start_tag();
+	buffer += '<';
+	open_elements.emplace_back(buffer.size(), name.size());
+	buffer.append(name.data(), name.size());
+	start_tag_open = true;
+	return *this;
+}
+
+Xml_writer & Xml_writer::attribute(boost::string_ref name, boost::string_ref value)
+{
+	if (!start_tag_open)
+		throw std::runtime_error("Attributes must be added before the content of an element.");
+	buffer += ' ';
+	buffer.append(name.data(), name.size());
+	buffer += "=\"";
+	append_escaped(buffer, value);
+	buffer += '"';
+	return *this;
+}
+
+Xml_writer & Xml_writer::text(boost::string_ref value)
+{
+	if (open_elements.empty())
+		throw std::runtime_error("Text must be added to an element.");
+	close_start_tag();
+	append_escaped(buffer, value);
+	return *this;
+}
+
+Xml_writer & Xml_writer::end_element()
+{
+	if (open_elements.empty())
+		throw std::runtime_error("No element to end.");
+	if (start_tag_open) {
+		buffer += "/>";
+		start_tag_open = false;
+	} else {
+		buffer += "</";
+		// The name is copied from the start tag.
+		auto name = open_elements.back();
+		buffer.append(buffer, name.first, name.second);
+		buffer += '>';
+	}
+	open_elements.pop_back();
+	return *this;
+}
+
+Xml_writer & Xml_writer::element(boost::string_ref name, boost::string_ref value)
+{
+	return start_element(name).text(value).end_element();
+}
+
+const std::string & Xml_writer::str() const
+{
+	if (!open_elements.empty())
+		throw std::runtime_error("Not all elements are ended.");
+	return buffer;
+}
+
+//
+// Helper implementation
+//
+
+/**
+ * \brief Append the UTF-8 encoding of a character reference.
+ */
+void append_utf8(std::string &buffer, unsigned long long code_point)
+{
+	if (code_point == 0 || (code_point >= 0xd800 && code_point <= 0xdfff) || code_point > 0x10ffff)
+		throw std::runtime_error("Malformed xml: Invalid character reference " + std::to_string(code_point) + ".");
+	if (code_point < 0x80) {
+		buffer += static_cast<char>(code_point);
+	} else if (code_point < 0x800) {
+		buffer += static_cast<char>(0xc0 | (code_point >> 6));
+		buffer += static_cast<char>(0x80 | (code_point & 0x3f));
+	} else if (code_point < 0x10000) {
+		buffer += static_cast<char>(0xe0 | (code_point >> 12));
+		buffer += static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+		buffer += static_cast<char>(0x80 | (code_point & 0x3f));
+	} else {
+		buffer += static_cast<char>(0xf0 | (code_point >> 18));
+		buffer += static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+		buffer += static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+		buffer += static_cast<char>(0x80 | (code_point & 0x3f));
+	}
+}
+
+std::string decode_xml(boost::string_ref str)
+{
+	std::string decoded;
+	decoded.reserve(str.size());
+	while (!str.empty()) {
+		auto amp = str.find('&');
+		decoded.append(str.data(), std::min(amp, str.size()));
+		if (amp == boost::string_ref::npos)
+			break;
+		str.remove_prefix(amp);
+		auto semicolon = str.find(';');
+		if (semicolon == boost::string_ref::npos)
+			throw std::runtime_error("Malformed xml: Unterminated entity.");
+		auto entity = str.substr(1, semicolon - 1);
+		if (entity == "amp")
+			decoded += '&';
+		else if (entity == "lt")
+			decoded += '<';
+		else if (entity == "gt")
+			decoded += '>';
+		else if (entity == "quot")
+			decoded += '"';
+		else if (entity == "apos")
+			decoded += '\'';
+		else if (entity.starts_with("#x"))
+			append_utf8(decoded, to_unsigned(entity.substr(2), 16));
+		else if (entity.starts_with('#'))
+			append_utf8(decoded, to_unsigned(entity.substr(1)));
+		else
+			throw std::runtime_error("Malformed xml: Unknown entity \"" + std::string(entity.data(), entity.size()) + "\".");
+		str.remove_prefix(semicolon + 1);
+	}
+	return decoded;
+}
+
+unsigned long long to_unsigned(boost::string_ref str, int base)
+{
+	str = trim_xml_whitespace(str);
+	if (base == 0) {
+		if (str.starts_with("0x") || str.starts_with("0X")) {
+			str.remove_prefix(2);
+			base = 16;
+		} else {
+			base = 10;
+		}
+	}
+	if (str.empty())
+		throw std::runtime_error("Cannot convert an empty string to a number.");
+	unsigned long long value = 0;
+	for (auto c : str) {
+		unsigned int digit;
+		if (c >= '0' && c <= '9')
+			digit = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			digit = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			digit = c - 'A' + 10;
+		else
+			digit = base;
+		if (digit >= static_cast<unsigned int>(base))
+			throw std::runtime_error("\"" + std::string(str.data(), str.size()) + "\" is not a number of base " + std::to_string(base) + ".");
+		if (value > (std::numeric_limits<unsigned long long>::max() - digit) / base)
+			throw std::runtime_error("\"" + std::string(str.data(), str.size()) + "\" is out of range.");
+		value = value * base + digit;
+	}
+	return value;
+}
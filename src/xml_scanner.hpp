@@ -0,0 +1,140 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef XML_SCANNER_HPP
+#define XML_SCANNER_HPP
+
+#include <boost/utility/string_ref.hpp>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+/**
+ * \brief A pull parser which reads an xml document in place.
+ *
+ * Names, attribute values and text are references into the document, so scanning does not allocate.
+ * The document has to outlive the scanner and all references returned.
+ * Comments, processing instructions and the doctype are skipped. Entities are not decoded, see decode_xml().
+ * Malformed documents lead to a std::runtime_error.
+ */
+class Xml_scanner
+{
+public:
+	enum class Token
+	{
+		start_element,
+		end_element,
+		text,
+		end_of_document
+	};
+
+	explicit Xml_scanner(boost::string_ref document);
+
+	/**
+	 * \brief Advance to the next token.
+	 *
+	 * An empty element (e.g. <a/>) yields a start_element followed by an end_element.
+	 */
+	Token next();
+	/**
+	 * \brief Get the name of the current start or end element.
+	 */
+	boost::string_ref get_name() const;
+	/**
+	 * \brief Get the current text with surrounding whitespace removed.
+	 */
+	boost::string_ref get_text() const;
+	/**
+	 * \brief Get the value of an attribute of the current start element.
+	 *
+	 * \returns The default value if the element does not have the attribute.
+	 */
+	boost::string_ref get_attribute(boost::string_ref name, boost::string_ref default_value = boost::string_ref()) const;
+	/**
+	 * \brief Get all attributes of the current start element as (name : value) pairs.
+	 */
+	std::vector<std::pair<boost::string_ref, boost::string_ref>> get_attributes() const;
+	/**
+	 * \brief Get the depth of the current element. The root element has depth 1.
+	 */
+	unsigned int get_depth() const;
+	/**
+	 * \brief Advance to the next child of the element at parent_depth.
+	 *
+	 * Deeper elements are skipped.
+	 * \returns False if the end of the parent element or of the document is reached.
+	 */
+	bool next_child(unsigned int parent_depth);
+	/**
+	 * \brief Read the text of the current start element and advance to its end.
+	 */
+	boost::string_ref read_text();
+private:
+	boost::string_ref document;
+	size_t pos;
+	Token token;
+	boost::string_ref name;
+	boost::string_ref text;
+	// Everything between the name and the end of the start tag.
+	boost::string_ref attributes;
+	// Number of open elements.
+	unsigned int depth;
+	// The end of an empty element is yet to be returned.
+	bool pending_end;
+};
+
+/**
+ * \brief Writes an xml document without indentation into a single string.
+ *
+ * Attribute values and text are escaped.
+ */
+class Xml_writer
+{
+public:
+	explicit Xml_writer(size_t capacity = 256);
+
+	Xml_writer & start_element(boost::string_ref name);
+	/**
+	 * \brief Add an attribute to the current start element. Must be called before any content is added.
+	 */
+	Xml_writer & attribute(boost::string_ref name, boost::string_ref value);
+	Xml_writer & text(boost::string_ref value);
+	Xml_writer & end_element();
+	/**
+	 * \brief Write an element with text only.
+	 */
+	Xml_writer & element(boost::string_ref name, boost::string_ref value);
+	/**
+	 * \brief Get the document. All elements have to be ended.
+	 */
+	const std::string & str() const;
+private:
+	void close_start_tag();
+
+	std::string buffer;
+	// (position : length) of the names of the open elements in buffer.
+	std::vector<std::pair<size_t, size_t>> open_elements;
+	bool start_tag_open;
+};
+
+/**
+ * \brief Replace the predefined entities and character references.
+ *
+ * Character references are encoded as UTF-8. Throws if a reference is not a valid character.
+ */
+std::string decode_xml(boost::string_ref str);
+
+/**
+ * \brief Convert a string to an unsigned integer.
+ *
+ * \param base The base of the number or 0 to detect a hexadecimal number by its "0x" prefix.
+ */
+unsigned long long to_unsigned(boost::string_ref str, int base = 10);
+
+#endif